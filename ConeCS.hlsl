@@ -0,0 +1,35 @@
+//--------------------------------------------------------------------------------------
+// File: ConeCS.hlsl
+//
+// Cone marching pre-pass of the compute shader path. One thread per block of pixels
+// marches the cone around the block's rays and stores how far they can all skip. The
+// top level starts at the eye; finer levels start from the enclosing coarse block.
+//
+//--------------------------------------------------------------------------------------
+#include "frac.fx"
+#include "mandelbulb.fx"
+
+StructuredBuffer<float> ParentDist : register( t1 );
+RWStructuredBuffer<float> BlockDist : register( u0 );
+
+[numthreads(8, 8, 1)]
+void ConeCS( uint3 id : SV_DispatchThreadID )
+{
+    uint2 p0 = id.xy * BlockSize;
+    if (p0.x >= Size.x || p0.y >= Size.y) return;
+    uint2 p1 = min(p0 + BlockSize, Size) - 1;
+
+    Ray ray;
+    float k;
+    GetBlockCone(p0, p1, Size, ray, k);
+
+    // The parent cone is empty up to that distance along its axis, which covers this
+    // cone up to the same distance times cos(atan(k))
+    float t = 0;
+    if (ParentBlockSize > 0)
+    {
+        uint2 parent = p0 / ParentBlockSize;
+        t = ParentDist[parent.y * ParentBlocksX + parent.x] * rsqrt(1 + k * k);
+    }
+    BlockDist[id.y * BlocksX + id.x] = cone_marching(ray, k, t);
+}
@@ -7,6 +7,7 @@
 #include "frac.fx"
 
 
+// MandelboxDE<T> in fracde.h is the CPU version of this function, change both together
 float DE(float3 p)
 {
     const float scale = 9;
@@ -25,6 +26,21 @@ float DE(float3 p)
     return ((length(c.xyz) - (scale - 1)) / c.w - pow(scale, -3));
 }
 
+// The shader runs too few folds for the usual bound on the mandelbox, so frac.cpp probes
+// the radius of the surface on the CPU (GetFractalRadius in cpude.h) and passes it here
+// with a 10% margin
+cbuffer cbMandelbox : register( b2 )
+{
+    float BoundRadius;
+    float3 padMandelbox;
+}
+
+// Fewer folds change the shape instead of just dropping detail, so no iteration LOD here
+float DELod(float3 p, float eps)
+{
+    return DE(p);
+}
+
 #include "raymarch.fx"
 
 float4 shade(Ray ray)
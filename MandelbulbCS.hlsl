@@ -0,0 +1,37 @@
+//--------------------------------------------------------------------------------------
+// File: MandelbulbCS.hlsl
+//
+// Compute shader path of mandelbulb rendering. Each ray starts at the distance found
+// by ConeCS for its block. CS4.0 cannot write to textures, so MandelbulbCS writes the
+// image to a structured buffer and BlitPS copies it to the back buffer.
+//
+//--------------------------------------------------------------------------------------
+#include "frac.fx"
+#include "mandelbulb.fx"
+
+StructuredBuffer<float> ConeDist : register( t1 );
+StructuredBuffer<float4> Image : register( t2 );
+RWStructuredBuffer<float4> Output : register( u0 );
+
+[numthreads(8, 8, 1)]
+void MandelbulbCS( uint3 id : SV_DispatchThreadID )
+{
+    if (id.x >= Size.x || id.y >= Size.y) return;
+
+    Ray ray;
+    GetRay((id.xy + 0.5) / Size, ray);
+    uint2 block = id.xy / BlockSize;
+    ray.pos += ConeDist[block.y * BlocksX + block.x] * ray.dir;
+
+    float4 radiance = shade(ray);
+
+    float3 col = float3(0.02, 0.02, 0.02);
+    col = lerp(col, radiance.rgb, radiance.a);
+    Output[id.y * Size.x + id.x] = float4(pow(col, 0.45), 1);
+}
+
+float4 BlitPS( QuadVS_Output Input ) : SV_TARGET
+{
+    uint2 p = (uint2)Input.Pos.xy;
+    return Image[p.y * Size.x + p.x];
+}
@@ -0,0 +1,306 @@
+//--------------------------------------------------------------------------------------
+// File: brickpager.cpp
+//
+// Memory-mapped brick file with an LRU of mapped chunks, see brickpager.h.
+//
+// One mutex guards the chunk table, the LRU list and the prefetch queue. It is never
+// held while a chunk is being mapped or touched, only while the bookkeeping changes;
+// unmapping happens under it so no Lock can hand out a chunk that is going away.
+//--------------------------------------------------------------------------------------
+#include "brickpager.h"
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Size chunks aim for: big enough that mapping one is cheap next to reading it, small
+// enough that a budget of a few MB holds dozens of them
+static const size_t CHUNK_TARGET = 256 << 10;
+
+// Chunk states, kept in Chunk::bBusy and Chunk::pView: unmapped (false, NULL), queued or
+// being mapped (true, NULL), mapped (false, view)
+
+CBrickPager::CBrickPager() :
+    m_hFile( NULL ),
+    m_hMapping( NULL ),
+    m_nFile( -1 ),
+    m_nOffset( 0 ),
+    m_nBrickSize( 0 ),
+    m_nBricks( 0 ),
+    m_nBricksPerChunk( 0 ),
+    m_nChunkSize( 0 ),
+    m_nFileSize( 0 ),
+    m_nBudget( 0 ),
+    m_bQuit( false )
+{
+    memset( &m_Stats, 0, sizeof( m_Stats ) );
+}
+
+CBrickPager::~CBrickPager()
+{
+    Close();
+}
+
+bool CBrickPager::Open( const wchar_t* szFile, unsigned long long nOffset, size_t nBrickSize, unsigned int nBricks,
+                        size_t nBudget, unsigned int nPrefetchThreads )
+{
+    Close();
+    if( nBrickSize == 0 || nBricks == 0 || nOffset % BRICKPAGER_ALIGNMENT != 0 )
+        return false;
+
+#ifdef _WIN32
+    HANDLE hFile = CreateFileW( szFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS,
+                                NULL );
+    if( hFile == INVALID_HANDLE_VALUE )
+        return false;
+    LARGE_INTEGER size;
+    HANDLE hMapping = GetFileSizeEx( hFile, &size ) ? CreateFileMappingW( hFile, NULL, PAGE_READONLY, 0, 0, NULL ) : NULL;
+    if( !hMapping )
+    {
+        CloseHandle( hFile );
+        return false;
+    }
+    m_hFile = hFile;
+    m_hMapping = hMapping;
+    m_nFileSize = ( unsigned long long )size.QuadPart;
+#else
+    char szName[1024];
+    if( wcstombs( szName, szFile, sizeof( szName ) ) == ( size_t )-1 )
+        return false;
+    int nFile = open( szName, O_RDONLY );
+    if( nFile < 0 )
+        return false;
+    struct stat st;
+    if( fstat( nFile, &st ) != 0 )
+    {
+        close( nFile );
+        return false;
+    }
+    m_nFile = nFile;
+    m_nFileSize = ( unsigned long long )st.st_size;
+#endif
+
+    // Chunks start on the alignment too: a whole number of the smallest run of bricks
+    // that ends on it
+    size_t nGcd = BRICKPAGER_ALIGNMENT, nRem = nBrickSize;
+    while( nRem != 0 )
+    {
+        size_t t = nGcd % nRem;
+        nGcd = nRem;
+        nRem = t;
+    }
+    const size_t nRun = ( size_t )BRICKPAGER_ALIGNMENT / nGcd;
+    const size_t nRuns = CHUNK_TARGET / ( nRun * nBrickSize );
+    m_nBricksPerChunk = ( unsigned int )( nRun * ( ( nRuns > 1 ) ? nRuns : 1 ) );
+    m_nChunkSize = m_nBricksPerChunk * nBrickSize;
+    m_nOffset = nOffset;
+    m_nBrickSize = nBrickSize;
+    m_nBricks = nBricks;
+    m_nBudget = nBudget;
+    if( m_nOffset + ( unsigned long long )nBricks * nBrickSize > m_nFileSize )
+    {
+        Close();
+        return false;
+    }
+
+    Chunk chunk = { NULL, 0, false, m_LRU.end() };
+    m_Chunks.assign( ( nBricks + m_nBricksPerChunk - 1 ) / m_nBricksPerChunk, chunk );
+    memset( &m_Stats, 0, sizeof( m_Stats ) );
+    m_bQuit = false;
+    for( unsigned int i = 0; i < nPrefetchThreads; ++i )
+        m_Threads.push_back( std::thread( &CBrickPager::ThreadProc, this ) );
+    return true;
+}
+
+void CBrickPager::Close()
+{
+    {
+        std::lock_guard<std::mutex> lock( m_Lock );
+        m_bQuit = true;
+    }
+    m_Queued.notify_all();
+    for( size_t i = 0; i < m_Threads.size(); ++i )
+        m_Threads[i].join();
+    m_Threads.clear();
+    m_Queue.clear();
+
+    for( unsigned int i = 0; i < ( unsigned int )m_Chunks.size(); ++i )
+        if( m_Chunks[i].pView )
+            UnmapChunk( i );
+    m_Chunks.clear();
+    m_LRU.clear();
+
+#ifdef _WIN32
+    if( m_hMapping ) CloseHandle( ( HANDLE )m_hMapping );
+    if( m_hFile ) CloseHandle( ( HANDLE )m_hFile );
+#else
+    if( m_nFile >= 0 ) close( m_nFile );
+#endif
+    m_hFile = m_hMapping = NULL;
+    m_nFile = -1;
+    m_nBricks = 0;
+    m_Stats.nResident = 0;
+}
+
+size_t CBrickPager::ChunkLength( unsigned int nChunk ) const
+{
+    const unsigned int nFirst = nChunk * m_nBricksPerChunk;
+    return ( ( m_nBricks - nFirst < m_nBricksPerChunk ) ? m_nBricks - nFirst : m_nBricksPerChunk ) * m_nBrickSize;
+}
+
+void* CBrickPager::MapChunk( unsigned int nChunk )
+{
+    const unsigned long long nStart = m_nOffset + ( unsigned long long )nChunk * m_nChunkSize;
+#ifdef _WIN32
+    return MapViewOfFile( ( HANDLE )m_hMapping, FILE_MAP_READ, ( DWORD )( nStart >> 32 ), ( DWORD )nStart,
+                          ChunkLength( nChunk ) );
+#else
+    void* pView = mmap( NULL, ChunkLength( nChunk ), PROT_READ, MAP_SHARED, m_nFile, ( off_t )nStart );
+    return ( pView == MAP_FAILED ) ? NULL : pView;
+#endif
+}
+
+void CBrickPager::UnmapChunk( unsigned int nChunk )
+{
+    Chunk& c = m_Chunks[nChunk];
+#ifdef _WIN32
+    UnmapViewOfFile( c.pView );
+#else
+    munmap( ( void* )c.pView, ChunkLength( nChunk ) );
+#endif
+    c.pView = NULL;
+    m_LRU.erase( c.itLRU );
+    c.itLRU = m_LRU.end();
+    m_Stats.nResident -= ChunkLength( nChunk );
+}
+
+// Called with m_Lock held, for a chunk that was busy; pView NULL if mapping failed
+void CBrickPager::Install( unsigned int nChunk, void* pView )
+{
+    Chunk& c = m_Chunks[nChunk];
+    c.bBusy = false;
+    if( pView )
+    {
+        c.pView = ( const char* )pView;
+        m_LRU.push_front( nChunk );
+        c.itLRU = m_LRU.begin();
+        m_Stats.nResident += ChunkLength( nChunk );
+
+        // Least recently used first, never the new one or a locked one
+        std::list<unsigned int>::iterator it = m_LRU.end();
+        while( m_Stats.nResident > m_nBudget && it != m_LRU.begin() )
+        {
+            --it;
+            const unsigned int nOld = *it;
+            if( nOld == nChunk || m_Chunks[nOld].nLocks > 0 )
+                continue;
+            ++it;
+            UnmapChunk( nOld );
+            ++m_Stats.nEvicted;
+        }
+    }
+    m_Mapped.notify_all();
+}
+
+const void* CBrickPager::Lock( unsigned int nBrick )
+{
+    const unsigned int nChunk = nBrick / m_nBricksPerChunk;
+    std::unique_lock<std::mutex> lock( m_Lock );
+    Chunk& c = m_Chunks[nChunk];
+    if( c.pView )
+    {
+        ++m_Stats.nHits;
+        m_LRU.splice( m_LRU.begin(), m_LRU, c.itLRU );
+    }
+    else
+    {
+        ++m_Stats.nMisses;
+        while( !c.pView )
+        {
+            if( c.bBusy )
+            {
+                // Queued or being mapped by a prefetch thread
+                m_Mapped.wait( lock );
+                continue;
+            }
+            c.bBusy = true;
+            lock.unlock();
+            void* pView = MapChunk( nChunk );
+            lock.lock();
+            Install( nChunk, pView );
+            if( !pView )
+                return NULL;
+        }
+    }
+    ++c.nLocks;
+    return c.pView + ( size_t )( nBrick % m_nBricksPerChunk ) * m_nBrickSize;
+}
+
+void CBrickPager::Unlock( unsigned int nBrick )
+{
+    std::lock_guard<std::mutex> lock( m_Lock );
+    --m_Chunks[nBrick / m_nBricksPerChunk].nLocks;
+}
+
+void CBrickPager::Prefetch( unsigned int nBrick )
+{
+    if( m_Threads.empty() || nBrick >= m_nBricks )
+        return;
+    const unsigned int nChunk = nBrick / m_nBricksPerChunk;
+    {
+        std::lock_guard<std::mutex> lock( m_Lock );
+        Chunk& c = m_Chunks[nChunk];
+        if( c.pView || c.bBusy )
+            return;
+        c.bBusy = true;
+        m_Queue.push_back( nChunk );
+    }
+    m_Queued.notify_one();
+}
+
+void CBrickPager::ThreadProc()
+{
+    std::unique_lock<std::mutex> lock( m_Lock );
+    for( ;; )
+    {
+        while( !m_bQuit && m_Queue.empty() )
+            m_Queued.wait( lock );
+        if( m_bQuit )
+            return;
+        const unsigned int nChunk = m_Queue.front();
+        m_Queue.pop_front();
+        lock.unlock();
+
+        // Touch a byte of every page, so the reads happen here and not in Lock's caller
+        void* pView = MapChunk( nChunk );
+        if( pView )
+        {
+            volatile const char* p = ( const char* )pView;
+            char nSum = 0;
+            const size_t nLength = ChunkLength( nChunk );
+            for( size_t i = 0; i < nLength; i += 4096 )
+                nSum += p[i];
+            ( void )nSum;
+        }
+
+        lock.lock();
+        Install( nChunk, pView );
+        if( pView )
+            ++m_Stats.nPrefetched;
+    }
+}
+
+BrickPagerStats CBrickPager::GetStats()
+{
+    std::lock_guard<std::mutex> lock( m_Lock );
+    return m_Stats;
+}
@@ -0,0 +1,98 @@
+//--------------------------------------------------------------------------------------
+// File: brickpager.h
+//
+// Read-only access to a file of fixed size bricks that may be far larger than memory.
+//
+// The file is memory-mapped a chunk of consecutive bricks at a time. Mapped chunks sit
+// in an LRU list; once they take more than the byte budget, the least recently used
+// ones nobody has locked are unmapped. Lock maps a missing chunk on the calling thread
+// and waits for the page faults; Prefetch instead queues it for the pager's own
+// threads, which map it and touch every page, so the caller finds it resident later.
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef BRICKPAGER_H
+#define BRICKPAGER_H
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Bricks in a file must start at a multiple of this (the Windows allocation granularity,
+// also a multiple of every page size)
+static const unsigned long long BRICKPAGER_ALIGNMENT = 65536;
+
+struct BrickPagerStats
+{
+    unsigned long long nHits;       // Lock found the chunk mapped
+    unsigned long long nMisses;     // Lock had to map it, or wait for a prefetch
+    unsigned long long nPrefetched; // chunks mapped by the prefetch threads
+    unsigned long long nEvicted;    // chunks unmapped to stay in the budget
+    size_t nResident;               // bytes mapped now
+};
+
+class CBrickPager
+{
+public:
+    CBrickPager();
+    ~CBrickPager();
+
+    // Opens nBricks bricks of nBrickSize bytes starting at nOffset (a multiple of
+    // BRICKPAGER_ALIGNMENT) in szFile. At least one chunk stays mapped whatever nBudget.
+    bool Open( const wchar_t* szFile, unsigned long long nOffset, size_t nBrickSize, unsigned int nBricks,
+               size_t nBudget, unsigned int nPrefetchThreads = 1 );
+    void Close();
+    bool IsOpen() const { return m_nBricks > 0; }
+
+    // The brick's bytes, valid until the matching Unlock. Thread safe.
+    const void* Lock( unsigned int nBrick );
+    void Unlock( unsigned int nBrick );
+    // Has the chunk of nBrick mapped in the background unless it already is. Thread safe.
+    void Prefetch( unsigned int nBrick );
+
+    BrickPagerStats GetStats();
+    size_t GetChunkSize() const { return m_nChunkSize; }
+
+private:
+    struct Chunk
+    {
+        const char* pView;          // NULL while unmapped
+        unsigned int nLocks;
+        bool bBusy;                 // being mapped, or queued for the prefetch threads
+        std::list<unsigned int>::iterator itLRU;
+    };
+
+    // Bytes of nChunk, less than m_nChunkSize for the last one
+    size_t ChunkLength( unsigned int nChunk ) const;
+    void* MapChunk( unsigned int nChunk );
+    void UnmapChunk( unsigned int nChunk );
+    void Install( unsigned int nChunk, void* pView );
+    void ThreadProc();
+
+    // File and mapping handles (HANDLE on Windows, the file descriptor elsewhere)
+    void* m_hFile;
+    void* m_hMapping;
+    int m_nFile;
+
+    unsigned long long m_nOffset;
+    size_t m_nBrickSize;
+    unsigned int m_nBricks;
+    unsigned int m_nBricksPerChunk;
+    size_t m_nChunkSize;
+    unsigned long long m_nFileSize;
+    size_t m_nBudget;
+
+    std::mutex m_Lock;
+    std::condition_variable m_Mapped;       // a chunk became resident
+    std::condition_variable m_Queued;       // work for the prefetch threads
+    std::vector<Chunk> m_Chunks;
+    std::list<unsigned int> m_LRU;          // resident chunks, most recent first
+    std::deque<unsigned int> m_Queue;       // chunks to prefetch
+    std::vector<std::thread> m_Threads;
+    bool m_bQuit;
+    BrickPagerStats m_Stats;
+};
+
+#endif // BRICKPAGER_H
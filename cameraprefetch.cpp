@@ -0,0 +1,93 @@
+//--------------------------------------------------------------------------------------
+// File: cameraprefetch.cpp
+//
+// Prefetch of distance cache bricks along the camera's path, see cameraprefetch.h.
+//--------------------------------------------------------------------------------------
+#include "cameraprefetch.h"
+#include "distcache.h"
+
+// Points of the extrapolated path the frustum is prefetched from, the current eye included
+static const unsigned int PATH_POINTS = 4;
+
+// Rays per side of the grid across the frustum
+static const unsigned int FAN_SIZE = 3;
+
+// Bricks prefetched along each ray; the march gives up on the cache in the first few
+static const unsigned int RAY_BRICKS = 8;
+
+// Weight of the newest frame in the smoothed velocity and turn rate
+static const float SMOOTHING = 0.5f;
+
+CCameraPrefetcher::CCameraPrefetcher() :
+    m_pCache( NULL ),
+    m_fHorizon( 0.25f ),
+    m_bMoving( false ),
+    m_vEye( 0.0f ),
+    m_vAhead( 0.0f ),
+    m_vVelocity( 0.0f ),
+    m_vTurn( 0.0f ),
+    m_nRays( 0 )
+{
+    SetProjection( 3.14159265f / 4, 4.0f / 3 );
+}
+
+void CCameraPrefetcher::SetCache( const CDistanceCache* pCache )
+{
+    m_pCache = pCache;
+    m_bMoving = false;
+    m_vVelocity = m_vTurn = float3( 0.0f );
+}
+
+void CCameraPrefetcher::SetProjection( float fFOV, float fAspect )
+{
+    m_fTanY = tanf( fFOV * 0.5f );
+    m_fTanX = m_fTanY * fAspect;
+}
+
+void CCameraPrefetcher::FrameMove( const float3& vEye, const float3& vAhead, float fElapsedTime )
+{
+    const float3 vDir = normalize( vAhead );
+    if( m_bMoving && fElapsedTime > 0 )
+    {
+        m_vVelocity = lerp( m_vVelocity, ( vEye - m_vEye ) / fElapsedTime, SMOOTHING );
+        m_vTurn = lerp( m_vTurn, ( vDir - m_vAhead ) / fElapsedTime, SMOOTHING );
+    }
+    m_vEye = vEye;
+    m_vAhead = vDir;
+    m_bMoving = true;
+
+    m_nRays = 0;
+    if( !m_pCache || !m_pCache->IsPaged() )
+        return;
+
+    // Nearest in time first: the pager's queue is first in, first out. A camera at rest
+    // only needs its current view.
+    const bool bStill = dot( m_vVelocity, m_vVelocity ) == 0 && dot( m_vTurn, m_vTurn ) == 0;
+    for( unsigned int i = 0; i < ( bStill ? 1 : PATH_POINTS ); ++i )
+    {
+        const float t = m_fHorizon * i / ( PATH_POINTS - 1 );
+        PrefetchView( vEye + m_vVelocity * t, vDir + m_vTurn * t );
+    }
+}
+
+void CCameraPrefetcher::PrefetchView( const float3& vEye, const float3& vAhead )
+{
+    // Any basis across the view will do, the fan covers the frustum's rectangle either
+    // way; world up as in BuildCpuView unless looking along it
+    const float3 vZ = normalize( vAhead );
+    const float3 vUp = ( fabsf( vZ.y ) < 0.99f ) ? float3( 0, 1, 0 ) : float3( 1, 0, 0 );
+    const float3 vX = normalize( cross( vUp, vZ ) );
+    const float3 vY = cross( vZ, vX );
+
+    Ray ray;
+    ray.pos = vEye;
+    for( unsigned int v = 0; v < FAN_SIZE; ++v )
+        for( unsigned int u = 0; u < FAN_SIZE; ++u )
+        {
+            const float x = ( 2.0f * u / ( FAN_SIZE - 1 ) - 1 ) * m_fTanX;
+            const float y = ( 2.0f * v / ( FAN_SIZE - 1 ) - 1 ) * m_fTanY;
+            ray.dir = normalize( vZ + vX * x + vY * y );
+            m_pCache->PrefetchRay( ray, 0, RAY_BRICKS );
+            ++m_nRays;
+        }
+}
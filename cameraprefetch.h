@@ -0,0 +1,54 @@
+//--------------------------------------------------------------------------------------
+// File: cameraprefetch.h
+//
+// Pages in the distance cache bricks a moving camera is about to need.
+//
+// Fed the eye point and look direction every FrameMove (what CFirstPersonCamera and
+// CModelViewerCamera report), it keeps the camera's velocity and the rate its look
+// direction turns at, extrapolates both a short time ahead, and from a few points of
+// that path walks a fan of rays across the view frustum through the coarse grid of the
+// cache. The bricks those rays would reach first are queued for the pager's threads,
+// so by the time the renderer gets there they are mapped and the page faults happened
+// off the render thread.
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef CAMERAPREFETCH_H
+#define CAMERAPREFETCH_H
+
+#include "cpumath.h"
+
+class CDistanceCache;
+
+class CCameraPrefetcher
+{
+public:
+    CCameraPrefetcher();
+
+    // The cache to prefetch for, NULL for none. Forgets the camera's motion.
+    void SetCache( const CDistanceCache* pCache );
+    // Vertical field of view in radians and width / height of the camera (default pi / 4, 4 / 3)
+    void SetProjection( float fFOV, float fAspect );
+    // How far ahead the path is extrapolated, in seconds (default 0.25)
+    void SetHorizon( float fSeconds ) { m_fHorizon = fSeconds; }
+
+    // Once per frame, after the camera's FrameMove. vAhead needn't be normalized.
+    void FrameMove( const float3& vEye, const float3& vAhead, float fElapsedTime );
+
+    // Smoothed over the last frames, in units per second
+    const float3& GetVelocity() const { return m_vVelocity; }
+    // Rays walked by the last FrameMove
+    unsigned int GetRayCount() const { return m_nRays; }
+
+private:
+    void PrefetchView( const float3& vEye, const float3& vAhead );
+
+    const CDistanceCache* m_pCache;
+    float m_fTanY, m_fTanX;         // half the frustum's size at distance 1
+    float m_fHorizon;
+    bool m_bMoving;                 // m_vEye and m_vAhead hold the last frame
+    float3 m_vEye, m_vAhead;
+    float3 m_vVelocity, m_vTurn;    // of the eye and the unit look direction, per second
+    unsigned int m_nRays;
+};
+
+#endif // CAMERAPREFETCH_H
@@ -0,0 +1,215 @@
+//--------------------------------------------------------------------------------------
+// File: cpude.cpp
+//
+// Batched distance estimation, see cpude.h.
+//--------------------------------------------------------------------------------------
+#include "cpude.h"
+#include "cpukernels.h"
+#include "tilescheduler.h"
+#include <string.h>
+#include <mutex>
+
+// Points per scheduler task; smaller batches run on the calling thread
+static const size_t DE_CHUNK = 4096;
+
+CpuFractal MakeCpuFractal( FRACTAL_TYPE eFractal )
+{
+    CpuFractal fractal;
+    fractal.eFractal = eFractal;
+    fractal.eKernel = DK_TRIG;
+    fractal.nPower = MANDELBULB_DEFAULT_POWER;
+    fractal.bFastMath = false;
+    fractal.Mandelbox = MakeMandelboxParams();
+    return fractal;
+}
+
+FractalSymmetry GetFractalSymmetry( const CpuFractal& fractal )
+{
+    FractalSymmetry sym;
+    sym.bMirror[0] = sym.bMirror[1] = sym.bMirror[2] = true;
+    if( fractal.eFractal == FT_MANDELBOX )
+    {
+        const float3& b = fractal.Mandelbox.boxfold;
+        sym.bPermute = b.x == b.y && b.y == b.z;
+        SetSymmetryRotations( &sym, 1 );
+    }
+    else
+    {
+        sym.bMirror[0] = false;
+        sym.bPermute = false;
+        SetSymmetryRotations( &sym, fractal.nPower - 1 );
+    }
+    return sym;
+}
+
+bool SetSymmetryRotations( FractalSymmetry* pSym, int nRotations )
+{
+    pSym->nRotations = 1;
+    pSym->nSectors = 0;
+    pSym->fHalfCos = 1;
+    pSym->fHalfSin = 0;
+    if( nRotations <= 1 )
+        return true;
+    // The y mirror folds everything onto angles up to pi, so only the sectors starting
+    // there are needed
+    const int nSectors = nRotations / 2 + 1;
+    if( !pSym->bMirror[1] || nSectors > SYMMETRY_MAX_SECTORS )
+        return false;
+    const double w = 3.14159265358979 / nRotations;
+    for( int k = 0; k < nSectors; ++k )
+    {
+        pSym->fSectorCos[k] = ( float )cos( 2 * w * k );
+        pSym->fSectorSin[k] = ( float )sin( 2 * w * k );
+    }
+    pSym->fHalfCos = ( float )cos( w );
+    pSym->fHalfSin = ( float )sin( w );
+    pSym->nRotations = nRotations;
+    pSym->nSectors = nSectors;
+    return true;
+}
+
+int GetSymmetryOrder( const FractalSymmetry& sym )
+{
+    int nOrder = ( sym.bMirror[0] ? 2 : 1 ) * ( sym.bMirror[1] ? 2 : 1 ) * ( sym.bMirror[2] ? 2 : 1 );
+    if( sym.bPermute )
+        nOrder *= 6;
+    // The rotations and the y mirror make a dihedral group of 2 nRotations elements
+    return nOrder * sym.nRotations;
+}
+
+float3 ToFundamentalDomain( const FractalSymmetry& sym, const float3& p )
+{
+    float3 q = p;
+    if( sym.bMirror[0] ) q.x = fabsf( q.x );
+    if( sym.bMirror[1] ) q.y = fabsf( q.y );
+    if( sym.bMirror[2] ) q.z = fabsf( q.z );
+    if( sym.bPermute )
+    {
+        float t;
+        if( q.x < q.y ) { t = q.x; q.x = q.y; q.y = t; }
+        if( q.y < q.z ) { t = q.y; q.y = q.z; q.z = t; }
+        if( q.x < q.y ) { t = q.x; q.x = q.y; q.y = t; }
+    }
+    if( sym.nSectors > 0 )
+    {
+        // The sector of q is the number of sector edges past the first it is not behind
+        // (with y >= 0 all of them are within pi of it). Rotated back onto sector 0, the
+        // far half of that is mirrored onto the near one across the bisector; the final
+        // |y| puts a rounding error below 0 back.
+        int k = 0;
+        for( int i = 1; i < sym.nSectors; ++i )
+            k += ( sym.fSectorCos[i] * q.y - sym.fSectorSin[i] * q.x >= 0 ) ? 1 : 0;
+        const float x = sym.fSectorCos[k] * q.x + sym.fSectorSin[k] * q.y;
+        const float y = sym.fSectorCos[k] * q.y - sym.fSectorSin[k] * q.x;
+        const float h = 2 * fmaxf( sym.fHalfCos * y - sym.fHalfSin * x, 0.0f );
+        q.x = x + h * sym.fHalfSin;
+        q.y = fabsf( y - h * sym.fHalfCos );
+    }
+    return q;
+}
+
+float FundamentalDomainDistance( const FractalSymmetry& sym, const float3& p )
+{
+    const float fSqrtHalf = 0.70710678f;
+    float d = 0;
+    if( sym.bMirror[0] ) d = fmaxf( d, -p.x );
+    if( sym.bMirror[1] ) d = fmaxf( d, -p.y );
+    if( sym.bMirror[2] ) d = fmaxf( d, -p.z );
+    if( sym.bPermute )
+    {
+        d = fmaxf( d, ( p.y - p.x ) * fSqrtHalf );
+        d = fmaxf( d, ( p.z - p.y ) * fSqrtHalf );
+    }
+    if( sym.nSectors > 0 )
+    {
+        // The far side of the wedge: the plane through the z axis at angle pi / nRotations
+        d = fmaxf( d, p.y * sym.fHalfCos - p.x * sym.fHalfSin );
+    }
+    return d;
+}
+
+void EvaluateDE( const CpuFractal& fractal, const float3* pPoints, size_t nPoints, float* pDist )
+{
+    CpuKernelParams params;
+    memset( &params, 0, sizeof( params ) );
+    params.eFractal = fractal.eFractal;
+    params.eKernel = fractal.eKernel;
+    params.nPower = fractal.nPower;
+    params.bFastMath = fractal.bFastMath;
+    params.pMandelboxParams = &fractal.Mandelbox;
+
+    const CpuKernels& kernels = GetCpuKernels();
+    if( nPoints <= DE_CHUNK )
+    {
+        kernels.pfnEvaluateDE( params, pPoints, nPoints, pDist );
+        return;
+    }
+
+    // One pool for all callers; CTileScheduler::Run is not reentrant
+    static CTileScheduler s_Scheduler;
+    static std::mutex s_Lock;
+    std::lock_guard<std::mutex> lock( s_Lock );
+    const unsigned int nChunks = ( unsigned int )( ( nPoints + DE_CHUNK - 1 ) / DE_CHUNK );
+    s_Scheduler.Run( nChunks, [&]( unsigned int nChunk, unsigned int )
+    {
+        const size_t i = nChunk * DE_CHUNK;
+        const size_t n = ( nPoints - i < DE_CHUNK ) ? nPoints - i : DE_CHUNK;
+        kernels.pfnEvaluateDE( params, pPoints + i, n, pDist + i );
+    } );
+}
+
+// Outermost surface point along nDirs rays from far outside towards the origin. The rays
+// step together, one EvaluateDE batch per step, and drop out once they are inside the
+// outermost hit so far.
+static float ProbeRadius( const CpuFractal& fractal, float fStart, unsigned int nDirs )
+{
+    std::vector<float3> dirs( nDirs ), points( nDirs );
+    std::vector<float> r( nDirs, fStart ), d( nDirs );
+    std::vector<unsigned int> active( nDirs );
+    for( unsigned int i = 0; i < nDirs; ++i )
+    {
+        // Fibonacci sphere
+        const float z = 1 - ( 2 * i + 1.0f ) / nDirs;
+        const float a = 2.39996323f * i;
+        const float rho = sqrtf( 1 - z * z );
+        dirs[i] = float3( rho * cosf( a ), rho * sinf( a ), z );
+        active[i] = i;
+    }
+
+    float fMax = 0;
+    while( !active.empty() )
+    {
+        for( size_t j = 0; j < active.size(); ++j )
+            points[j] = r[active[j]] * dirs[active[j]];
+        EvaluateDE( fractal, &points[0], active.size(), &d[0] );
+        size_t n = 0;
+        for( size_t j = 0; j < active.size(); ++j )
+        {
+            const unsigned int i = active[j];
+            if( d[j] < 1e-3f )
+                fMax = fmaxf( fMax, r[i] );
+            else if( ( r[i] -= d[j] ) > fMax )
+                active[n++] = i;
+        }
+        active.resize( n );
+    }
+    return fMax;
+}
+
+float GetFractalRadius( const CpuFractal& fractal )
+{
+    if( fractal.eFractal == FT_MANDELBOX )
+    {
+        // The shaders run too few iterations for the usual bound on the mandelbox, so the
+        // radius is found by sphere tracing in from far outside: from 2 (|scale| + 1) /
+        // (|scale| - 1) times the fold limit, the size of the fully iterated set, times
+        // the scale
+        const MandelboxParams& box = fractal.Mandelbox;
+        const float s = fabsf( box.scale );
+        const float fFold = fmaxf( fmaxf( box.boxfold.x, box.boxfold.y ), box.boxfold.z );
+        const float fStart = s * 2 * fFold * ( s + 1 ) / fmaxf( s - 1, 0.1f );
+        return ProbeRadius( fractal, fStart, 4096 );
+    }
+    // |z| > max( |c|, 2^(1 / (power - 1)) ) grows with every iteration of z^power + c
+    return powf( 2.0f, 1.0f / ( fractal.nPower - 1 ) );
+}
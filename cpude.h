@@ -0,0 +1,86 @@
+//--------------------------------------------------------------------------------------
+// File: cpude.h
+//
+// Batched distance estimation for CPU code outside the renderer: the camera, and tools
+// that sample the fractal on grids or point sets. EvaluateDE spreads a batch over a
+// shared pool of worker threads and evaluates every chunk in SIMD packets with the
+// kernels build selected for the CPU (cpukernels.h), so callers don't have to care
+// about either.
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef CPUDE_H
+#define CPUDE_H
+
+#include "cpurender.h"
+
+// Which distance estimator to evaluate
+struct CpuFractal
+{
+    FRACTAL_TYPE eFractal;
+    DE_KERNEL eKernel;              // mandelbulb iteration
+    int nPower;                     // mandelbulb power
+    bool bFastMath;                 // fast vmath.h functions in the mandelbulb DEs
+    MandelboxParams Mandelbox;      // built with MakeMandelboxParams
+};
+
+// The fractal with the settings of the shaders
+CpuFractal MakeCpuFractal( FRACTAL_TYPE eFractal = FT_MANDELBULB );
+
+//--------------------------------------------------------------------------------------
+// Isometries that leave the DE of a fractal unchanged. Anything that samples the DE on a
+// grid only needs to cover the fundamental domain, a wedge 1 / GetSymmetryOrder of the
+// space, and maps every other point into it with ToFundamentalDomain.
+//
+// The mandelbox folds each axis with an odd function and the sphere fold only sees the
+// radius, so the DE is even in x, y and z, and symmetric in the axes that have the same
+// fold limit. The mandelbulb map in latitude / longitude form is even in y and z, and
+// rotating p by 2 pi / (power - 1) about z rotates every iterate by the same angle.
+//--------------------------------------------------------------------------------------
+
+// Rotation sectors the fold goes through up to pi, nRotations / 2 + 1: 8 for the highest
+// mandelbulb power
+static const int SYMMETRY_MAX_SECTORS = ( MANDELBULB_MAX_POWER - 1 ) / 2 + 1;
+
+struct FractalSymmetry
+{
+    bool bMirror[3];                // DE is even in x, y, z
+    bool bPermute;                  // x, y and z can be swapped (with all three mirrors)
+    int nRotations;                 // n-fold rotation about z (with the y mirror), 1 if none
+
+    // Set with nRotations by SetSymmetryRotations, so that the fold needs no trigonometry
+    int nSectors;                   // rotation sectors up to pi, 0 without rotations
+    float fSectorCos[SYMMETRY_MAX_SECTORS], fSectorSin[SYMMETRY_MAX_SECTORS];   // their first edges
+    float fHalfCos, fHalfSin;       // the bisector of sector 0, the far edge of the domain
+};
+
+FractalSymmetry GetFractalSymmetry( const CpuFractal& fractal );
+// Sets nRotations and the sectors that go with it. False, and no rotations, without the
+// y mirror or with more than SYMMETRY_MAX_SECTORS sectors; the domain is then larger but
+// still correct.
+bool SetSymmetryRotations( FractalSymmetry* pSym, int nRotations );
+// Number of copies of the fundamental domain that fill space
+int GetSymmetryOrder( const FractalSymmetry& sym );
+// The image of p in the fundamental domain: x, y, z >= 0 for the mirrors, x >= y >= z
+// with the permutations, 0 <= atan2( y, x ) <= pi / nRotations with the rotations
+float3 ToFundamentalDomain( const FractalSymmetry& sym, const float3& p );
+// How far p is outside the fundamental domain by the plane it violates most; a lower
+// bound on its distance to the domain, 0 inside
+float FundamentalDomainDistance( const FractalSymmetry& sym, const float3& p );
+
+// pDist[i] = DE( pPoints[i] ) for i < nPoints. Batches of more than a few thousand
+// points run on all hardware threads; calls from several threads take turns.
+void EvaluateDE( const CpuFractal& fractal, const float3* pPoints, size_t nPoints, float* pDist );
+
+inline float EvaluateDE( const CpuFractal& fractal, const float3& p )
+{
+    float d;
+    EvaluateDE( fractal, &p, 1, &d );
+    return d;
+}
+
+// Distance of the outermost surface point from the origin: the escape radius of the
+// mandelbulb, probed along 4096 rays for the mandelbox. 10% more bounds the fractal
+// with a margin for the points between the rays (GetDistanceCacheExtent, BoundRadius).
+float GetFractalRadius( const CpuFractal& fractal );
+
+#endif // CPUDE_H
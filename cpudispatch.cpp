@@ -0,0 +1,139 @@
+//--------------------------------------------------------------------------------------
+// File: cpudispatch.cpp
+//
+// Picks the cpukernels.cpp build for this CPU, see cpukernels.h.
+//--------------------------------------------------------------------------------------
+#include "cpukernels.h"
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+enum CPU_ISA
+{
+    ISA_SSE2,
+    ISA_SSE42,
+    ISA_AVX2,
+    ISA_AVX512,
+};
+
+static const struct
+{
+    const char* szEnv;
+    const CpuKernels* ( *pfnGetKernels )();
+} s_Isas[] =
+{
+    { "sse2", &sse2::GetIsaKernels },
+    { "sse4.2", &sse42::GetIsaKernels },
+    { "avx2", &avx2::GetIsaKernels },
+    { "avx512", &avx512::GetIsaKernels },
+};
+
+static void CpuId( int nLeaf, int nSubLeaf, unsigned int regs[4] )
+{
+#ifdef _MSC_VER
+    __cpuidex( ( int* )regs, nLeaf, nSubLeaf );
+#else
+    __cpuid_count( nLeaf, nSubLeaf, regs[0], regs[1], regs[2], regs[3] );
+#endif
+}
+
+// Register state the OS saves on context switches (XCR0)
+static unsigned long long GetXCR0()
+{
+#ifdef _MSC_VER
+    return _xgetbv( 0 );
+#else
+    unsigned int lo, hi;
+    __asm__ __volatile__( "xgetbv" : "=a"( lo ), "=d"( hi ) : "c"( 0 ) );
+    return ( ( unsigned long long )hi << 32 ) | lo;
+#endif
+}
+
+// Widest instruction set both the CPU and the OS support
+static CPU_ISA DetectIsa()
+{
+    unsigned int regs[4];
+    CpuId( 0, 0, regs );
+    const unsigned int nMaxLeaf = regs[0];
+
+    CpuId( 1, 0, regs );
+    const bool bSSE42 = ( regs[2] & ( 1 << 19 ) ) && ( regs[2] & ( 1 << 20 ) );    // SSE4.1, SSE4.2
+    const bool bFMA = ( regs[2] & ( 1 << 12 ) ) != 0;
+    const bool bOSXSave = ( regs[2] & ( 1 << 27 ) ) != 0;
+    if( !bSSE42 )
+        return ISA_SSE2;
+    if( !bOSXSave || nMaxLeaf < 7 )
+        return ISA_SSE42;
+
+    // XMM and YMM state, then opmask and both halves of ZMM
+    const unsigned long long nXCR0 = GetXCR0();
+    const bool bOSAVX = ( nXCR0 & 0x06 ) == 0x06;
+    const bool bOSAVX512 = ( nXCR0 & 0xe6 ) == 0xe6;
+
+    CpuId( 7, 0, regs );
+    const bool bAVX2 = ( regs[1] & ( 1 << 5 ) ) != 0;
+    const bool bAVX512F = ( regs[1] & ( 1 << 16 ) ) != 0;
+    if( bAVX512F && bAVX2 && bFMA && bOSAVX512 )
+        return ISA_AVX512;
+    if( bAVX2 && bFMA && bOSAVX )
+        return ISA_AVX2;
+    return ISA_SSE42;
+}
+
+static const CpuKernels* g_pCpuKernels = NULL;
+static wchar_t g_szCpuKernelsInfo[64];
+static std::once_flag g_CpuKernelsOnce;
+
+static void SelectCpuKernels()
+{
+    const CPU_ISA eDetected = DetectIsa();
+    int nIsa = eDetected;
+    bool bForced = false;
+
+    // FRAC_ISA may only ask for something the CPU has
+    const char* szEnv = getenv( "FRAC_ISA" );
+    bool bIgnored = false;
+    if( szEnv )
+    {
+        for( int i = 0; i <= ( int )eDetected; ++i )
+        {
+            if( strcmp( szEnv, s_Isas[i].szEnv ) == 0 )
+            {
+                nIsa = i;
+                bForced = true;
+            }
+        }
+        bIgnored = !bForced;
+    }
+
+    // Fall back to the next narrower build this binary has (debug builds: only SSE2)
+    while( nIsa > 0 && !s_Isas[nIsa].pfnGetKernels() )
+        --nIsa;
+    g_pCpuKernels = s_Isas[nIsa].pfnGetKernels();
+    if( bIgnored )
+        fprintf( stderr, "FRAC_ISA=%s is not one of sse2, sse4.2, avx2, avx512 this CPU supports; using %s\n", szEnv,
+                 s_Isas[nIsa].szEnv );
+
+    swprintf( g_szCpuKernelsInfo, sizeof( g_szCpuKernelsInfo ) / sizeof( g_szCpuKernelsInfo[0] ), L"%ls, %d lanes (%ls)",
+              g_pCpuKernels->szName, g_pCpuKernels->nWidth, bForced ? L"FRAC_ISA" : L"cpuid" );
+}
+
+// The first callers can be tile scheduler threads racing each other
+const CpuKernels& GetCpuKernels()
+{
+    std::call_once( g_CpuKernelsOnce, SelectCpuKernels );
+    return *g_pCpuKernels;
+}
+
+const wchar_t* GetCpuKernelsInfo()
+{
+    GetCpuKernels();
+    return g_szCpuKernelsInfo;
+}
@@ -0,0 +1,1139 @@
+//--------------------------------------------------------------------------------------
+// File: cpukernels.cpp
+//
+// Per-pixel work of the CPU renderer: ports of ray_marching (raymarch.fx) and shade()
+// from the pixel shaders, for one instruction set (see cpukernels.h). This file is the
+// SSE2 build; cpukernels_sse42.cpp, cpukernels_avx2.cpp and cpukernels_avx512.cpp
+// include it with CPU_KERNELS_VARIANT defined.
+//
+// The code below follows the HLSL as closely as possible (same float math, same
+// constants, same order of operations), so the output can be diffed against a frame
+// captured from the pixel shader path.
+//--------------------------------------------------------------------------------------
+#include "cpukernels.h"
+
+#if defined( CPU_KERNELS_VARIANT ) && defined( _DEBUG )
+
+#include "simd.h"
+
+namespace SIMD_ISA
+{
+const CpuKernels* GetIsaKernels() { return NULL; }
+}
+
+#else
+
+#include "fracde_simd.h"
+#include "distcache.h"
+
+namespace SIMD_ISA
+{
+
+// The scalar helpers next to the packet ones of the same name in this namespace
+using ::saturate;
+using ::MandelbulbLodIterations;
+
+//--------------------------------------------------------------------------------------
+// Distance estimator functors. Each one evaluates a fractal either for a single point
+// or for a packet of SIMD_WIDTH points, so the marching and shading code below can be
+// written once for every fractal and kernel. BoundRadius is the BoundRadius constant of
+// the shader and the overloads taking eps are its DELod (see raymarch.fx). Gradient
+// returns the DE together with its analytic gradient from the dual number version.
+// MandelbulbFn calls the kernel compiled for the selected power and iteration.
+//--------------------------------------------------------------------------------------
+struct MandelbulbFn
+{
+    const SIMD_ISA::MandelbulbKernel* pKernel;
+
+    float operator()( const float3& p ) const { return pKernel->pfnDE( p, MANDELBULB_ITERATIONS ); }
+    float Gradient( const float3& p, float3* pGrad ) const { return pKernel->pfnGradient( p, pGrad ); }
+    SIMD_ISA::vfloat operator()( const SIMD_ISA::vfloat3& p ) const
+    {
+        return pKernel->pfnPacketDE( p, SIMD_ISA::vfloat( ( float )MANDELBULB_ITERATIONS ) );
+    }
+    float operator()( const float3& p, float eps ) const { return pKernel->pfnDE( p, MandelbulbLodIterations( eps ) ); }
+    SIMD_ISA::vfloat operator()( const SIMD_ISA::vfloat3& p, const SIMD_ISA::vfloat& eps ) const
+    {
+        return pKernel->pfnPacketDE( p, SIMD_ISA::MandelbulbLodIterations( eps ) );
+    }
+    float BoundRadius() const { return MANDELBULB_BOUND_RADIUS; }
+};
+
+struct MandelboxFn
+{
+    const MandelboxParams* pParams;
+    float fBoundRadius;         // CpuKernelParams::fMandelboxBound
+
+    float operator()( const float3& p ) const { return ::MandelboxDE<ScalarMath>( p, *pParams ); }
+    float Gradient( const float3& p, float3* pGrad ) const { return ::MandelboxDEGrad<ScalarMath>( p, *pParams, pGrad ); }
+    SIMD_ISA::vfloat operator()( const SIMD_ISA::vfloat3& p ) const { return SIMD_ISA::MandelboxDE( p, *pParams ); }
+    float operator()( const float3& p, float ) const { return ::MandelboxDE<ScalarMath>( p, *pParams ); }
+    SIMD_ISA::vfloat operator()( const SIMD_ISA::vfloat3& p, const SIMD_ISA::vfloat& ) const
+    {
+        return SIMD_ISA::MandelboxDE( p, *pParams );
+    }
+    float BoundRadius() const { return fBoundRadius; }
+};
+
+//--------------------------------------------------------------------------------------
+// raymarch.fx
+//--------------------------------------------------------------------------------------
+static float HitEpsilon( const CpuView& view, const float3& p, const float3& eye )
+{
+    return ( view.pixelSize > 0 ) ? 0.5f * view.pixelSize * length( p - eye ) : view.dist * view.dist * 0.0001f;
+}
+
+template<class DEFN>
+static float MarchDE( const CpuView& view, const float3& p, float eps, const DEFN& DE )
+{
+    return ( view.pixelSize > 0 ) ? DE( p, eps ) : DE( p );
+}
+
+// Secant steps towards DE = eps from the previous (sa, fa) and current (0, fb) sample of
+// f = DE - eps, false position once the root is bracketed; see refine_hit in raymarch.fx
+template<class DEFN>
+static float3 refine_hit( const CpuView& view, const float3& pos, const float3& dir, float sa, float fa, float fb,
+                          float eps, const DEFN& DE, int* pSteps )
+{
+    float sb = 0;
+    for( int j = 0; j < 8 && ( fb > 0 || fb < -eps ); ++j )
+    {
+        float sc;
+        if( fb < 0 ) sc = sb + ( sa - sb ) * fb / ( fb - fa );
+        else if( fa > fb ) sc = sb + fminf( fb * ( sb - sa ) / ( fa - fb ), 4 * ( fb + eps ) );
+        else sc = sb + fb + eps;
+        float fc = MarchDE( view, pos + sc * dir, eps, DE ) - eps;
+        if( pSteps ) ++*pSteps;
+        if( fb < 0 && fc >= 0 )
+        {
+            sa = sc;
+            fa = fc;
+            continue;
+        }
+        if( fb >= 0 )
+        {
+            sa = sb;
+            fa = fb;
+        }
+        sb = sc;
+        fb = fc;
+    }
+    return pos + ( fb >= -eps ? sb + fb + eps : fminf( sa + fa + eps, sb ) ) * dir;
+}
+
+// CDistanceCache::March from the kernels. The cache is baseline code like libm, so the
+// AVX-512 build clears the upper register state first, as ScalarMath does.
+static float CacheMarch( const CDistanceCache& cache, const Ray& ray, float t, unsigned int* pnSteps )
+{
+#if SIMD_WIDTH == 16
+    _mm256_zeroupper();
+#endif
+    return cache.March( ray, t, pnSteps );
+}
+
+// pSteps optionally receives the number of DE evaluations, which rm.w doesn't give for
+// misses. With pCache, steps from points the DE puts far enough from the surface go on
+// through the cache, adding its steps to *pnCacheSteps.
+template<class DEFN>
+static float4 ray_marching( const CpuView& view, Ray ray, const DEFN& DE, int* pSteps = NULL,
+                            const CDistanceCache* pCache = NULL, unsigned int* pnCacheSteps = NULL )
+{
+    if( pSteps ) *pSteps = 0;
+    const float3 eye = GetEye( view );
+    const float R = DE.BoundRadius();
+    float tmax = 1e30f;
+    if( R > 0 )
+    {
+        float b = dot( ray.pos, ray.dir );
+        float h = b * b - dot( ray.pos, ray.pos ) + R * R;
+        if( h < 0 || -b + sqrtf( h ) < 0 ) return float4( ray.pos, -1 );
+        float t0 = fmaxf( -b - sqrtf( h ), 0.0f );
+        ray.pos += t0 * ray.dir;
+        tmax = -b + sqrtf( h ) - t0;
+    }
+
+    // Over-relaxed steps of view.relax * d, redone as a plain step and continued with k = 1
+    // as soon as the DE spheres of two consecutive points stop overlapping
+    float k = fmaxf( view.relax, 1.0f );
+    float3 pprev = ray.pos;
+    float dprev = 0, sprev = 0;
+    float t = 0;
+    const float fCacheFrom = pCache ? 2 * pCache->GetNearBound() : 0;
+    for( int i = 0; i < 128; ++i )
+    {
+        float eps = HitEpsilon( view, ray.pos, eye );
+        float d = MarchDE( view, ray.pos, eps, DE );
+        if( pSteps ) *pSteps = i + 1;
+        if( fabsf( d ) + dprev < sprev )
+        {
+            ray.pos = pprev + dprev * ray.dir;
+            t += dprev - sprev;
+            k = 1;
+            sprev = 0;
+            continue;
+        }
+        if( view.refine > 0 && d < view.refine * eps )
+            return float4( refine_hit( view, ray.pos, ray.dir, -sprev, dprev - eps, d - eps, eps, DE, pSteps ), ( float )i );
+        if( d < eps ) return float4( ray.pos + d * ray.dir, ( float )i );
+        if( pCache && d > fCacheFrom )
+        {
+            // Past the DE sphere the cache only skips what it found empty, so the march
+            // goes on from where it gives up as from a plain step
+            const float c = CacheMarch( *pCache, ray, d, pnCacheSteps );
+            ray.pos += c * ray.dir;
+            t += c;
+            pprev = ray.pos;
+            dprev = sprev = 0;
+            if( t > tmax )
+                break;
+            continue;
+        }
+        float s = k * d;
+        pprev = ray.pos;
+        dprev = fabsf( d );
+        sprev = s;
+        ray.pos += s * ray.dir;
+        const float tprev = t;
+        t += s;
+        if( t > tmax )
+        {
+            // Only the sphere at pprev is known to be empty: leave if it reaches past the
+            // exit, else the relaxed part of the step was never checked and is redone plain
+            if( tprev + dprev > tmax )
+                break;
+            ray.pos = pprev + dprev * ray.dir;
+            t = tprev + dprev;
+            k = 1;
+            sprev = 0;
+        }
+    }
+    return float4( ray.pos, -1 );
+}
+
+// Distance along the axis up to which the cone (apex ray.pos, half angle atan(k)) is
+// empty; nSteps counts the DE evaluations
+template<class DEFN>
+static float cone_marching( const CpuView& view, const Ray& ray, float k, float t, const DEFN& DE, unsigned int& nSteps )
+{
+    const float R = DE.BoundRadius();
+    const float tfar = ( R > 0 ) ? length( ray.pos ) + R : 1e30f;
+    for( int i = 0; i < 64 && t < tfar; ++i )
+    {
+        float d = DE( ray.pos + t * ray.dir );
+        ++nSteps;
+        float s = ( d - t * k ) / ( 1 + k );
+        if( s < ( view.dist * view.dist * 0.0001f ) ) break;
+        t += s;
+    }
+    return t;
+}
+
+//--------------------------------------------------------------------------------------
+// Surface normal at p, returns DE(p). bAnalytic takes the gradient of the dual number
+// DE in one pass; otherwise the normal comes from the forward differences of the
+// shaders, which cost three more DE calls and lose most of their float precision in
+// the subtraction.
+//--------------------------------------------------------------------------------------
+template<class DEFN>
+static float SurfaceNormal( const float3& p, const DEFN& DE, bool bAnalytic, float3* pN )
+{
+    if( bAnalytic )
+    {
+        float3 g;
+        float k = DE.Gradient( p, &g );
+        *pN = normalize( g );
+        return k;
+    }
+
+    float k = DE( p );
+    float gx = DE( p + float3( 1e-5f, 0, 0 ) ) - k;
+    float gy = DE( p + float3( 0, 1e-5f, 0 ) ) - k;
+    float gz = DE( p + float3( 0, 0, 1e-5f ) ) - k;
+    *pN = normalize( float3( gx, gy, gz ) );
+    return k;
+}
+
+//--------------------------------------------------------------------------------------
+// mandelbulb.fx, rm is the result of ray_marching for the primary ray. The shadow ray
+// marches through pCache if not NULL, adding its steps to *pnCacheSteps.
+//--------------------------------------------------------------------------------------
+template<class DEFN>
+static float4 shade( const CpuView& view, Ray ray, const float4& rm, const DEFN& DE, bool bAnalyticNormal,
+                     const CDistanceCache* pCache, unsigned int* pnCacheSteps )
+{
+    if( rm.w < 0 ) return float4( 0, 0, 0, 0 );
+
+    float3 p = rm.xyz();
+    float3 N;
+    SurfaceNormal( p, DE, bAnalyticNormal, &N );
+
+    float ao = 0;
+    ao += DE( p + 0.1f * N ) * 2.5f;
+    ao += DE( p + 0.2f * N ) * 1.0f;
+
+    float3 L = normalize( float3( -1, 1, 2 ) );
+    ray.pos = p + N * 0.01f;
+    ray.dir = L;
+    float4 S = ray_marching( view, ray, DE, NULL, pCache, pnCacheSteps );
+    float3 C = lerp( float3( 0.6f, 0.8f, 0.6f ), float3( 1.0f, 0.0f, 0.0f ), rm.w / 64 );
+    float D = 0.7f * ( S.w < 0 ? 1 : 0 );
+
+    float A = 0.1f;
+    float3 col = ( A + D * saturate( dot( L, N ) ) ) * ao * C;
+    return float4( col, 1 );
+}
+
+//--------------------------------------------------------------------------------------
+// MandelboxPS.hlsl
+//--------------------------------------------------------------------------------------
+static float4 shade( const CpuView&, const Ray&, const float4& rm, const MandelboxFn& DE, bool bAnalyticNormal,
+                     const CDistanceCache*, unsigned int* )
+{
+    if( rm.w < 0 ) return float4( 0, 0, 0, 0 );
+
+    float3 p = rm.xyz();
+    float3 N;
+    float k = SurfaceNormal( p, DE, bAnalyticNormal, &N );
+    float3 L = normalize( float3( -1, 1, 2 ) );
+
+    float3 C = float3( 0.5f, 0.8f, 0.9f );
+    float shadow = saturate( DE( p + L * 0.1f ) - k ) / 0.1f;
+    float ao = 1 - rm.w / 128; ao = ao * ao;
+    float A = 0.1f;
+    float3 col = ( A + saturate( dot( L, N ) ) * shadow ) * ao * C;
+
+    return float4( col, 1 );
+}
+
+// Tail of MandelbulbPS / MandelboxPS: background blend and gamma
+static float4 FinalColor( const float4& radiance )
+{
+    float3 col = float3( 0.02f, 0.02f, 0.02f );
+    col = lerp( col, radiance.xyz(), radiance.w );
+    return float4( powf( col.x, 0.45f ), powf( col.y, 0.45f ), powf( col.z, 0.45f ), 1 );
+}
+
+//--------------------------------------------------------------------------------------
+// ray_marching for SIMD_WIDTH rays at once with the packet distance estimator. MarchLanes
+// holds the loop state of every lane, which retires on its own when its ray is done.
+// RayMarchingPacket runs one packet until all of its lanes have retired; the wavefront
+// marcher (MarchQueue) runs a few steps at a time and refills the lanes of retired rays.
+//--------------------------------------------------------------------------------------
+struct MarchLanes
+{
+    vfloat3 pos, dir;
+    vfloat t, tmax;
+    vfloat k, dprev, sprev;         // over-relaxation as in ray_marching
+    vfloat3 pprev;
+    vfloat steps;                   // rm.w: iteration of the hit, -1 until then
+    vfloat sa, fa, fb, epsHit;      // refine_hit samples of the lanes that hit
+    vint count;                     // DE evaluations
+    vmask active, refined;
+};
+
+// What all lanes share: hit epsilon as in HitEpsilon, and the loose threshold of refine
+struct MarchConsts
+{
+    vfloat3 eye;
+    bool bFootprint;
+    vfloat halfPixel;
+    vfloat eps;
+    bool bRefine;
+    vfloat loose;
+
+    explicit MarchConsts( const CpuView& view )
+    {
+        const float3 e = GetEye( view );
+        eye = vfloat3( e.x, e.y, e.z );
+        bFootprint = view.pixelSize > 0;
+        halfPixel = 0.5f * view.pixelSize;
+        eps = view.dist * view.dist * 0.0001f;
+        bRefine = view.refine > 0;
+        loose = bRefine ? view.refine : 1.0f;
+    }
+};
+
+// Lanes at the start of ray_marching for the rays in m.pos / m.dir; the ones in
+// m.active that miss the bounding sphere are done, the others start where they enter it
+template<class DEFN>
+static void StartLanes( const CpuView& view, const DEFN& DE, MarchLanes& m )
+{
+    const float R = DE.BoundRadius();
+    m.tmax = 1e30f;
+    if( R > 0 )
+    {
+        vfloat b = dot( m.pos, m.dir );
+        vfloat h = b * b - dot( m.pos, m.pos ) + vfloat( R * R );
+        vfloat sh = sqrt( max( h, vfloat( 0.0f ) ) );
+        m.active = andnot( ( h < vfloat( 0.0f ) ) | ( sh - b < vfloat( 0.0f ) ), m.active );
+        vfloat t0 = max( vfloat( 0.0f ) - b - sh, vfloat( 0.0f ) );
+        m.pos = select( m.active, m.pos + t0 * m.dir, m.pos );
+        m.tmax = sh - b - t0;
+    }
+    m.t = 0.0f;
+    m.k = fmaxf( view.relax, 1.0f );
+    m.pprev = m.pos;
+    m.dprev = 0.0f;
+    m.sprev = 0.0f;
+    m.steps = -1.0f;
+    m.sa = 0.0f;
+    m.fa = 0.0f;
+    m.fb = 0.0f;
+    m.epsHit = 0.0f;
+    m.count = 0;
+    m.refined = lane_mask( 0 );
+}
+
+// One iteration of the loop of ray_marching for every active lane. Adds the lanes
+// evaluated and the active ones to pStats.
+template<class DEFN>
+static void StepLanes( const MarchConsts& c, const DEFN& DE, MarchLanes& m, CpuLaneCount* pStats )
+{
+    if( pStats )
+    {
+        pStats->nLanes += SIMD_WIDTH;
+        pStats->nActive += popcount( m.active );
+    }
+
+    vfloat eps = c.bFootprint ? c.halfPixel * length( m.pos - c.eye ) : c.eps;
+    vfloat d = c.bFootprint ? DE( m.pos, eps ) : DE( m.pos );
+    m.count = select( m.active, m.count + vint( 1 ), m.count );
+    vmask fail = m.active & ( abs( d ) + m.dprev < m.sprev );
+    m.pos = select( fail, m.pprev + m.dprev * m.dir, m.pos );
+    m.t = select( fail, m.t + m.dprev - m.sprev, m.t );
+    m.k = select( fail, vfloat( 1.0f ), m.k );
+    m.sprev = select( fail, vfloat( 0.0f ), m.sprev );
+
+    vmask step = andnot( fail, m.active );
+    vmask hit = step & ( d < c.loose * eps );
+    if( c.bRefine )
+    {
+        m.sa = select( hit, vfloat( 0.0f ) - m.sprev, m.sa );
+        m.fa = select( hit, m.dprev - eps, m.fa );
+        m.fb = select( hit, d - eps, m.fb );
+        m.epsHit = select( hit, eps, m.epsHit );
+        m.refined = m.refined | hit;
+    }
+    else
+        m.pos = select( hit, m.pos + d * m.dir, m.pos );
+    m.steps = select( hit, tofloat( m.count ) - vfloat( 1.0f ), m.steps );
+    m.active = andnot( hit, m.active );
+    step = andnot( hit, step );
+
+    vfloat s = m.k * d;
+    m.pprev = select( step, m.pos, m.pprev );
+    m.dprev = select( step, abs( d ), m.dprev );
+    m.sprev = select( step, s, m.sprev );
+    m.pos = select( step, m.pos + s * m.dir, m.pos );
+    const vfloat tprev = m.t;
+    m.t = select( step, m.t + s, m.t );
+
+    // Past the exit of the bounding sphere: a miss if the sphere at pprev reaches there,
+    // else the unchecked relaxed part of the step is redone as a plain one
+    vmask past = step & ( m.t > m.tmax );
+    vmask miss = past & ( tprev + m.dprev > m.tmax );
+    vmask redo = andnot( miss, past );
+    m.pos = select( redo, m.pprev + m.dprev * m.dir, m.pos );
+    m.t = select( redo, tprev + m.dprev, m.t );
+    m.k = select( redo, vfloat( 1.0f ), m.k );
+    m.sprev = select( redo, vfloat( 0.0f ), m.sprev );
+    m.active = andnot( miss, m.active );
+}
+
+// refine_hit on all refined lanes at once
+template<class DEFN>
+static void RefineLanes( const MarchConsts& c, const DEFN& DE, MarchLanes& m )
+{
+    vfloat sa = m.sa, fa = m.fa, fb = m.fb;
+    const vfloat epsHit = m.epsHit;
+    vfloat sb = 0.0f;
+    const vfloat zero = 0.0f;
+    for( int j = 0; j < 8; ++j )
+    {
+        vmask todo = m.refined & ( ( fb > zero ) | ( fb < zero - epsHit ) );
+        if( !any( todo ) )
+            break;
+        vmask inside = fb < zero;
+        vfloat secant = sb + min( fb * ( sb - sa ) / ( fa - fb ), vfloat( 4.0f ) * ( fb + epsHit ) );
+        vfloat bracket = sb + ( sa - sb ) * fb / ( fb - fa );
+        vfloat sc = select( inside, bracket, select( fa > fb, secant, sb + fb + epsHit ) );
+        vfloat3 pc = m.pos + sc * m.dir;
+        vfloat fc = ( c.bFootprint ? DE( pc, epsHit ) : DE( pc ) ) - epsHit;
+        m.count = select( todo, m.count + vint( 1 ), m.count );
+
+        vmask keepB = todo & inside & ( fc >= zero );
+        sa = select( keepB, sc, sa );
+        fa = select( keepB, fc, fa );
+        vmask shift = andnot( inside, todo );
+        sa = select( shift, sb, sa );
+        fa = select( shift, fb, fa );
+        vmask moveB = andnot( keepB, todo );
+        sb = select( moveB, sc, sb );
+        fb = select( moveB, fc, fb );
+    }
+    vfloat s = select( fb >= zero - epsHit, sb + fb + epsHit, min( sa + fa + epsHit, sb ) );
+    m.pos = select( m.refined, m.pos + s * m.dir, m.pos );
+}
+
+template<class DEFN>
+static void RayMarchingPacket( const CpuView& view, const Ray* pRays, int nRays, float4* pResults, const DEFN& DE,
+                               int* pSteps = NULL, CpuLaneCount* pStats = NULL )
+{
+    float ox[SIMD_WIDTH], oy[SIMD_WIDTH], oz[SIMD_WIDTH], dx[SIMD_WIDTH], dy[SIMD_WIDTH], dz[SIMD_WIDTH];
+    for( int i = 0; i < SIMD_WIDTH; ++i )
+    {
+        const Ray& ray = pRays[i < nRays ? i : 0];
+        ox[i] = ray.pos.x; oy[i] = ray.pos.y; oz[i] = ray.pos.z;
+        dx[i] = ray.dir.x; dy[i] = ray.dir.y; dz[i] = ray.dir.z;
+    }
+
+    const MarchConsts c( view );
+    MarchLanes m;
+    m.pos = vfloat3( load( ox ), load( oy ), load( oz ) );
+    m.dir = vfloat3( load( dx ), load( dy ), load( dz ) );
+    m.active = lane_mask( nRays );
+    StartLanes( view, DE, m );
+    for( int i = 0; i < 128 && any( m.active ); ++i )
+        StepLanes( c, DE, m, pStats );
+    if( c.bRefine )
+        RefineLanes( c, DE, m );
+
+    float w[SIMD_WIDTH];
+    int n[SIMD_WIDTH];
+    store( ox, m.pos.x ); store( oy, m.pos.y ); store( oz, m.pos.z ); store( w, m.steps ); storei( n, m.count );
+    for( int i = 0; i < nRays; ++i )
+    {
+        pResults[i] = float4( ox[i], oy[i], oz[i], w[i] );
+        if( pSteps ) pSteps[i] = n[i];
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Moves every ray forward to its seed distance. The seed comes from reprojection and may
+// be wrong where the view has changed: geometry the camera now sees in front of the
+// reprojected surface must not be skipped. So the DE is sampled along the way, densest
+// near the seed where the surface is close, and the seed is taken only if the DE spheres
+// of the samples cover the whole segment, each reaching back to the ones before. A ray
+// whose chain breaks starts where the spheres before the gap reach, which is known to be
+// empty; one whose seed point is within the hit epsilon of a surface starts at the camera.
+//--------------------------------------------------------------------------------------
+static const float SEED_SAMPLES[] = { 0.0f, 0.5f, 0.75f, 0.875f, 1.0f };
+
+template<class DEFN>
+static void SeedRays( const CpuView& view, Ray* pRays, const float* pSeed, int nRays, bool bPacket, const DEFN& DE )
+{
+    float3 p[SIMD_WIDTH];
+    float d[SIMD_WIDTH], reach[SIMD_WIDTH];
+    bool covered[SIMD_WIDTH];
+    for( int i = 0; i < nRays; ++i )
+    {
+        reach[i] = 0;
+        covered[i] = pSeed[i] > 0;
+    }
+
+    const int nSamples = sizeof( SEED_SAMPLES ) / sizeof( SEED_SAMPLES[0] );
+    for( int j = 0; j < nSamples; ++j )
+    {
+        for( int i = 0; i < nRays; ++i )
+            p[i] = pRays[i].pos + ( pSeed[i] * SEED_SAMPLES[j] ) * pRays[i].dir;
+        if( bPacket )
+        {
+            float px[SIMD_WIDTH], py[SIMD_WIDTH], pz[SIMD_WIDTH];
+            for( int i = 0; i < SIMD_WIDTH; ++i )
+            {
+                const float3& q = p[i < nRays ? i : 0];
+                px[i] = q.x; py[i] = q.y; pz[i] = q.z;
+            }
+            SIMD_ISA::store( d, DE( SIMD_ISA::vfloat3( SIMD_ISA::load( px ), SIMD_ISA::load( py ), SIMD_ISA::load( pz ) ) ) );
+        }
+        else
+        {
+            for( int i = 0; i < nRays; ++i )
+                d[i] = covered[i] ? DE( p[i] ) : 0;
+        }
+
+        for( int i = 0; i < nRays; ++i )
+        {
+            const float t = pSeed[i] * SEED_SAMPLES[j];
+            if( !covered[i] )
+                continue;
+            if( t - d[i] > reach[i] )
+                covered[i] = false;
+            else
+                reach[i] = fmaxf( reach[i], t + d[i] );
+        }
+    }
+
+    // d is the DE at the seed points now
+    const float3 eye = GetEye( view );
+    for( int i = 0; i < nRays; ++i )
+    {
+        if( pSeed[i] <= 0 )
+            continue;
+        if( covered[i] && d[i] >= HitEpsilon( view, p[i], eye ) )
+            pRays[i].pos = p[i];
+        else if( !covered[i] )
+            pRays[i].pos += fminf( reach[i], pSeed[i] ) * pRays[i].dir;
+    }
+}
+
+static unsigned int PackUNORM( const float4& c )
+{
+    unsigned int r = ( unsigned int )( saturate( c.x ) * 255.0f + 0.5f );
+    unsigned int g = ( unsigned int )( saturate( c.y ) * 255.0f + 0.5f );
+    unsigned int b = ( unsigned int )( saturate( c.z ) * 255.0f + 0.5f );
+    unsigned int a = ( unsigned int )( saturate( c.w ) * 255.0f + 0.5f );
+    return r | ( g << 8 ) | ( b << 16 ) | ( a << 24 );
+}
+
+// Marches and shades n rays already moved to their start, at most SIMD_WIDTH together
+// with the packet DE or one with the scalar one
+template<class DEFN>
+static void TraceGroup( const CpuView& view, const CpuKernelParams& params, const DEFN& DE, Ray* pRays,
+                        const float* pSeed, int n, unsigned int* pPixels, float4* pHits, int* pSteps,
+                        CpuLaneStats* pStats )
+{
+    if( pSeed )
+        SeedRays( view, pRays, pSeed, n, params.bPacketDE, DE );
+    if( params.bPacketDE )
+        RayMarchingPacket( view, pRays, n, pHits, DE, pSteps, &pStats->Queue[LQ_PRIMARY] );
+    else
+        pHits[0] = ray_marching( view, pRays[0], DE, pSteps );
+    unsigned int nCacheSteps = 0;
+    for( int i = 0; i < n; ++i )
+        pPixels[i] = PackUNORM( FinalColor( shade( view, pRays[i], pHits[i], DE, params.bAnalyticNormals,
+                                                   params.pDistanceCache, &nCacheSteps ) ) );
+    pStats->nCacheSteps += nCacheSteps;
+}
+
+//--------------------------------------------------------------------------------------
+// Bundles. The rays of a CPU_BUNDLE_SIZE square of pixels share the cone of
+// GetBlockCone and move together, one DE evaluation on its axis per step, as long as the
+// DE sphere covers the cone's cross section (cone_marching). Where it stops doing so the
+// rays diverge: the square splits into quadrants, each starting from the distance up to
+// which all of its rays are empty, and the BUNDLE_LEAF squares march their rays one by
+// one as packets of neighbouring rows and columns.
+//--------------------------------------------------------------------------------------
+static const unsigned int BUNDLE_LEAF = 4;
+
+struct Bundle
+{
+    unsigned int x, y, w, h;    // pixels of the bundle in the W x H image
+    const float* pStart;        // per pixel of the bundle, see pfnRenderBundle
+    const float* pSeed;
+    unsigned int* pPixels;      // W x H
+    float4* pHits;
+    int* pSteps;
+    CpuLaneStats* pStats;
+};
+
+template<class DEFN>
+static void MarchBundle( const CpuView& view, const CpuKernelParams& params, const DEFN& DE, unsigned int W,
+                         unsigned int H, const Bundle& b, unsigned int x0, unsigned int y0, unsigned int nSize, float t,
+                         unsigned int& nConeSteps )
+{
+    const unsigned int x1 = ( x0 + nSize < b.x + b.w ) ? x0 + nSize : b.x + b.w;
+    const unsigned int y1 = ( y0 + nSize < b.y + b.h ) ? y0 + nSize : b.y + b.h;
+    if( x0 >= x1 || y0 >= y1 )
+        return;
+
+    Ray axis;
+    float k;
+    GetBlockCone( view, x0, y0, x1 - 1, y1 - 1, W, H, &axis, &k );
+    t = cone_marching( view, axis, k, t, DE, nConeSteps ) / sqrtf( 1 + k * k );
+    if( nSize > BUNDLE_LEAF )
+    {
+        unsigned int nHalf = nSize / 2;
+        MarchBundle( view, params, DE, W, H, b, x0, y0, nHalf, t, nConeSteps );
+        MarchBundle( view, params, DE, W, H, b, x0 + nHalf, y0, nHalf, t, nConeSteps );
+        MarchBundle( view, params, DE, W, H, b, x0, y0 + nHalf, nHalf, t, nConeSteps );
+        MarchBundle( view, params, DE, W, H, b, x0 + nHalf, y0 + nHalf, nHalf, t, nConeSteps );
+        return;
+    }
+
+    // Every ray of the leaf is empty up to t; the reprojected seeds keep their distance
+    const int nGroup = params.bPacketDE ? SIMD_WIDTH : 1;
+    Ray rays[SIMD_WIDTH];
+    float seed[SIMD_WIDTH];
+    unsigned int index[SIMD_WIDTH], pixels[SIMD_WIDTH];
+    float4 rm[SIMD_WIDTH];
+    int steps[SIMD_WIDTH];
+    int n = 0;
+    for( unsigned int y = y0; y < y1; ++y )
+        for( unsigned int x = x0; x < x1; ++x )
+        {
+            const unsigned int i = ( y - b.y ) * b.w + x - b.x;
+            const float fStart = fmaxf( b.pStart[i], t );
+            GetRay( view, ( x + 0.5f ) / W, ( y + 0.5f ) / H, &rays[n] );
+            rays[n].pos += fStart * rays[n].dir;
+            if( b.pSeed )
+                seed[n] = fmaxf( b.pStart[i] + b.pSeed[i] - fStart, 0.0f );
+            index[n] = i;
+            if( ++n < nGroup && !( y == y1 - 1 && x == x1 - 1 ) )
+                continue;
+
+            TraceGroup( view, params, DE, rays, b.pSeed ? seed : NULL, n, pixels, rm, steps, b.pStats );
+            for( int j = 0; j < n; ++j )
+            {
+                const unsigned int p = ( b.y + index[j] / b.w ) * W + b.x + index[j] % b.w;
+                b.pPixels[p] = pixels[j];
+                if( b.pHits )
+                    b.pHits[p] = rm[j];
+                b.pSteps[index[j]] = steps[j];
+            }
+            n = 0;
+        }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Wavefront marching. All rays of a tile wait in a queue which keeps the MarchLanes state
+// of every ray as a structure of arrays. A pass loads SIMD_WIDTH rays at a time, runs
+// WAVEFRONT_STEPS iterations and stores them back; then the rays that are done leave the
+// queue and the others move up, so the next pass starts with full lanes again. Only the
+// lanes of rays that retire during a pass and the last packet of the queue idle.
+//--------------------------------------------------------------------------------------
+static const int WAVEFRONT_STEPS = 4;
+
+struct RayQueue
+{
+    enum FIELD
+    {
+        PX, PY, PZ, DX, DY, DZ, T, TMAX, K, DPREV, SPREV, QX, QY, QZ, STEPS, SA, FA, FB, EPSHIT,
+        COUNT, ACTIVE, REFINED,
+        FIELDS,
+    };
+
+    size_t nCapacity;               // rays per field, a multiple of SIMD_WIDTH
+    size_t nSize;
+    std::vector<float> Data;        // FIELDS arrays of nCapacity rays
+    std::vector<size_t> Id;         // index of the ray in the caller's arrays
+
+    explicit RayQueue( size_t nRays ) :
+        nCapacity( ( nRays + SIMD_WIDTH - 1 ) / SIMD_WIDTH * SIMD_WIDTH ),
+        nSize( 0 ),
+        Data( FIELDS * nCapacity ),
+        Id( nCapacity )
+    {
+    }
+
+    float* Field( FIELD f ) { return &Data[f * nCapacity]; }
+    const float* Field( FIELD f ) const { return &Data[f * nCapacity]; }
+
+    // Ray i of src to position j
+    void Copy( size_t j, const RayQueue& src, size_t i )
+    {
+        for( int f = 0; f < FIELDS; ++f )
+            Data[f * nCapacity + j] = src.Data[f * src.nCapacity + i];
+        Id[j] = src.Id[i];
+    }
+    void Push( const RayQueue& src, size_t i ) { Copy( nSize++, src, i ); }
+};
+
+static vmask LoadMask( const float* p ) { return load( p ) > vfloat( 0.0f ); }
+static void StoreMask( float* p, vmask m ) { store( p, select( m, vfloat( 1.0f ), vfloat( 0.0f ) ) ); }
+
+static void LoadLanes( const RayQueue& q, size_t i, MarchLanes& m )
+{
+    m.pos = vfloat3( load( q.Field( RayQueue::PX ) + i ), load( q.Field( RayQueue::PY ) + i ), load( q.Field( RayQueue::PZ ) + i ) );
+    m.dir = vfloat3( load( q.Field( RayQueue::DX ) + i ), load( q.Field( RayQueue::DY ) + i ), load( q.Field( RayQueue::DZ ) + i ) );
+    m.t = load( q.Field( RayQueue::T ) + i );
+    m.tmax = load( q.Field( RayQueue::TMAX ) + i );
+    m.k = load( q.Field( RayQueue::K ) + i );
+    m.dprev = load( q.Field( RayQueue::DPREV ) + i );
+    m.sprev = load( q.Field( RayQueue::SPREV ) + i );
+    m.pprev = vfloat3( load( q.Field( RayQueue::QX ) + i ), load( q.Field( RayQueue::QY ) + i ), load( q.Field( RayQueue::QZ ) + i ) );
+    m.steps = load( q.Field( RayQueue::STEPS ) + i );
+    m.sa = load( q.Field( RayQueue::SA ) + i );
+    m.fa = load( q.Field( RayQueue::FA ) + i );
+    m.fb = load( q.Field( RayQueue::FB ) + i );
+    m.epsHit = load( q.Field( RayQueue::EPSHIT ) + i );
+    m.count = trunci( load( q.Field( RayQueue::COUNT ) + i ) );
+    m.active = LoadMask( q.Field( RayQueue::ACTIVE ) + i );
+    m.refined = LoadMask( q.Field( RayQueue::REFINED ) + i );
+}
+
+static void StoreLanes( RayQueue& q, size_t i, const MarchLanes& m )
+{
+    store( q.Field( RayQueue::PX ) + i, m.pos.x ); store( q.Field( RayQueue::PY ) + i, m.pos.y ); store( q.Field( RayQueue::PZ ) + i, m.pos.z );
+    store( q.Field( RayQueue::DX ) + i, m.dir.x ); store( q.Field( RayQueue::DY ) + i, m.dir.y ); store( q.Field( RayQueue::DZ ) + i, m.dir.z );
+    store( q.Field( RayQueue::T ) + i, m.t );
+    store( q.Field( RayQueue::TMAX ) + i, m.tmax );
+    store( q.Field( RayQueue::K ) + i, m.k );
+    store( q.Field( RayQueue::DPREV ) + i, m.dprev );
+    store( q.Field( RayQueue::SPREV ) + i, m.sprev );
+    store( q.Field( RayQueue::QX ) + i, m.pprev.x ); store( q.Field( RayQueue::QY ) + i, m.pprev.y ); store( q.Field( RayQueue::QZ ) + i, m.pprev.z );
+    store( q.Field( RayQueue::STEPS ) + i, m.steps );
+    store( q.Field( RayQueue::SA ) + i, m.sa );
+    store( q.Field( RayQueue::FA ) + i, m.fa );
+    store( q.Field( RayQueue::FB ) + i, m.fb );
+    store( q.Field( RayQueue::EPSHIT ) + i, m.epsHit );
+    store( q.Field( RayQueue::COUNT ) + i, tofloat( m.count ) );
+    StoreMask( q.Field( RayQueue::ACTIVE ) + i, m.active );
+    StoreMask( q.Field( RayQueue::REFINED ) + i, m.refined );
+}
+
+// ray_marching for nRays rays; pResults and pSteps (may be NULL) as for RayMarchingPacket
+template<class DEFN>
+static void MarchQueue( const CpuView& view, const DEFN& DE, const Ray* pRays, size_t nRays, float4* pResults,
+                        int* pSteps, CpuLaneCount* pStats )
+{
+    const MarchConsts c( view );
+    RayQueue q( nRays ), done( nRays );
+    for( size_t i = 0; i < nRays; ++i )
+    {
+        q.Field( RayQueue::PX )[i] = pRays[i].pos.x;
+        q.Field( RayQueue::PY )[i] = pRays[i].pos.y;
+        q.Field( RayQueue::PZ )[i] = pRays[i].pos.z;
+        q.Field( RayQueue::DX )[i] = pRays[i].dir.x;
+        q.Field( RayQueue::DY )[i] = pRays[i].dir.y;
+        q.Field( RayQueue::DZ )[i] = pRays[i].dir.z;
+        q.Id[i] = i;
+    }
+    q.nSize = nRays;
+    for( size_t i = 0; i < q.nSize; i += SIMD_WIDTH )
+    {
+        MarchLanes m;
+        LoadLanes( q, i, m );
+        m.active = lane_mask( ( int )( q.nSize - i ) );
+        StartLanes( view, DE, m );
+        StoreLanes( q, i, m );
+    }
+
+    while( q.nSize > 0 )
+    {
+        for( size_t i = 0; i < q.nSize; i += SIMD_WIDTH )
+        {
+            MarchLanes m;
+            LoadLanes( q, i, m );
+            // Slots past the end still hold rays that compaction moved up or retired
+            m.active = m.active & lane_mask( ( int )( q.nSize - i ) );
+            for( int j = 0; j < WAVEFRONT_STEPS; ++j )
+            {
+                m.active = m.active & ( tofloat( m.count ) < vfloat( 128.0f ) );
+                if( !any( m.active ) )
+                    break;
+                StepLanes( c, DE, m, pStats );
+            }
+            m.active = m.active & ( tofloat( m.count ) < vfloat( 128.0f ) );
+            StoreLanes( q, i, m );
+        }
+
+        // Compaction: rays still marching move up, the others go to the done queue
+        size_t nLive = 0;
+        const float* pActive = q.Field( RayQueue::ACTIVE );
+        for( size_t i = 0; i < q.nSize; ++i )
+        {
+            if( pActive[i] > 0 )
+                q.Copy( nLive++, q, i );
+            else
+                done.Push( q, i );
+        }
+        q.nSize = nLive;
+    }
+
+    if( c.bRefine )
+    {
+        for( size_t i = 0; i < done.nSize; i += SIMD_WIDTH )
+        {
+            MarchLanes m;
+            LoadLanes( done, i, m );
+            RefineLanes( c, DE, m );
+            StoreLanes( done, i, m );
+        }
+    }
+
+    for( size_t i = 0; i < done.nSize; ++i )
+    {
+        const size_t id = done.Id[i];
+        pResults[id] = float4( done.Field( RayQueue::PX )[i], done.Field( RayQueue::PY )[i], done.Field( RayQueue::PZ )[i],
+                               done.Field( RayQueue::STEPS )[i] );
+        if( pSteps )
+            pSteps[id] = ( int )done.Field( RayQueue::COUNT )[i];
+    }
+}
+
+// DE( p ) at n points, SIMD_WIDTH at a time with the packet DE; pStats may be NULL
+template<class DEFN>
+static void EvaluateSamples( const DEFN& DE, const float3* pPoints, size_t n, float* pDist, CpuLaneCount* pStats )
+{
+    for( size_t i = 0; i < n; i += SIMD_WIDTH )
+    {
+        const int m = ( n - i < SIMD_WIDTH ) ? ( int )( n - i ) : SIMD_WIDTH;
+        float px[SIMD_WIDTH], py[SIMD_WIDTH], pz[SIMD_WIDTH], d[SIMD_WIDTH];
+        for( int j = 0; j < SIMD_WIDTH; ++j )
+        {
+            const float3& p = pPoints[i + ( j < m ? j : 0 )];
+            px[j] = p.x; py[j] = p.y; pz[j] = p.z;
+        }
+        store( d, DE( vfloat3( load( px ), load( py ), load( pz ) ) ) );
+        for( int j = 0; j < m; ++j )
+            pDist[i + j] = d[j];
+        if( pStats )
+        {
+            pStats->nLanes += SIMD_WIDTH;
+            pStats->nActive += m;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// shade() for all pixels of a wavefront tile at once: the normals of the hits, then
+// their AO samples and shadow rays, each kind in a queue of its own. pColor receives the
+// radiance as shade() returns it.
+//--------------------------------------------------------------------------------------
+template<class DEFN>
+static void ShadeWavefront( const CpuView& view, const CpuKernelParams& params, const DEFN& DE, const float4* pRM,
+                            size_t n, float4* pColor, CpuLaneStats* pStats )
+{
+    std::vector<size_t> hits;
+    for( size_t i = 0; i < n; ++i )
+    {
+        pColor[i] = float4( 0, 0, 0, 0 );
+        if( pRM[i].w >= 0 )
+            hits.push_back( i );
+    }
+    const size_t m = hits.size();
+    if( m == 0 )
+        return;
+
+    const float3 L = normalize( float3( -1, 1, 2 ) );
+    std::vector<float3> normals( m ), samples( 2 * m );
+    std::vector<Ray> shadows( m );
+    for( size_t j = 0; j < m; ++j )
+    {
+        float3 p = pRM[hits[j]].xyz();
+        float3& N = normals[j];
+        SurfaceNormal( p, DE, params.bAnalyticNormals, &N );
+        samples[2 * j] = p + 0.1f * N;
+        samples[2 * j + 1] = p + 0.2f * N;
+        shadows[j].pos = p + N * 0.01f;
+        shadows[j].dir = L;
+    }
+    std::vector<float> ao( 2 * m );
+    std::vector<float4> S( m );
+    EvaluateSamples( DE, &samples[0], 2 * m, &ao[0], &pStats->Queue[LQ_SAMPLES] );
+    MarchQueue( view, DE, &shadows[0], m, &S[0], NULL, &pStats->Queue[LQ_SHADOW] );
+
+    for( size_t j = 0; j < m; ++j )
+    {
+        const float4& rm = pRM[hits[j]];
+        float a = 0;
+        a += ao[2 * j] * 2.5f;
+        a += ao[2 * j + 1] * 1.0f;
+        float3 C = lerp( float3( 0.6f, 0.8f, 0.6f ), float3( 1.0f, 0.0f, 0.0f ), rm.w / 64 );
+        float D = 0.7f * ( S[j].w < 0 ? 1 : 0 );
+        float A = 0.1f;
+        float3 col = ( A + D * saturate( dot( L, normals[j] ) ) ) * a * C;
+        pColor[hits[j]] = float4( col, 1 );
+    }
+}
+
+static void ShadeWavefront( const CpuView&, const CpuKernelParams& params, const MandelboxFn& DE, const float4* pRM,
+                            size_t n, float4* pColor, CpuLaneStats* pStats )
+{
+    std::vector<size_t> hits;
+    for( size_t i = 0; i < n; ++i )
+    {
+        pColor[i] = float4( 0, 0, 0, 0 );
+        if( pRM[i].w >= 0 )
+            hits.push_back( i );
+    }
+    const size_t m = hits.size();
+    if( m == 0 )
+        return;
+
+    const float3 L = normalize( float3( -1, 1, 2 ) );
+    std::vector<float3> normals( m ), samples( m );
+    std::vector<float> k( m ), d( m );
+    for( size_t j = 0; j < m; ++j )
+    {
+        float3 p = pRM[hits[j]].xyz();
+        k[j] = SurfaceNormal( p, DE, params.bAnalyticNormals, &normals[j] );
+        samples[j] = p + L * 0.1f;
+    }
+    EvaluateSamples( DE, &samples[0], m, &d[0], &pStats->Queue[LQ_SAMPLES] );
+
+    for( size_t j = 0; j < m; ++j )
+    {
+        const float4& rm = pRM[hits[j]];
+        float3 C = float3( 0.5f, 0.8f, 0.9f );
+        float shadow = saturate( d[j] - k[j] ) / 0.1f;
+        float ao = 1 - rm.w / 128; ao = ao * ao;
+        float A = 0.1f;
+        float3 col = ( A + saturate( dot( L, normals[j] ) ) * shadow ) * ao * C;
+        pColor[hits[j]] = float4( col, 1 );
+    }
+}
+
+template<class DEFN>
+static void RenderWavefrontWithDE( const CpuView& view, const CpuKernelParams& params, const DEFN& DE, unsigned int W,
+                                   unsigned int H, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1,
+                                   const float* pStart, const float* pSeed, unsigned int* pPixels, float4* pHits,
+                                   int* pSteps, CpuLaneStats* pStats )
+{
+    const unsigned int w = x1 - x0;
+    const size_t n = ( size_t )w * ( y1 - y0 );
+    std::vector<Ray> rays( n );
+    for( size_t i = 0; i < n; i += SIMD_WIDTH )
+    {
+        const int m = ( n - i < SIMD_WIDTH ) ? ( int )( n - i ) : SIMD_WIDTH;
+        for( int j = 0; j < m; ++j )
+        {
+            Ray& ray = rays[i + j];
+            GetRay( view, ( x0 + ( i + j ) % w + 0.5f ) / W, ( y0 + ( i + j ) / w + 0.5f ) / H, &ray );
+            ray.pos += pStart[i + j] * ray.dir;
+        }
+        if( pSeed )
+            SeedRays( view, &rays[i], pSeed + i, m, true, DE );
+    }
+
+    std::vector<float4> rm( n ), color( n );
+    MarchQueue( view, DE, &rays[0], n, &rm[0], pSteps, &pStats->Queue[LQ_PRIMARY] );
+    ShadeWavefront( view, params, DE, &rm[0], n, &color[0], pStats );
+    for( size_t i = 0; i < n; ++i )
+    {
+        const size_t p = ( y0 + i / w ) * W + x0 + i % w;
+        pPixels[p] = PackUNORM( FinalColor( color[i] ) );
+        if( pHits )
+            pHits[p] = rm[i];
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Entry points
+//--------------------------------------------------------------------------------------
+template<class DEFN>
+static void RenderSpanWithDE( const CpuView& view, const CpuKernelParams& params, const DEFN& DE, unsigned int W,
+                              unsigned int H, unsigned int x0, unsigned int x1, unsigned int y, const float* pStart,
+                              const float* pSeed, unsigned int* pPixels, float4* pHits, int* pSteps,
+                              CpuLaneStats* pStats )
+{
+    // March up to SIMD_WIDTH primary rays of the row together, then shade each hit
+    const unsigned int nGroup = params.bPacketDE ? SIMD_WIDTH : 1;
+    for( unsigned int x = x0; x < x1; x += nGroup )
+    {
+        const unsigned int i0 = x - x0;
+        int n = ( int )( ( x1 - x < nGroup ) ? x1 - x : nGroup );
+        Ray rays[SIMD_WIDTH];
+        float4 rm[SIMD_WIDTH];
+        for( int i = 0; i < n; ++i )
+        {
+            GetRay( view, ( x + i + 0.5f ) / W, ( y + 0.5f ) / H, &rays[i] );
+            rays[i].pos += pStart[i0 + i] * rays[i].dir;
+        }
+        TraceGroup( view, params, DE, rays, pSeed ? pSeed + i0 : NULL, n, pPixels + i0, rm, pSteps + i0, pStats );
+        if( pHits )
+            for( int i = 0; i < n; ++i )
+                pHits[i0 + i] = rm[i];
+    }
+}
+
+template<class DEFN>
+static void RenderBundleWithDE( const CpuView& view, const CpuKernelParams& params, const DEFN& DE, unsigned int W,
+                                unsigned int H, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1,
+                                const float* pStart, const float* pSeed, unsigned int* pPixels, float4* pHits,
+                                int* pSteps, unsigned int* pnConeSteps, CpuLaneStats* pStats )
+{
+    const Bundle b = { x0, y0, x1 - x0, y1 - y0, pStart, pSeed, pPixels, pHits, pSteps, pStats };
+    float t = 1e30f;
+    for( unsigned int i = 0; i < b.w * b.h; ++i )
+        t = fminf( t, pStart[i] );
+    MarchBundle( view, params, DE, W, H, b, x0, y0, CPU_BUNDLE_SIZE, t, *pnConeSteps );
+}
+
+static void RenderSpan( const CpuView& view, const CpuKernelParams& params, unsigned int W, unsigned int H,
+                        unsigned int x0, unsigned int x1, unsigned int y, const float* pStart, const float* pSeed,
+                        unsigned int* pPixels, float4* pHits, int* pSteps, CpuLaneStats* pStats )
+{
+    if( params.eFractal == FT_MANDELBOX )
+    {
+        MandelboxFn DE = { params.pMandelboxParams, params.fMandelboxBound };
+        RenderSpanWithDE( view, params, DE, W, H, x0, x1, y, pStart, pSeed, pPixels, pHits, pSteps, pStats );
+    }
+    else
+    {
+        MandelbulbFn DE = { &GetMandelbulbKernel( params.eKernel, params.nPower, params.bFastMath ) };
+        RenderSpanWithDE( view, params, DE, W, H, x0, x1, y, pStart, pSeed, pPixels, pHits, pSteps, pStats );
+    }
+}
+
+static void RenderBundle( const CpuView& view, const CpuKernelParams& params, unsigned int W, unsigned int H,
+                          unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, const float* pStart,
+                          const float* pSeed, unsigned int* pPixels, float4* pHits, int* pSteps,
+                          unsigned int* pnConeSteps, CpuLaneStats* pStats )
+{
+    if( params.eFractal == FT_MANDELBOX )
+    {
+        MandelboxFn DE = { params.pMandelboxParams, params.fMandelboxBound };
+        RenderBundleWithDE( view, params, DE, W, H, x0, y0, x1, y1, pStart, pSeed, pPixels, pHits, pSteps, pnConeSteps,
+                            pStats );
+    }
+    else
+    {
+        MandelbulbFn DE = { &GetMandelbulbKernel( params.eKernel, params.nPower, params.bFastMath ) };
+        RenderBundleWithDE( view, params, DE, W, H, x0, y0, x1, y1, pStart, pSeed, pPixels, pHits, pSteps, pnConeSteps,
+                            pStats );
+    }
+}
+
+static void RenderWavefront( const CpuView& view, const CpuKernelParams& params, unsigned int W, unsigned int H,
+                             unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, const float* pStart,
+                             const float* pSeed, unsigned int* pPixels, float4* pHits, int* pSteps,
+                             CpuLaneStats* pStats )
+{
+    if( params.eFractal == FT_MANDELBOX )
+    {
+        MandelboxFn DE = { params.pMandelboxParams, params.fMandelboxBound };
+        RenderWavefrontWithDE( view, params, DE, W, H, x0, y0, x1, y1, pStart, pSeed, pPixels, pHits, pSteps, pStats );
+    }
+    else
+    {
+        MandelbulbFn DE = { &GetMandelbulbKernel( params.eKernel, params.nPower, params.bFastMath ) };
+        RenderWavefrontWithDE( view, params, DE, W, H, x0, y0, x1, y1, pStart, pSeed, pPixels, pHits, pSteps, pStats );
+    }
+}
+
+static void EvaluatePoints( const CpuKernelParams& params, const float3* pPoints, size_t nPoints, float* pDist )
+{
+    if( params.eFractal == FT_MANDELBOX )
+    {
+        MandelboxFn DE = { params.pMandelboxParams, params.fMandelboxBound };
+        EvaluateSamples( DE, pPoints, nPoints, pDist, NULL );
+    }
+    else
+    {
+        MandelbulbFn DE = { &GetMandelbulbKernel( params.eKernel, params.nPower, params.bFastMath ) };
+        EvaluateSamples( DE, pPoints, nPoints, pDist, NULL );
+    }
+}
+
+static float ConeMarch( const CpuView& view, const CpuKernelParams& params, const Ray& ray, float k, float t,
+                        unsigned int* pnSteps )
+{
+    if( params.eFractal == FT_MANDELBOX )
+    {
+        MandelboxFn DE = { params.pMandelboxParams, params.fMandelboxBound };
+        return cone_marching( view, ray, k, t, DE, *pnSteps );
+    }
+    MandelbulbFn DE = { &GetMandelbulbKernel( params.eKernel, params.nPower, params.bFastMath ) };
+    return cone_marching( view, ray, k, t, DE, *pnSteps );
+}
+
+const CpuKernels* GetIsaKernels()
+{
+#if SIMD_WIDTH == 16
+    static const CpuKernels s_Kernels = { L"AVX-512", SIMD_WIDTH, &RenderSpan, &RenderBundle, &RenderWavefront, &ConeMarch, &EvaluatePoints };
+#elif SIMD_WIDTH == 8
+    static const CpuKernels s_Kernels = { L"AVX2", SIMD_WIDTH, &RenderSpan, &RenderBundle, &RenderWavefront, &ConeMarch, &EvaluatePoints };
+#elif defined( SIMD_SSE4 )
+    static const CpuKernels s_Kernels = { L"SSE4.2", SIMD_WIDTH, &RenderSpan, &RenderBundle, &RenderWavefront, &ConeMarch, &EvaluatePoints };
+#else
+    static const CpuKernels s_Kernels = { L"SSE2", SIMD_WIDTH, &RenderSpan, &RenderBundle, &RenderWavefront, &ConeMarch, &EvaluatePoints };
+#endif
+    return &s_Kernels;
+}
+
+} // namespace SIMD_ISA
+
+#endif
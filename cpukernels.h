@@ -0,0 +1,94 @@
+//--------------------------------------------------------------------------------------
+// File: cpukernels.h
+//
+// The per-pixel work of the CPU renderer (distance estimators, ray marching, shading),
+// compiled once per instruction set and chosen at startup.
+//
+// cpukernels.cpp is built as is for SSE2, the x64 baseline, and again by
+// cpukernels_sse42.cpp, cpukernels_avx2.cpp and cpukernels_avx512.cpp with the matching
+// compiler switches. Everything in it lives in the SIMD_ISA namespace of its build, or
+// instantiates the fracde.h templates with a type from it, so no function compiled for a
+// wider instruction set can be shared with code that runs on every CPU. Debug builds
+// only have the baseline: without inlining even the small cpumath.h helpers would be
+// emitted out of line and shared.
+//
+// GetCpuKernels picks the widest build the CPU and OS support (cpuid / xgetbv). The
+// FRAC_ISA environment variable (sse2, sse4.2, avx2 or avx512) forces a build for A/B
+// comparisons, if the CPU can run it; any other value is reported on stderr and ignored.
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef CPUKERNELS_H
+#define CPUKERNELS_H
+
+#include "cpurender.h"
+
+// What the kernels need to know about the renderer's settings
+struct CpuKernelParams
+{
+    FRACTAL_TYPE eFractal;
+    DE_KERNEL eKernel;
+    int nPower;
+    bool bFastMath;
+    const MandelboxParams* pMandelboxParams;
+    float fMandelboxBound;                  // BoundRadius of the mandelbox DE, 0 for none
+    bool bPacketDE;
+    bool bAnalyticNormals;
+    const CDistanceCache* pDistanceCache;   // for the shadow rays of shade(), NULL for none
+};
+
+// Side of the pixel squares pfnRenderBundle marches as one bundle
+static const unsigned int CPU_BUNDLE_SIZE = 8;
+
+struct CpuKernels
+{
+    const wchar_t* szName;
+    int nWidth;                 // SIMD_WIDTH of the build
+
+    // Marches and shades pixels x0 .. x1 - 1 of row y of a W x H image. Each ray starts
+    // pStart[i] along its direction and, if pSeed is not NULL, is moved pSeed[i] further
+    // where that is safe (see SeedRays). Writes the colors to pPixels[i], the result of
+    // ray_marching to pHits[i] if pHits is not NULL, and the DE evaluations to pSteps[i].
+    // Adds the lane use of the packet DE calls and the distance cache steps to *pStats.
+    void ( *pfnRenderSpan )( const CpuView& view, const CpuKernelParams& params, unsigned int W, unsigned int H,
+                             unsigned int x0, unsigned int x1, unsigned int y, const float* pStart, const float* pSeed,
+                             unsigned int* pPixels, float4* pHits, int* pSteps, CpuLaneStats* pStats );
+
+    // Same for the pixels x0 .. x1 - 1, y0 .. y1 - 1, at most CPU_BUNDLE_SIZE square, but
+    // marching them as a bundle (see MarchBundle). pStart, pSeed and pSteps hold one value
+    // per pixel of the bundle, row by row; pPixels and pHits are the whole W x H image.
+    // Adds the DE evaluations of the shared steps to *pnConeSteps.
+    void ( *pfnRenderBundle )( const CpuView& view, const CpuKernelParams& params, unsigned int W, unsigned int H,
+                               unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, const float* pStart,
+                               const float* pSeed, unsigned int* pPixels, float4* pHits, int* pSteps,
+                               unsigned int* pnConeSteps, CpuLaneStats* pStats );
+
+    // Same for any rectangle of pixels, through the wavefront marcher (see MarchQueue);
+    // needs the packet DEs
+    void ( *pfnRenderWavefront )( const CpuView& view, const CpuKernelParams& params, unsigned int W, unsigned int H,
+                                  unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1,
+                                  const float* pStart, const float* pSeed, unsigned int* pPixels, float4* pHits,
+                                  int* pSteps, CpuLaneStats* pStats );
+
+    // cone_marching: distance along ray up to which the cone of half angle atan(k) is
+    // empty, starting at t; adds its DE evaluations to *pnSteps
+    float ( *pfnConeMarch )( const CpuView& view, const CpuKernelParams& params, const Ray& ray, float k, float t,
+                             unsigned int* pnSteps );
+
+    // pDist[i] = DE( pPoints[i] ) with the packet DE; uses the fractal, kernel, power, fast
+    // math and mandelbox settings of params. See EvaluateDE (cpude.h) for big batches.
+    void ( *pfnEvaluateDE )( const CpuKernelParams& params, const float3* pPoints, size_t nPoints, float* pDist );
+};
+
+// The kernels of one build, NULL if this binary does not have it
+namespace sse2   { const CpuKernels* GetIsaKernels(); }
+namespace sse42  { const CpuKernels* GetIsaKernels(); }
+namespace avx2   { const CpuKernels* GetIsaKernels(); }
+namespace avx512 { const CpuKernels* GetIsaKernels(); }
+
+// The kernels the renderer uses, chosen on the first call
+const CpuKernels& GetCpuKernels();
+
+// How they were chosen, e.g. "AVX2, 8 lanes (cpuid)", for the frame stats
+const wchar_t* GetCpuKernelsInfo();
+
+#endif // CPUKERNELS_H
@@ -0,0 +1,7 @@
+//--------------------------------------------------------------------------------------
+// File: cpukernels_avx2.cpp
+//
+// AVX2 build of cpukernels.cpp, compiled with /arch:AVX2 (gcc and clang: -mavx2 -mfma).
+//--------------------------------------------------------------------------------------
+#define CPU_KERNELS_VARIANT
+#include "cpukernels.cpp"
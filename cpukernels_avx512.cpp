@@ -0,0 +1,8 @@
+//--------------------------------------------------------------------------------------
+// File: cpukernels_avx512.cpp
+//
+// AVX-512 build of cpukernels.cpp, compiled with /arch:AVX512 (gcc and clang:
+// -mavx512f).
+//--------------------------------------------------------------------------------------
+#define CPU_KERNELS_VARIANT
+#include "cpukernels.cpp"
@@ -0,0 +1,9 @@
+//--------------------------------------------------------------------------------------
+// File: cpukernels_sse42.cpp
+//
+// SSE4.2 build of cpukernels.cpp. MSVC has no /arch switch for SSE4, so SIMD_SSE42
+// turns on the SSE4.1 blends of simd.h (gcc and clang: -msse4.2).
+//--------------------------------------------------------------------------------------
+#define SIMD_SSE42
+#define CPU_KERNELS_VARIANT
+#include "cpukernels.cpp"
@@ -0,0 +1,135 @@
+//--------------------------------------------------------------------------------------
+// File: cpumath.h
+//
+// Minimal HLSL-style vector and matrix types for the CPU rendering path.
+//
+// The functions here deliberately mirror the HLSL intrinsics used in frac.fx and the
+// pixel shaders (length, normalize, lerp, saturate, mul with row_major matrices), so the
+// CPU code can be kept line-by-line comparable with the shaders.
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef CPUMATH_H
+#define CPUMATH_H
+
+#include <math.h>
+
+struct float3
+{
+    float x, y, z;
+
+    float3() {}
+    float3( float _x, float _y, float _z ) : x( _x ), y( _y ), z( _z ) {}
+    explicit float3( float s ) : x( s ), y( s ), z( s ) {}
+
+    float3& operator += ( const float3& v ) { x += v.x; y += v.y; z += v.z; return *this; }
+    float3& operator -= ( const float3& v ) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+    float3& operator *= ( float s ) { x *= s; y *= s; z *= s; return *this; }
+};
+
+inline float3 operator + ( const float3& a, const float3& b ) { return float3( a.x + b.x, a.y + b.y, a.z + b.z ); }
+inline float3 operator - ( const float3& a, const float3& b ) { return float3( a.x - b.x, a.y - b.y, a.z - b.z ); }
+inline float3 operator * ( const float3& a, const float3& b ) { return float3( a.x * b.x, a.y * b.y, a.z * b.z ); }
+inline float3 operator - ( const float3& a ) { return float3( -a.x, -a.y, -a.z ); }
+inline float3 operator * ( const float3& a, float s ) { return float3( a.x * s, a.y * s, a.z * s ); }
+inline float3 operator * ( float s, const float3& a ) { return float3( a.x * s, a.y * s, a.z * s ); }
+inline float3 operator / ( const float3& a, float s ) { return a * ( 1.0f / s ); }
+
+inline float  dot( const float3& a, const float3& b ) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline float  length( const float3& a ) { return sqrtf( dot( a, a ) ); }
+inline float3 normalize( const float3& a ) { return a * ( 1.0f / length( a ) ); }
+inline float3 cross( const float3& a, const float3& b )
+{
+    return float3( a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x );
+}
+
+inline float  clamp( float s, float lo, float hi )
+{
+    // Two independent selects, which compile to maxss / minss. NaN gives lo, as
+    // saturate does on the GPU (and PackUNORM must not convert a NaN to an integer).
+    float t = s >= lo ? s : lo;
+    return t > hi ? hi : t;
+}
+inline float  saturate( float s ) { return clamp( s, 0.0f, 1.0f ); }
+inline float  lerp( float a, float b, float t ) { return a + ( b - a ) * t; }
+inline float3 lerp( const float3& a, const float3& b, float t ) { return a + ( b - a ) * t; }
+inline float3 clamp( const float3& a, const float3& lo, const float3& hi )
+{
+    return float3( clamp( a.x, lo.x, hi.x ), clamp( a.y, lo.y, hi.y ), clamp( a.z, lo.z, hi.z ) );
+}
+
+struct float4
+{
+    float x, y, z, w;
+
+    float4() {}
+    float4( float _x, float _y, float _z, float _w ) : x( _x ), y( _y ), z( _z ), w( _w ) {}
+    float4( const float3& v, float _w ) : x( v.x ), y( v.y ), z( v.z ), w( _w ) {}
+
+    float3 xyz() const { return float3( x, y, z ); }
+};
+
+//--------------------------------------------------------------------------------------
+// Row-major 4x4 matrix with the same memory layout as D3DXMATRIX, so a CbMandelbulb can
+// be copied into it directly. mul() follows the HLSL row-vector convention.
+//--------------------------------------------------------------------------------------
+struct float4x4
+{
+    float m[4][4];
+};
+
+inline float4x4 Identity4x4()
+{
+    float4x4 r;
+    for( int i = 0; i < 4; ++i )
+        for( int j = 0; j < 4; ++j )
+            r.m[i][j] = ( i == j ) ? 1.0f : 0.0f;
+    return r;
+}
+
+// mul(float4(v, 1), M).xyz
+inline float3 mul( const float3& v, const float4x4& M, float w )
+{
+    return float3( v.x * M.m[0][0] + v.y * M.m[1][0] + v.z * M.m[2][0] + w * M.m[3][0],
+                   v.x * M.m[0][1] + v.y * M.m[1][1] + v.z * M.m[2][1] + w * M.m[3][1],
+                   v.x * M.m[0][2] + v.y * M.m[1][2] + v.z * M.m[2][2] + w * M.m[3][2] );
+}
+
+// mul(v, (float3x3)M)
+inline float3 mul3x3( const float3& v, const float4x4& M )
+{
+    return mul( v, M, 0.0f );
+}
+
+// (float3x3)A * (float3x3)B, the rest of the result is identity
+inline float4x4 mul3x3( const float4x4& A, const float4x4& B )
+{
+    float4x4 r = Identity4x4();
+    for( int i = 0; i < 3; ++i )
+        for( int j = 0; j < 3; ++j )
+            r.m[i][j] = A.m[i][0] * B.m[0][j] + A.m[i][1] * B.m[1][j] + A.m[i][2] * B.m[2][j];
+    return r;
+}
+
+// Inverse of the upper 3x3 part (adjugate over determinant), the rest is identity
+inline float4x4 inverse3x3( const float4x4& M )
+{
+    const float ( *m )[4] = M.m;
+    float4x4 r = Identity4x4();
+    r.m[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    r.m[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+    r.m[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+    r.m[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    r.m[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+    r.m[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+    r.m[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    r.m[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+    r.m[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+    float det = m[0][0] * r.m[0][0] + m[0][1] * r.m[1][0] + m[0][2] * r.m[2][0];
+    float inv = ( det != 0 ) ? 1.0f / det : 0.0f;
+    for( int i = 0; i < 3; ++i )
+        for( int j = 0; j < 3; ++j )
+            r.m[i][j] *= inv;
+    return r;
+}
+
+#endif // CPUMATH_H
@@ -0,0 +1,685 @@
+//--------------------------------------------------------------------------------------
+// File: cpurender.cpp
+//
+// Headless multi-threaded CPU implementation of the mandelbulb / mandelbox renderer.
+//
+// This file splits the image into tiles and runs them on the scheduler; the kernels
+// that march and shade the pixels of a tile are in cpukernels.cpp.
+//--------------------------------------------------------------------------------------
+#include "cpurender.h"
+#include "cpukernels.h"
+#include "cpude.h"
+#include "distcache.h"
+#include <stdlib.h>
+#include <string.h>
+
+//--------------------------------------------------------------------------------------
+// frac.fx
+//--------------------------------------------------------------------------------------
+void GetRay( const CpuView& view, float ptx, float pty, Ray* pRay )
+{
+    float u = ( ptx * 2 - 1 ) / view.mProj.m[0][0];
+    float v = ( -pty * 2 + 1 ) / view.mProj.m[1][1];
+
+    pRay->pos = float3( view.mInvView.m[3][0], view.mInvView.m[3][1], view.mInvView.m[3][2] );
+    pRay->pos = mul( pRay->pos, view.mInvWorld, 1.0f );
+
+    pRay->dir = normalize( float3( u, v, 1.0f ) );
+    pRay->dir = mul3x3( pRay->dir, view.mInvView );
+    pRay->dir = normalize( mul3x3( pRay->dir, view.mInvWorld ) );
+}
+
+float3 GetEye( const CpuView& view )
+{
+    float3 eye( view.mInvView.m[3][0], view.mInvView.m[3][1], view.mInvView.m[3][2] );
+    return mul( eye, view.mInvWorld, 1.0f );
+}
+
+void GetBlockCone( const CpuView& view, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1,
+                   unsigned int W, unsigned int H, Ray* pRay, float* pk )
+{
+    GetRay( view, ( x0 + x1 + 1 ) * 0.5f / W, ( y0 + y1 + 1 ) * 0.5f / H, pRay );
+
+    const unsigned int cx[4] = { x0, x1, x0, x1 };
+    const unsigned int cy[4] = { y0, y0, y1, y1 };
+    float c = 1;
+    for( int i = 0; i < 4; ++i )
+    {
+        Ray corner;
+        GetRay( view, ( cx[i] + 0.5f ) / W, ( cy[i] + 0.5f ) / H, &corner );
+        c = fminf( c, dot( corner.dir, pRay->dir ) );
+    }
+    *pk = sqrtf( fmaxf( 1 - c * c, 0.0f ) ) / c;
+}
+
+//--------------------------------------------------------------------------------------
+// CCpuRenderer
+//--------------------------------------------------------------------------------------
+CCpuRenderer::CCpuRenderer() :
+    m_pKernels( &GetCpuKernels() ),
+    m_nTileSize( 16 ),
+    m_bCostBalancing( true ),
+    m_bPacketDE( true ),
+    m_bFastMath( false ),
+    m_bAnalyticNormals( true ),
+    m_eKernel( DK_TRIG ),
+    m_nPower( MANDELBULB_DEFAULT_POWER ),
+    m_nCellsX( 0 ),
+    m_nCellsY( 0 ),
+    m_nCostWidth( 0 ),
+    m_nCostHeight( 0 ),
+    m_bConePrepass( false ),
+    m_bBundles( false ),
+    m_bWavefront( false ),
+    m_pDistanceCache( NULL ),
+    m_nCacheSteps( 0 ),
+    m_nConeSteps( 0 ),
+    m_bReproject( false ),
+    m_eHistoryFractal( FT_MANDELBULB ),
+    m_vHistoryEye( 0, 0, 0 ),
+    m_nReprojDistSize( 0 )
+{
+    m_MandelboxParams = MakeMandelboxParams();
+    m_fMandelboxBound = -1;
+    memset( &m_LaneStats, 0, sizeof( m_LaneStats ) );
+}
+
+void CCpuRenderer::Render( const CpuView& view, FRACTAL_TYPE eFractal, CpuImage* pImage )
+{
+    if( eFractal != m_eHistoryFractal )
+        m_History.clear();
+    m_eHistoryFractal = eFractal;
+
+    if( eFractal == FT_MANDELBOX && m_fMandelboxBound < 0 )
+    {
+        CpuFractal box = MakeCpuFractal( FT_MANDELBOX );
+        box.Mandelbox = m_MandelboxParams;
+        m_fMandelboxBound = 1.1f * GetFractalRadius( box );
+    }
+
+    CpuKernelParams params;
+    params.eFractal = eFractal;
+    params.eKernel = m_eKernel;
+    params.nPower = m_nPower;
+    params.bFastMath = m_bFastMath;
+    params.pMandelboxParams = &m_MandelboxParams;
+    params.fMandelboxBound = m_fMandelboxBound;
+    params.bPacketDE = m_bPacketDE;
+    params.bAnalyticNormals = m_bAnalyticNormals;
+    params.pDistanceCache = UsesDistanceCache( eFractal ) ? m_pDistanceCache : NULL;
+    RenderTiles( view, params, pImage );
+}
+
+// Whether the distance cache was built for the fractal Render draws with the current
+// settings; the mandelbulb kernel and fast math only round the same DE differently
+bool CCpuRenderer::UsesDistanceCache( FRACTAL_TYPE eFractal ) const
+{
+    if( !m_pDistanceCache || m_pDistanceCache->IsEmpty() )
+        return false;
+    const CpuFractal& f = m_pDistanceCache->GetFractal();
+    if( f.eFractal != eFractal )
+        return false;
+    if( eFractal == FT_MANDELBULB )
+        return f.nPower == m_nPower;
+    const MandelboxParams& a = f.Mandelbox;
+    const MandelboxParams& b = m_MandelboxParams;
+    return a.scale == b.scale && a.boxfold.x == b.boxfold.x && a.boxfold.y == b.boxfold.y &&
+           a.boxfold.z == b.boxfold.z && a.spherefold == b.spherefold && a.iterations == b.iterations;
+}
+
+float CCpuRenderer::PredictCost( unsigned int x, unsigned int y, unsigned int w, unsigned int h ) const
+{
+    const unsigned int T = m_nTileSize;
+    float fCost = 0;
+    for( unsigned int cy = y / T; cy < ( y + h + T - 1 ) / T; ++cy )
+        for( unsigned int cx = x / T; cx < ( x + w + T - 1 ) / T; ++cx )
+            fCost += m_CellCost[cy * m_nCellsX + cx];
+    return fCost;
+}
+
+// Quadtree split of a block until its predicted cost fits the budget
+void CCpuRenderer::SplitTile( unsigned int x, unsigned int y, unsigned int nSize, float fBudget )
+{
+    if( x >= m_nCostWidth || y >= m_nCostHeight )
+        return;
+
+    TileCost tile;
+    tile.x = x;
+    tile.y = y;
+    tile.w = ( x + nSize < m_nCostWidth ) ? nSize : m_nCostWidth - x;
+    tile.h = ( y + nSize < m_nCostHeight ) ? nSize : m_nCostHeight - y;
+    tile.fPredicted = PredictCost( tile.x, tile.y, tile.w, tile.h );
+    tile.fActual = 0;
+
+    if( nSize > m_nTileSize && tile.fPredicted > fBudget )
+    {
+        unsigned int nHalf = nSize / 2;
+        SplitTile( x, y, nHalf, fBudget );
+        SplitTile( x + nHalf, y, nHalf, fBudget );
+        SplitTile( x, y + nHalf, nHalf, fBudget );
+        SplitTile( x + nHalf, y + nHalf, nHalf, fBudget );
+        return;
+    }
+    m_Tiles.push_back( tile );
+}
+
+//--------------------------------------------------------------------------------------
+// Without a cost map every tile is m_nTileSize. With the map of the previous frame the
+// image is covered by 4x4 cell blocks which are split where they are expensive, so the
+// silhouette gets small tiles and empty space a few large ones, and the scheduler can
+// start the expensive tiles first.
+//--------------------------------------------------------------------------------------
+void CCpuRenderer::BuildTiles( unsigned int nWidth, unsigned int nHeight )
+{
+    const unsigned int T = m_nTileSize;
+    const unsigned int nCellsX = ( nWidth + T - 1 ) / T;
+    const unsigned int nCellsY = ( nHeight + T - 1 ) / T;
+
+    if( !m_bCostBalancing || nWidth != m_nCostWidth || nHeight != m_nCostHeight ||
+        m_CellCost.size() != nCellsX * nCellsY )
+    {
+        m_CellCost.clear();
+    }
+    m_nCellsX = nCellsX;
+    m_nCellsY = nCellsY;
+    m_nCostWidth = nWidth;
+    m_nCostHeight = nHeight;
+    m_CellCostNext.assign( nCellsX * nCellsY, 0.0f );
+    m_Tiles.clear();
+
+    if( m_CellCost.empty() )
+    {
+        for( unsigned int y = 0; y < nHeight; y += T )
+            for( unsigned int x = 0; x < nWidth; x += T )
+            {
+                TileCost tile = { x, y, ( x + T < nWidth ) ? T : nWidth - x, ( y + T < nHeight ) ? T : nHeight - y, 0, 0 };
+                m_Tiles.push_back( tile );
+            }
+        return;
+    }
+
+    // Aim for at least 16 tiles per thread on the expensive parts of the image
+    float fTotal = 0;
+    for( size_t i = 0; i < m_CellCost.size(); ++i )
+        fTotal += m_CellCost[i];
+    float fBudget = fTotal / ( 16.0f * m_Scheduler.GetThreadCount() );
+
+    const unsigned int B = 4 * T;
+    for( unsigned int y = 0; y < nHeight; y += B )
+        for( unsigned int x = 0; x < nWidth; x += B )
+            SplitTile( x, y, B, fBudget );
+
+    m_TilePredicted.resize( m_Tiles.size() );
+    for( size_t i = 0; i < m_Tiles.size(); ++i )
+        m_TilePredicted[i] = m_Tiles[i].fPredicted;
+}
+
+//--------------------------------------------------------------------------------------
+// Cone marching pre-pass, see cone_marching. Blocks of CONE_TOP_BLOCK pixels are split
+// into quadrants down to CONE_LEAF_BLOCK; every quadrant starts from its parent's
+// distance scaled by cos(atan(k)), up to which the parent's empty cone contains all of
+// the quadrant's rays. The compute shader path (ConeCS.hlsl) does the same in two levels.
+//--------------------------------------------------------------------------------------
+static const unsigned int CONE_TOP_BLOCK = 32;
+static const unsigned int CONE_LEAF_BLOCK = 4;
+
+static void ConeBlock( const CpuView& view, const CpuKernels& kernels, const CpuKernelParams& params, unsigned int x0,
+                       unsigned int y0, unsigned int nSize, float t, unsigned int W, unsigned int H, float* pLeafDist,
+                       unsigned int nLeavesX, unsigned int& nSteps )
+{
+    if( x0 >= W || y0 >= H )
+        return;
+
+    Ray ray;
+    float k;
+    unsigned int x1 = ( x0 + nSize < W ) ? x0 + nSize : W;
+    unsigned int y1 = ( y0 + nSize < H ) ? y0 + nSize : H;
+    GetBlockCone( view, x0, y0, x1 - 1, y1 - 1, W, H, &ray, &k );
+    t = kernels.pfnConeMarch( view, params, ray, k, t / sqrtf( 1 + k * k ), &nSteps );
+
+    if( nSize <= CONE_LEAF_BLOCK )
+    {
+        pLeafDist[( y0 / CONE_LEAF_BLOCK ) * nLeavesX + x0 / CONE_LEAF_BLOCK] = t;
+        return;
+    }
+    unsigned int nHalf = nSize / 2;
+    ConeBlock( view, kernels, params, x0, y0, nHalf, t, W, H, pLeafDist, nLeavesX, nSteps );
+    ConeBlock( view, kernels, params, x0 + nHalf, y0, nHalf, t, W, H, pLeafDist, nLeavesX, nSteps );
+    ConeBlock( view, kernels, params, x0, y0 + nHalf, nHalf, t, W, H, pLeafDist, nLeavesX, nSteps );
+    ConeBlock( view, kernels, params, x0 + nHalf, y0 + nHalf, nHalf, t, W, H, pLeafDist, nLeavesX, nSteps );
+}
+
+void CCpuRenderer::ConePrepass( const CpuView& view, const CpuKernelParams& params, unsigned int W, unsigned int H )
+{
+    const unsigned int nLeavesX = ( W + CONE_LEAF_BLOCK - 1 ) / CONE_LEAF_BLOCK;
+    const unsigned int nLeavesY = ( H + CONE_LEAF_BLOCK - 1 ) / CONE_LEAF_BLOCK;
+    const unsigned int nTopX = ( W + CONE_TOP_BLOCK - 1 ) / CONE_TOP_BLOCK;
+    const unsigned int nTopY = ( H + CONE_TOP_BLOCK - 1 ) / CONE_TOP_BLOCK;
+    m_ConeDist.resize( nLeavesX * nLeavesY );
+    float* pLeafDist = &m_ConeDist[0];
+
+    std::atomic<unsigned int> nTotalSteps( 0 );
+    m_Scheduler.Run( nTopX * nTopY, [&]( unsigned int nBlock, unsigned int )
+    {
+        unsigned int nSteps = 0;
+        ConeBlock( view, *m_pKernels, params, ( nBlock % nTopX ) * CONE_TOP_BLOCK, ( nBlock / nTopX ) * CONE_TOP_BLOCK,
+                   CONE_TOP_BLOCK, 0.0f, W, H, pLeafDist, nLeavesX, nSteps );
+        nTotalSteps += nSteps;
+    } );
+    m_nConeSteps = nTotalSteps;
+}
+
+float CCpuRenderer::ConeDistance( unsigned int x, unsigned int y, unsigned int W ) const
+{
+    const unsigned int nLeavesX = ( W + CONE_LEAF_BLOCK - 1 ) / CONE_LEAF_BLOCK;
+    return m_ConeDist[( y / CONE_LEAF_BLOCK ) * nLeavesX + x / CONE_LEAF_BLOCK];
+}
+
+//--------------------------------------------------------------------------------------
+// Temporal reprojection. Every hit of the previous frame is projected into the current
+// view and the distance from the new eye is kept per pixel, nearest first. The hits are
+// in fractal space, so GetRay is inverted: the direction from the eye to the hit goes
+// through the inverse of (float3x3)mInvView * (float3x3)mInvWorld into view space, where
+// x/z and y/z give the screen position.
+//--------------------------------------------------------------------------------------
+static const unsigned int NO_HIT_BITS = 0x7f800000;    // +inf
+
+void CCpuRenderer::ReprojectHistory( const CpuView& view, unsigned int W, unsigned int H )
+{
+    if( m_nReprojDistSize != W * H )
+    {
+        m_pReprojDist.reset( new std::atomic<unsigned int>[W * H] );
+        m_nReprojDistSize = W * H;
+    }
+    std::atomic<unsigned int>* pDist = m_pReprojDist.get();
+    for( size_t i = 0; i < m_nReprojDistSize; ++i )
+        pDist[i].store( NO_HIT_BITS, std::memory_order_relaxed );
+
+    const float3 eye = GetEye( view );
+    const float4x4 M = inverse3x3( mul3x3( view.mInvView, view.mInvWorld ) );
+    const float sx = view.mProj.m[0][0], sy = view.mProj.m[1][1];
+    const float4* pHistory = &m_History[0];
+
+    m_Scheduler.Run( H, [&]( unsigned int y, unsigned int )
+    {
+        for( unsigned int x = 0; x < W; ++x )
+        {
+            const float4& hit = pHistory[y * W + x];
+            if( hit.w < 0 )
+                continue;
+
+            float3 v = hit.xyz() - eye;
+            float3 d = mul3x3( v, M );
+            if( d.z <= 0 )
+                continue;
+            float px = ( d.x / d.z * sx + 1 ) * 0.5f * W;
+            float py = ( 1 - d.y / d.z * sy ) * 0.5f * H;
+            if( !( px >= 0 && px < W && py >= 0 && py < H ) )
+                continue;
+
+            // Positive floats order like their bit patterns
+            float t = length( v );
+            unsigned int nBits;
+            memcpy( &nBits, &t, sizeof( nBits ) );
+            std::atomic<unsigned int>& dst = pDist[( unsigned int )py * W + ( unsigned int )px];
+            unsigned int nOld = dst.load( std::memory_order_relaxed );
+            while( nBits < nOld && !dst.compare_exchange_weak( nOld, nBits, std::memory_order_relaxed ) )
+                ;
+        }
+    } );
+}
+
+// Start distance for a pixel: the nearest reprojected hit in its 3x3 neighbourhood, less
+// 1% and the distance the eye has moved. 0 (start at the camera) if a neighbour has none.
+float CCpuRenderer::SeedDistance( unsigned int x, unsigned int y, unsigned int W, unsigned int H, float fMove ) const
+{
+    unsigned int nMin = NO_HIT_BITS;
+    for( unsigned int sy = ( y > 0 ? y - 1 : 0 ); sy <= y + 1 && sy < H; ++sy )
+        for( unsigned int sx = ( x > 0 ? x - 1 : 0 ); sx <= x + 1 && sx < W; ++sx )
+        {
+            unsigned int nBits = m_pReprojDist[sy * W + sx].load( std::memory_order_relaxed );
+            if( nBits == NO_HIT_BITS )
+                return 0;
+            if( nBits < nMin ) nMin = nBits;
+        }
+
+    float t;
+    memcpy( &t, &nMin, sizeof( t ) );
+    t -= t * 0.01f + fMove;
+    return t > 0 ? t : 0;
+}
+
+void CCpuRenderer::RenderTiles( const CpuView& view, const CpuKernelParams& params, CpuImage* pImage )
+{
+    const unsigned int W = pImage->Width;
+    const unsigned int H = pImage->Height;
+    const unsigned int T = m_nTileSize;
+    const CpuKernels& kernels = *m_pKernels;
+
+    BuildTiles( W, H );
+    const bool bPredicted = !m_CellCost.empty();
+
+    m_nConeSteps = 0;
+    const bool bCone = m_bConePrepass;
+    if( bCone )
+        ConePrepass( view, params, W, H );
+
+    const bool bSeed = m_bReproject && m_History.size() == W * H;
+    const float3 eye = GetEye( view );
+    const float fMove = length( eye - m_vHistoryEye );
+    if( bSeed )
+        ReprojectHistory( view, W, H );
+    if( m_bReproject )
+        m_History.resize( W * H );
+    float4* pHistory = m_bReproject ? &m_History[0] : NULL;
+    const unsigned int nCellsX = m_nCellsX;
+    float* pCellCost = &m_CellCostNext[0];
+
+    // The wavefront needs the packet DEs and takes precedence over bundles
+    const bool bWavefront = m_bWavefront && m_bPacketDE;
+    const bool bBundles = m_bBundles && !bWavefront;
+    std::atomic<unsigned int> nBundleSteps( 0 );
+    m_ThreadLaneStats.resize( m_Scheduler.GetThreadCount() );
+    memset( &m_ThreadLaneStats[0], 0, m_ThreadLaneStats.size() * sizeof( CpuLaneStats ) );
+
+    m_Scheduler.Run( ( unsigned int )m_Tiles.size(), [&]( unsigned int nTile, unsigned int nThread )
+    {
+        TileCost& tile = m_Tiles[nTile];
+        const unsigned int x0 = tile.x, y0 = tile.y;
+        const unsigned int x1 = x0 + tile.w, y1 = y0 + tile.h;
+        const unsigned int B = CPU_BUNDLE_SIZE;
+        const size_t nSize = bWavefront ? tile.w * tile.h : bBundles ? B * B : tile.w;
+        CpuLaneStats* pLaneStats = &m_ThreadLaneStats[nThread];
+        std::vector<float> start( nSize ), seed( nSize );
+        std::vector<int> steps( nSize );
+        float fSteps = 0;
+
+        // Start at the cone distance, then move on to the reprojected hit where it is further
+        auto StartAt = [&]( unsigned int x, unsigned int y, size_t i )
+        {
+            start[i] = bCone ? ConeDistance( x, y, W ) : 0;
+            if( bSeed )
+                seed[i] = fmaxf( SeedDistance( x, y, W, H, fMove ) - start[i], 0.0f );
+        };
+        // Tiles never share a cell, so no other thread writes this one
+        auto AddSteps = [&]( unsigned int x, unsigned int y, float fRaySteps )
+        {
+            pCellCost[( y / T ) * nCellsX + x / T] += fRaySteps;
+            fSteps += fRaySteps;
+        };
+
+        if( bWavefront )
+        {
+            for( unsigned int i = 0; i < tile.w * tile.h; ++i )
+                StartAt( x0 + i % tile.w, y0 + i / tile.w, i );
+            kernels.pfnRenderWavefront( view, params, W, H, x0, y0, x1, y1, &start[0], bSeed ? &seed[0] : NULL,
+                                        &pImage->Pixels[0], pHistory, &steps[0], pLaneStats );
+            for( unsigned int i = 0; i < tile.w * tile.h; ++i )
+                AddSteps( x0 + i % tile.w, y0 + i / tile.w, ( float )steps[i] );
+        }
+        else if( bBundles )
+        {
+            for( unsigned int by = y0; by < y1; by += B )
+                for( unsigned int bx = x0; bx < x1; bx += B )
+                {
+                    const unsigned int bw = ( bx + B < x1 ) ? B : x1 - bx;
+                    const unsigned int bh = ( by + B < y1 ) ? B : y1 - by;
+                    for( unsigned int i = 0; i < bw * bh; ++i )
+                        StartAt( bx + i % bw, by + i / bw, i );
+                    unsigned int nConeSteps = 0;
+                    kernels.pfnRenderBundle( view, params, W, H, bx, by, bx + bw, by + bh, &start[0],
+                                             bSeed ? &seed[0] : NULL, &pImage->Pixels[0], pHistory, &steps[0],
+                                             &nConeSteps, pLaneStats );
+                    for( unsigned int i = 0; i < bw * bh; ++i )
+                        AddSteps( bx + i % bw, by + i / bw, ( float )steps[i] );
+                    nBundleSteps += nConeSteps;
+                }
+        }
+        else
+        {
+            for( unsigned int y = y0; y < y1; ++y )
+            {
+                for( unsigned int i = 0; i < tile.w; ++i )
+                    StartAt( x0 + i, y, i );
+                kernels.pfnRenderSpan( view, params, W, H, x0, x1, y, &start[0], bSeed ? &seed[0] : NULL,
+                                       &pImage->Pixels[y * W + x0], pHistory ? pHistory + y * W + x0 : NULL, &steps[0],
+                                       pLaneStats );
+                for( unsigned int i = 0; i < tile.w; ++i )
+                    AddSteps( x0 + i, y, ( float )steps[i] );
+            }
+        }
+        tile.fActual = fSteps;
+    }, bPredicted ? &m_TilePredicted[0] : NULL );
+    m_nConeSteps += nBundleSteps;
+
+    memset( &m_LaneStats, 0, sizeof( m_LaneStats ) );
+    for( size_t i = 0; i < m_ThreadLaneStats.size(); ++i )
+    {
+        for( int q = 0; q < LQ_COUNT; ++q )
+        {
+            m_LaneStats.Queue[q].nLanes += m_ThreadLaneStats[i].Queue[q].nLanes;
+            m_LaneStats.Queue[q].nActive += m_ThreadLaneStats[i].Queue[q].nActive;
+        }
+        m_LaneStats.nCacheSteps += m_ThreadLaneStats[i].nCacheSteps;
+    }
+    m_nCacheSteps = ( unsigned int )m_LaneStats.nCacheSteps;
+
+    m_CellCost.swap( m_CellCostNext );
+    m_vHistoryEye = eye;
+}
+
+//--------------------------------------------------------------------------------------
+// Camera helpers
+//--------------------------------------------------------------------------------------
+void BuildCpuView( const float3& vEye, const float3& vAt, float fFOV, float fAspect,
+                   float fNear, float fFar, float dist, CpuView* pView )
+{
+    memset( pView, 0, sizeof( CpuView ) );
+
+    // D3DXMatrixPerspectiveFovLH
+    float yScale = 1.0f / tanf( fFOV * 0.5f );
+    pView->mProj.m[0][0] = yScale / fAspect;
+    pView->mProj.m[1][1] = yScale;
+    pView->mProj.m[2][2] = fFar / ( fFar - fNear );
+    pView->mProj.m[2][3] = 1.0f;
+    pView->mProj.m[3][2] = -fNear * fFar / ( fFar - fNear );
+
+    // Inverse of D3DXMatrixLookAtLH: the rows are the camera basis and the eye point
+    float3 zaxis = normalize( vAt - vEye );
+    float3 xaxis = normalize( cross( float3( 0, 1, 0 ), zaxis ) );
+    float3 yaxis = cross( zaxis, xaxis );
+    const float3 rows[4] = { xaxis, yaxis, zaxis, vEye };
+    for( int i = 0; i < 4; ++i )
+    {
+        pView->mInvView.m[i][0] = rows[i].x;
+        pView->mInvView.m[i][1] = rows[i].y;
+        pView->mInvView.m[i][2] = rows[i].z;
+        pView->mInvView.m[i][3] = ( i == 3 ) ? 1.0f : 0.0f;
+    }
+
+    pView->mInvWorld = Identity4x4();
+    pView->dist = dist;
+    pView->relax = 1;
+}
+
+//--------------------------------------------------------------------------------------
+// File I/O
+//--------------------------------------------------------------------------------------
+FILE* OpenFileW( const wchar_t* szFileName, const wchar_t* szMode )
+{
+#ifdef _WIN32
+    FILE* pFile = NULL;
+    if( _wfopen_s( &pFile, szFileName, szMode ) != 0 )
+        return NULL;
+    return pFile;
+#else
+    char szName[1024], szM[16];
+    if( wcstombs( szName, szFileName, sizeof( szName ) ) == ( size_t )-1 ||
+        wcstombs( szM, szMode, sizeof( szM ) ) == ( size_t )-1 )
+        return NULL;
+    return fopen( szName, szM );
+#endif
+}
+
+static void PutLE( unsigned char* p, unsigned int v, int nBytes )
+{
+    for( int i = 0; i < nBytes; ++i )
+        p[i] = ( unsigned char )( v >> ( 8 * i ) );
+}
+
+static unsigned int GetLE( const unsigned char* p, int nBytes )
+{
+    unsigned int v = 0;
+    for( int i = 0; i < nBytes; ++i )
+        v |= ( unsigned int )p[i] << ( 8 * i );
+    return v;
+}
+
+// Writes a bottom-up 24 bit BMP
+bool SaveBMP( const wchar_t* szFileName, const CpuImage& image )
+{
+    FILE* pFile = OpenFileW( szFileName, L"wb" );
+    if( !pFile )
+        return false;
+
+    const unsigned int nPitch = ( image.Width * 3 + 3 ) & ~3u;
+    unsigned char header[54];
+    memset( header, 0, sizeof( header ) );
+    header[0] = 'B'; header[1] = 'M';
+    PutLE( header + 2, 54 + nPitch * image.Height, 4 );
+    PutLE( header + 10, 54, 4 );
+    PutLE( header + 14, 40, 4 );
+    PutLE( header + 18, image.Width, 4 );
+    PutLE( header + 22, image.Height, 4 );
+    PutLE( header + 26, 1, 2 );
+    PutLE( header + 28, 24, 2 );
+    PutLE( header + 34, nPitch * image.Height, 4 );
+    bool bOK = fwrite( header, sizeof( header ), 1, pFile ) == 1;
+
+    std::vector<unsigned char> row( nPitch, 0 );
+    for( unsigned int y = 0; y < image.Height && bOK; ++y )
+    {
+        const unsigned int* pSrc = &image.Pixels[( image.Height - 1 - y ) * image.Width];
+        for( unsigned int x = 0; x < image.Width; ++x )
+        {
+            row[x * 3 + 0] = ( unsigned char )( pSrc[x] >> 16 );
+            row[x * 3 + 1] = ( unsigned char )( pSrc[x] >> 8 );
+            row[x * 3 + 2] = ( unsigned char )( pSrc[x] );
+        }
+        bOK = fwrite( &row[0], nPitch, 1, pFile ) == 1;
+    }
+
+    fclose( pFile );
+    return bOK;
+}
+
+// Reads an uncompressed 24 or 32 bit BMP, e.g. one written by DXUTSnapD3D11Screenshot
+bool LoadBMP( const wchar_t* szFileName, CpuImage* pImage )
+{
+    FILE* pFile = OpenFileW( szFileName, L"rb" );
+    if( !pFile )
+        return false;
+
+    unsigned char header[54];
+    bool bOK = fread( header, sizeof( header ), 1, pFile ) == 1 && header[0] == 'B' && header[1] == 'M';
+    if( bOK )
+    {
+        unsigned int nOffset = GetLE( header + 10, 4 );
+        int w = ( int )GetLE( header + 18, 4 );
+        int h = ( int )GetLE( header + 22, 4 );
+        unsigned int nBpp = GetLE( header + 28, 2 );
+        unsigned int nCompression = GetLE( header + 30, 4 );
+        bool bTopDown = h < 0;
+        if( bTopDown ) h = -h;
+
+        bOK = w > 0 && h > 0 && ( nBpp == 24 || nBpp == 32 ) && ( nCompression == 0 || nCompression == 3 ) &&
+              fseek( pFile, nOffset, SEEK_SET ) == 0;
+        if( bOK )
+        {
+            const unsigned int nBytes = nBpp / 8;
+            const unsigned int nPitch = ( w * nBytes + 3 ) & ~3u;
+            std::vector<unsigned char> row( nPitch );
+            pImage->Resize( w, h );
+            for( int y = 0; y < h && bOK; ++y )
+            {
+                bOK = fread( &row[0], nPitch, 1, pFile ) == 1;
+                unsigned int* pDst = &pImage->Pixels[( bTopDown ? y : h - 1 - y ) * w];
+                for( int x = 0; x < w; ++x )
+                {
+                    const unsigned char* p = &row[x * nBytes];
+                    pDst[x] = p[2] | ( p[1] << 8 ) | ( p[0] << 16 ) | 0xff000000u;
+                }
+            }
+        }
+    }
+
+    fclose( pFile );
+    return bOK;
+}
+
+static bool WriteMatrix( FILE* pFile, const char* szName, const float4x4& M )
+{
+    fprintf( pFile, "%s", szName );
+    for( int i = 0; i < 4; ++i )
+        for( int j = 0; j < 4; ++j )
+            fprintf( pFile, " %.9g", M.m[i][j] );
+    return fprintf( pFile, "\n" ) > 0;
+}
+
+static bool ReadMatrix( FILE* pFile, const char* szName, float4x4* pM )
+{
+    char szTag[32];
+    if( fscanf( pFile, "%31s", szTag ) != 1 || strcmp( szTag, szName ) != 0 )
+        return false;
+    for( int i = 0; i < 4; ++i )
+        for( int j = 0; j < 4; ++j )
+            if( fscanf( pFile, "%f", &pM->m[i][j] ) != 1 )
+                return false;
+    return true;
+}
+
+// Text dump of the constant buffer, written by the interactive app on frame capture
+bool SaveCpuView( const wchar_t* szFileName, const CpuView& view )
+{
+    FILE* pFile = OpenFileW( szFileName, L"wt" );
+    if( !pFile )
+        return false;
+
+    bool bOK = WriteMatrix( pFile, "mProj", view.mProj ) &&
+               WriteMatrix( pFile, "mInvWorld", view.mInvWorld ) &&
+               WriteMatrix( pFile, "mInvView", view.mInvView ) &&
+               fprintf( pFile, "dist %.9g\n", view.dist ) > 0 &&
+               fprintf( pFile, "relax %.9g\n", view.relax ) > 0 &&
+               fprintf( pFile, "pixelSize %.9g\n", view.pixelSize ) > 0 &&
+               fprintf( pFile, "refine %.9g\n", view.refine ) > 0;
+
+    fclose( pFile );
+    return bOK;
+}
+
+bool LoadCpuView( const wchar_t* szFileName, CpuView* pView )
+{
+    FILE* pFile = OpenFileW( szFileName, L"rt" );
+    if( !pFile )
+        return false;
+
+    memset( pView, 0, sizeof( CpuView ) );
+    char szTag[32];
+    bool bOK = ReadMatrix( pFile, "mProj", &pView->mProj ) &&
+               ReadMatrix( pFile, "mInvWorld", &pView->mInvWorld ) &&
+               ReadMatrix( pFile, "mInvView", &pView->mInvView ) &&
+               fscanf( pFile, "%31s %f", szTag, &pView->dist ) == 2 && strcmp( szTag, "dist" ) == 0;
+
+    // Optional fields; views saved by older versions end after dist
+    pView->relax = 1;
+    float fValue;
+    while( bOK && fscanf( pFile, "%31s %f", szTag, &fValue ) == 2 )
+    {
+        if( strcmp( szTag, "relax" ) == 0 ) pView->relax = fValue;
+        else if( strcmp( szTag, "pixelSize" ) == 0 ) pView->pixelSize = fValue;
+        else if( strcmp( szTag, "refine" ) == 0 ) pView->refine = fValue;
+    }
+
+    fclose( pFile );
+    return bOK;
+}
@@ -0,0 +1,232 @@
+//--------------------------------------------------------------------------------------
+// File: cpurender.h
+//
+// Headless multi-threaded CPU implementation of the mandelbulb / mandelbox renderer.
+//
+// This is a port of GetRay (frac.fx), ray_marching (raymarch.fx) and shade() from the
+// pixel shaders. The image is split into screen tiles which are rendered on all cores
+// by a work-stealing scheduler (tilescheduler.h).
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef CPURENDER_H
+#define CPURENDER_H
+
+#include "cpumath.h"
+#include "fracde.h"
+#include "tilescheduler.h"
+#include <stdio.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+enum FRACTAL_TYPE
+{
+    FT_MANDELBULB,
+    FT_MANDELBOX,
+};
+
+// Same layout and meaning as CbMandelbulb in frac.cpp / cbView in frac.fx
+struct CpuView
+{
+    float4x4 mProj;
+    float4x4 mInvWorld;
+    float4x4 mInvView;
+    float dist;
+    float relax;
+    float pixelSize;
+    // Loose hit threshold in hit epsilons before refine_hit, 0 = off (default). Not a speed
+    // option: at 320x240 it never beats the plain march. 2x costs 23.3 steps/ray at a mean
+    // error of 2.05 against a 16x finer march, 4x 22.5 at 2.40; plain takes 23.4 at 1.56.
+    float refine;
+};
+
+struct Ray
+{
+    float3 pos;
+    float3 dir;
+};
+
+// RGBA8 image, same byte order as DXGI_FORMAT_R8G8B8A8_UNORM
+struct CpuImage
+{
+    unsigned int Width;
+    unsigned int Height;
+    std::vector<unsigned int> Pixels;
+
+    CpuImage() : Width( 0 ), Height( 0 ) {}
+    void Resize( unsigned int w, unsigned int h ) { Width = w; Height = h; Pixels.resize( w * h ); }
+};
+
+// Predicted and measured cost of one screen tile of the last frame, in primary ray
+// marching steps (DE evaluations)
+struct TileCost
+{
+    unsigned int x, y, w, h;
+    float fPredicted;           // from the previous frame's steps, 0 if there was none
+    float fActual;
+};
+
+// SIMD lane use of the packet DE evaluations of a Render, by the kind of ray: lanes
+// evaluated, and how many of them carried a ray that was still marching
+enum LANE_QUEUE
+{
+    LQ_PRIMARY,
+    LQ_SHADOW,                  // shadow rays of the mandelbulb
+    LQ_SAMPLES,                 // AO samples, and the one shadow sample of the mandelbox
+    LQ_COUNT,
+};
+
+struct CpuLaneCount
+{
+    unsigned long long nLanes;
+    unsigned long long nActive;
+};
+
+struct CpuLaneStats
+{
+    CpuLaneCount Queue[LQ_COUNT];
+    unsigned long long nCacheSteps; // of the shadow rays through the distance cache
+};
+
+struct CpuKernels;
+struct CpuKernelParams;
+class CDistanceCache;
+
+class CCpuRenderer
+{
+public:
+    CCpuRenderer();
+
+    // 0 means one thread per hardware thread
+    void SetThreadCount( unsigned int nThreads ) { m_Scheduler.SetThreadCount( nThreads ); }
+    // Smallest tile; tiles are up to 4x larger where the previous frame was cheap
+    void SetTileSize( unsigned int nTileSize ) { m_nTileSize = nTileSize; m_CellCost.clear(); }
+    // Size and order tiles by the step counts of the previous frame (default on)
+    void SetCostBalancing( bool bCostBalancing ) { m_bCostBalancing = bCostBalancing; }
+    // Start primary rays just short of the previous frame's hits reprojected into the new
+    // view. Off by default: the shaders color by the step count, so skipping the empty
+    // space in front of the surface also changes the image.
+    void SetTemporalReprojection( bool bReproject ) { m_bReproject = bReproject; m_History.clear(); }
+    // Low resolution cone marching pre-pass giving every 4x4 pixel block a safe start
+    // distance. Off by default for the same reason as reprojection.
+    void SetConePrepass( bool bConePrepass ) { m_bConePrepass = bConePrepass; }
+    // March primary rays in bundles of CPU_BUNDLE_SIZE square pixels which share their
+    // steps through empty space. Off by default for the same reason as the pre-pass.
+    void SetBundleMarching( bool bBundles ) { m_bBundles = bBundles; }
+    // Wavefront marching: the rays of a tile wait in a queue and are marched a few steps
+    // at a time, SIMD_WIDTH rays still marching in every packet; shadow rays and AO samples
+    // get queues of their own. Off by default: shadows and AO use the packet DEs, which
+    // round slightly differently from the scalar ones of shade(). Needs the packet DEs.
+    void SetWavefront( bool bWavefront ) { m_bWavefront = bWavefront; }
+    // March the mandelbulb's shadow rays of shade() through a distance cache (distcache.h)
+    // wherever the DE finds them far enough from the surface, back with the DE where the
+    // cache gives up. Those are scalar 4 iteration DEs; the primary rays' packet DEs
+    // through empty space cost less than the cache lookups would, and the wavefront's
+    // shadow packets don't use it either. It pays where the shadow rays cross much empty
+    // space, not near the surface, where they take most of their steps: 128^3 cells take
+    // a 320x240 frame from about 545 to 470 ms at -eye:-1,1,1.5, and a -orbit:15 fly-by
+    // from 428-468 to 391-444 ms. The cache is used only while it holds the fractal being
+    // rendered, and must outlive its use; NULL (default) turns it off. Shadows can move by
+    // the rounding of the longer steps.
+    void SetDistanceCache( const CDistanceCache* pCache ) { m_pDistanceCache = pCache; }
+    // March primary rays in SIMD packets (default) instead of one at a time with the
+    // scalar reference distance estimator
+    void SetPacketDE( bool bPacketDE ) { m_bPacketDE = bPacketDE; }
+    // Packet mandelbulb DEs with the fast vmath.h functions (about 1e-5 relative error)
+    // instead of the precise ones; off by default
+    void SetFastMath( bool bFastMath ) { m_bFastMath = bFastMath; }
+    // Normals from the analytic gradient of the dual number DE (default) instead of the
+    // shaders' forward differences; turn off to reproduce a GPU frame exactly
+    void SetAnalyticNormals( bool bAnalyticNormals ) { m_bAnalyticNormals = bAnalyticNormals; }
+    void SetMandelbulbKernel( DE_KERNEL eKernel ) { m_eKernel = eKernel; }
+    // Mandelbulb power, MANDELBULB_MIN_POWER to MANDELBULB_MAX_POWER (default 8 as in the
+    // shaders); every power has its own compiled kernel
+    void SetMandelbulbPower( int nPower ) { m_nPower = nPower; }
+    // Build params with MakeMandelboxParams so the derived constants are up to date. The
+    // bounding sphere of the new box is probed on its first Render.
+    void SetMandelboxParams( const MandelboxParams& params ) { m_MandelboxParams = params; m_fMandelboxBound = -1; }
+
+    void Render( const CpuView& view, FRACTAL_TYPE eFractal, CpuImage* pImage );
+
+    // Per-thread busy/idle time and tile counts of the last Render
+    const std::vector<TileThreadStats>& GetThreadStats() const { return m_Scheduler.GetThreadStats(); }
+    // Tiles of the last Render with their predicted and actual cost
+    const std::vector<TileCost>& GetTileCosts() const { return m_Tiles; }
+    // DE evaluations of the cone pre-pass and the shared bundle steps of the last Render
+    unsigned int GetConeSteps() const { return m_nConeSteps; }
+    // Steps through the distance cache of the last Render
+    unsigned int GetCacheSteps() const { return m_nCacheSteps; }
+    // SIMD lane use of the packet DE evaluations of the last Render
+    const CpuLaneStats& GetLaneStats() const { return m_LaneStats; }
+
+private:
+    void RenderTiles( const CpuView& view, const CpuKernelParams& params, CpuImage* pImage );
+    bool UsesDistanceCache( FRACTAL_TYPE eFractal ) const;
+    void BuildTiles( unsigned int nWidth, unsigned int nHeight );
+    void SplitTile( unsigned int x, unsigned int y, unsigned int nSize, float fBudget );
+    float PredictCost( unsigned int x, unsigned int y, unsigned int w, unsigned int h ) const;
+    void ConePrepass( const CpuView& view, const CpuKernelParams& params, unsigned int nWidth, unsigned int nHeight );
+    float ConeDistance( unsigned int x, unsigned int y, unsigned int nWidth ) const;
+    void ReprojectHistory( const CpuView& view, unsigned int nWidth, unsigned int nHeight );
+    float SeedDistance( unsigned int x, unsigned int y, unsigned int nWidth, unsigned int nHeight, float fMove ) const;
+
+    CTileScheduler m_Scheduler;
+    const CpuKernels* m_pKernels;       // GetCpuKernels
+    unsigned int m_nTileSize;
+    bool m_bCostBalancing;
+    bool m_bPacketDE;
+    bool m_bFastMath;
+    bool m_bAnalyticNormals;
+    DE_KERNEL m_eKernel;
+    int m_nPower;
+    MandelboxParams m_MandelboxParams;
+    float m_fMandelboxBound;                // its BoundRadius, -1 until probed
+
+    // Steps per m_nTileSize cell of the previous frame (m_CellCost) and the current one
+    std::vector<float> m_CellCost;
+    std::vector<float> m_CellCostNext;
+    unsigned int m_nCellsX, m_nCellsY;
+    unsigned int m_nCostWidth, m_nCostHeight;
+    std::vector<TileCost> m_Tiles;
+    std::vector<float> m_TilePredicted;
+
+    bool m_bConePrepass;
+    bool m_bBundles;
+    bool m_bWavefront;
+    const CDistanceCache* m_pDistanceCache;
+    unsigned int m_nCacheSteps;
+    CpuLaneStats m_LaneStats;
+    std::vector<CpuLaneStats> m_ThreadLaneStats;
+    std::vector<float> m_ConeDist;          // start distance per 4x4 pixel block
+    unsigned int m_nConeSteps;
+
+    // Temporal reprojection: rm of every pixel of the previous frame, and the distance
+    // of the nearest reprojected hit per pixel of the current one (float bits)
+    bool m_bReproject;
+    FRACTAL_TYPE m_eHistoryFractal;
+    float3 m_vHistoryEye;
+    std::vector<float4> m_History;
+    std::unique_ptr<std::atomic<unsigned int>[]> m_pReprojDist;
+    size_t m_nReprojDistSize;
+};
+
+void GetRay( const CpuView& view, float ptx, float pty, Ray* pRay );
+// Ray origin of GetRay
+float3 GetEye( const CpuView& view );
+// Cone around the rays through pixel centers x0 .. x1, y0 .. y1 (inclusive) of a W x H
+// image: its axis and the tangent of its half angle
+void GetBlockCone( const CpuView& view, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1,
+                   unsigned int W, unsigned int H, Ray* pRay, float* pk );
+
+// Camera helpers for building a view without DXUT (matches D3DXMatrixLookAtLH / PerspectiveFovLH)
+void BuildCpuView( const float3& vEye, const float3& vAt, float fFOV, float fAspect,
+                   float fNear, float fFar, float dist, CpuView* pView );
+
+// Image and view file I/O
+FILE* OpenFileW( const wchar_t* szFileName, const wchar_t* szMode );
+bool SaveBMP( const wchar_t* szFileName, const CpuImage& image );
+bool LoadBMP( const wchar_t* szFileName, CpuImage* pImage );
+bool SaveCpuView( const wchar_t* szFileName, const CpuView& view );
+bool LoadCpuView( const wchar_t* szFileName, CpuView* pView );
+
+#endif // CPURENDER_H
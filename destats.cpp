@@ -0,0 +1,419 @@
+//--------------------------------------------------------------------------------------
+// File: destats.cpp
+//
+// Accuracy and throughput of the CPU distance estimator kernels against the scalar
+// reference (the float port of the shader DE).
+//
+// Points are drawn uniformly from a cube around each fractal. Besides the
+// absolute error the relative error is reported with a floor of 1e-4 on the reference,
+// since close to the surface both values are tiny and their ratio is meaningless. A sign
+// mismatch means a point was classified as inside by one kernel and outside by the other.
+//
+// The normal table compares the forward differences of the shaders (four DE calls) with
+// the analytic gradient of the dual number DE (one call) on the same points. The power
+// table times the compiled kernel of every mandelbulb power. The EvaluateDE rows are the
+// batched entry point of cpude.h on all threads with the kernels chosen for the CPU.
+//
+// PrintMathStats measures the vmath.h functions themselves. The error of a result is
+// given in ULP of the double precision libm value, i.e. |result - exact| / 2^(e - 23)
+// for an exact value in [2^e, 2^(e + 1)).
+//--------------------------------------------------------------------------------------
+#include "destats.h"
+#include "fracde.h"
+#include "fracde_simd.h"
+#include "cpude.h"
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <float.h>
+
+typedef std::function<void ( const float* px, const float* py, const float* pz, float* pOut, unsigned int n )> DEBATCH;
+
+template<class DEFN>
+static DEBATCH ScalarBatch( DEFN DE )
+{
+    return [DE]( const float* px, const float* py, const float* pz, float* pOut, unsigned int n )
+    {
+        for( unsigned int i = 0; i < n; ++i )
+            pOut[i] = DE( float3( px[i], py[i], pz[i] ) );
+    };
+}
+
+namespace SIMD_ISA
+{
+
+// n must be a multiple of SIMD_WIDTH
+template<class DEFN>
+static DEBATCH PacketBatch( DEFN DE )
+{
+    return [DE]( const float* px, const float* py, const float* pz, float* pOut, unsigned int n )
+    {
+        for( unsigned int i = 0; i < n; i += SIMD_WIDTH )
+            store( pOut + i, DE( vfloat3( load( px + i ), load( py + i ), load( pz + i ) ) ) );
+    };
+}
+
+} // namespace SIMD_ISA
+
+// EvaluateDE on all threads, including the copy of the points into float3s
+static DEBATCH BatchedDE( const CpuFractal& fractal )
+{
+    return [fractal]( const float* px, const float* py, const float* pz, float* pOut, unsigned int n )
+    {
+        std::vector<float3> p( n );
+        for( unsigned int i = 0; i < n; ++i )
+            p[i] = float3( px[i], py[i], pz[i] );
+        EvaluateDE( fractal, &p[0], n, pOut );
+    };
+}
+
+struct DE_KERNEL_ENTRY
+{
+    const char* szName;
+    DEBATCH batch;
+};
+
+static double TimeBatch( const DEBATCH& batch, const std::vector<float>* xyz, std::vector<float>* pOut )
+{
+    unsigned int n = ( unsigned int )pOut->size();
+    std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+    batch( &xyz[0][0], &xyz[1][0], &xyz[2][0], &( *pOut )[0], n );
+    std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>( t1 - t0 ).count() / n;
+}
+
+static void RandomPoints( float fExtent, unsigned int nSamples, std::vector<float>* xyz )
+{
+    unsigned int seed = 12345;
+    for( int c = 0; c < 3; ++c )
+    {
+        xyz[c].resize( nSamples );
+        for( unsigned int i = 0; i < nSamples; ++i )
+        {
+            seed = seed * 1664525u + 1013904223u;
+            xyz[c][i] = ( ( seed >> 8 ) / 16777216.0f * 2.0f - 1.0f ) * fExtent;
+        }
+    }
+}
+
+// The first entry is the reference the others are compared against
+static void PrintTable( const char* szTitle, float fExtent, const DE_KERNEL_ENTRY* pKernels, size_t nKernels, unsigned int nSamples )
+{
+    std::vector<float> xyz[3];
+    RandomPoints( fExtent, nSamples, xyz );
+
+    std::vector<float> ref( nSamples ), out( nSamples );
+    double fRefTime = TimeBatch( pKernels[0].batch, xyz, &ref );
+
+    printf( "%s DE, %u points in [-%g, %g]^3, %d lanes\n", szTitle, nSamples, fExtent, fExtent, SIMD_WIDTH );
+    printf( "%-16s %10s %8s %12s %12s %12s %8s\n", "kernel", "ns/point", "speedup", "max abs", "rms abs", "max rel", "sign" );
+    for( size_t k = 0; k < nKernels; ++k )
+    {
+        double fTime = ( k == 0 ) ? fRefTime : TimeBatch( pKernels[k].batch, xyz, &out );
+        const std::vector<float>& res = ( k == 0 ) ? ref : out;
+
+        double fMaxAbs = 0, fSumSq = 0, fMaxRel = 0;
+        unsigned int nSign = 0;
+        for( unsigned int i = 0; i < nSamples; ++i )
+        {
+            double d = fabs( ( double )res[i] - ref[i] );
+            double rel = d / fmax( fabs( ( double )ref[i] ), 1e-4 );
+            fMaxAbs = fmax( fMaxAbs, d );
+            fMaxRel = fmax( fMaxRel, rel );
+            fSumSq += d * d;
+            if( ( res[i] < 0 ) != ( ref[i] < 0 ) ) ++nSign;
+        }
+        printf( "%-16s %10.1f %7.2fx %12.3g %12.3g %12.3g %8u\n", pKernels[k].szName, fTime, fRefTime / fTime,
+                fMaxAbs, sqrt( fSumSq / nSamples ), fMaxRel, nSign );
+    }
+    printf( "\n" );
+}
+
+template<class DEFN, class GRADFN>
+static void PrintNormalTable( const char* szTitle, float fExtent, DEFN DE, GRADFN Grad, unsigned int nSamples )
+{
+    std::vector<float> xyz[3];
+    RandomPoints( fExtent, nSamples, xyz );
+    std::vector<float3> fd( nSamples ), an( nSamples );
+    std::vector<float> fdValue( nSamples ), anValue( nSamples );
+
+    std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+    for( unsigned int i = 0; i < nSamples; ++i )
+    {
+        float3 p( xyz[0][i], xyz[1][i], xyz[2][i] );
+        float k = DE( p );
+        fd[i] = float3( DE( p + float3( 1e-5f, 0, 0 ) ) - k, DE( p + float3( 0, 1e-5f, 0 ) ) - k, DE( p + float3( 0, 0, 1e-5f ) ) - k );
+        fdValue[i] = k;
+    }
+    std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+    for( unsigned int i = 0; i < nSamples; ++i )
+        anValue[i] = Grad( float3( xyz[0][i], xyz[1][i], xyz[2][i] ), &an[i] );
+    std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
+
+    // Angle between the two normals; a forward difference of exactly 0 gives no normal
+    double fSum = 0, fMax = 0, fMaxValue = 0;
+    unsigned int nDegenerate = 0, nOver1 = 0;
+    for( unsigned int i = 0; i < nSamples; ++i )
+    {
+        fMaxValue = fmax( fMaxValue, fabs( ( double )anValue[i] - fdValue[i] ) );
+        if( dot( fd[i], fd[i] ) == 0 || dot( an[i], an[i] ) == 0 )
+        {
+            ++nDegenerate;
+            continue;
+        }
+        double c = dot( normalize( fd[i] ), normalize( an[i] ) );
+        double a = acos( fmin( fmax( c, -1.0 ), 1.0 ) ) * 180 / 3.14159265358979;
+        fSum += a;
+        fMax = fmax( fMax, a );
+        if( a > 1 ) ++nOver1;
+    }
+    double fFDTime = std::chrono::duration<double, std::nano>( t1 - t0 ).count() / nSamples;
+    double fANTime = std::chrono::duration<double, std::nano>( t2 - t1 ).count() / nSamples;
+    printf( "%s normals, %u points: forward differences %.1f ns, dual gradient %.1f ns (%.2fx)\n", szTitle, nSamples,
+            fFDTime, fANTime, fFDTime / fANTime );
+    printf( "  angle between them: mean %.3g, max %.3g degrees, %u over 1 degree, %u degenerate; max DE difference %.3g\n\n",
+            nSamples > nDegenerate ? fSum / ( nSamples - nDegenerate ) : 0.0, fMax, nOver1, nDegenerate, fMaxValue );
+}
+
+// Every mandelbulb power through the dispatch table the renderer uses, packets against
+// the scalar trig kernel of the same power
+static void PrintPowerTable( unsigned int nSamples )
+{
+    std::vector<float> xyz[3];
+    RandomPoints( 1.5f, nSamples, xyz );
+    std::vector<float> ref( nSamples ), out( nSamples );
+
+    printf( "mandelbulb powers, %u points in [-1.5, 1.5]^3, ns/point and max abs error against scalar trig\n", nSamples );
+    printf( "%-6s %12s %12s %12s %12s %12s\n", "power", "scalar trig", "packet trig", "error", "packet trplx", "error" );
+    for( int nPower = MANDELBULB_MIN_POWER; nPower <= MANDELBULB_MAX_POWER; ++nPower )
+    {
+        const SIMD_ISA::MandelbulbKernel& trig = SIMD_ISA::GetMandelbulbKernel( DK_TRIG, nPower );
+        const SIMD_ISA::MandelbulbKernel& triplex = SIMD_ISA::GetMandelbulbKernel( DK_TRIPLEX, nPower );
+        const SIMD_ISA::vfloat n = ( float )MANDELBULB_ITERATIONS;
+        double fTime[3], fError[3] = { 0, 0, 0 };
+        fTime[0] = TimeBatch( ScalarBatch( [&trig]( const float3& p ) { return trig.pfnDE( p, MANDELBULB_ITERATIONS ); } ), xyz, &ref );
+        for( int k = 1; k < 3; ++k )
+        {
+            const SIMD_ISA::MandelbulbKernel& kernel = ( k == 1 ) ? trig : triplex;
+            fTime[k] = TimeBatch( SIMD_ISA::PacketBatch( [&kernel, n]( const SIMD_ISA::vfloat3& p ) { return kernel.pfnPacketDE( p, n ); } ),
+                                  xyz, &out );
+            for( unsigned int i = 0; i < nSamples; ++i )
+                fError[k] = fmax( fError[k], fabs( ( double )out[i] - ref[i] ) );
+        }
+        printf( "%-6d %12.1f %12.1f %12.3g %12.1f %12.3g\n", nPower, fTime[0], fTime[1], fError[1], fTime[2], fError[2] );
+    }
+    printf( "\n" );
+}
+
+void PrintDEStats( unsigned int nSamples )
+{
+    nSamples = ( nSamples + SIMD_WIDTH - 1 ) / SIMD_WIDTH * SIMD_WIDTH;
+    if( nSamples == 0 )
+        return;
+
+    const DE_KERNEL_ENTRY bulb[] =
+    {
+        { "scalar trig",    ScalarBatch( []( const float3& p ) { return MandelbulbDE( p ); } ) },
+        { "scalar triplex", ScalarBatch( []( const float3& p ) { return MandelbulbDETriplex( p ); } ) },
+        { "packet trig",    SIMD_ISA::PacketBatch( []( const SIMD_ISA::vfloat3& p ) { return SIMD_ISA::MandelbulbDE( p ); } ) },
+        { "packet triplex", SIMD_ISA::PacketBatch( []( const SIMD_ISA::vfloat3& p ) { return SIMD_ISA::MandelbulbDETriplex( p ); } ) },
+        { "fast trig",      SIMD_ISA::PacketBatch( []( const SIMD_ISA::vfloat3& p )
+                            { return SIMD_ISA::MandelbulbDE<MANDELBULB_DEFAULT_POWER, SIMD_ISA::VMathFast>( p, ( float )MANDELBULB_ITERATIONS ); } ) },
+        { "fast triplex",   SIMD_ISA::PacketBatch( []( const SIMD_ISA::vfloat3& p )
+                            { return SIMD_ISA::MandelbulbDETriplex<MANDELBULB_DEFAULT_POWER, SIMD_ISA::VMathFast>( p, ( float )MANDELBULB_ITERATIONS ); } ) },
+        { "EvaluateDE",     BatchedDE( MakeCpuFractal( FT_MANDELBULB ) ) },
+    };
+    PrintTable( "mandelbulb", 1.5f, bulb, sizeof( bulb ) / sizeof( bulb[0] ), nSamples );
+    PrintNormalTable( "mandelbulb trig", 1.5f, []( const float3& p ) { return MandelbulbDE( p ); },
+                      []( const float3& p, float3* pGrad ) { return MandelbulbDEGrad( p, pGrad ); }, nSamples );
+    PrintNormalTable( "mandelbulb triplex", 1.5f, []( const float3& p ) { return MandelbulbDETriplex( p ); },
+                      []( const float3& p, float3* pGrad ) { return MandelbulbDETriplexGrad( p, pGrad ); }, nSamples );
+    PrintPowerTable( nSamples );
+
+    const MandelboxParams params = MakeMandelboxParams();
+    const DE_KERNEL_ENTRY box[] =
+    {
+        { "scalar",         ScalarBatch( [params]( const float3& p ) { return MandelboxDE( p, params ); } ) },
+        { "packet",         SIMD_ISA::PacketBatch( [params]( const SIMD_ISA::vfloat3& p ) { return SIMD_ISA::MandelboxDE( p, params ); } ) },
+        { "EvaluateDE",     BatchedDE( MakeCpuFractal( FT_MANDELBOX ) ) },
+    };
+    PrintTable( "mandelbox", 3.0f, box, sizeof( box ) / sizeof( box[0] ), nSamples );
+    PrintNormalTable( "mandelbox", 3.0f, [params]( const float3& p ) { return MandelboxDE( p, params ); },
+                      [params]( const float3& p, float3* pGrad ) { return MandelboxDEGrad( p, params, pGrad ); }, nSamples );
+}
+
+//--------------------------------------------------------------------------------------
+// vmath.h against libm
+//--------------------------------------------------------------------------------------
+typedef std::function<void ( const float* pa, const float* pb, float* pOut, unsigned int n )> MATHBATCH;
+
+namespace SIMD_ISA
+{
+
+// n must be a multiple of SIMD_WIDTH; one-argument functions ignore pb
+template<class FN>
+static MATHBATCH MathBatch( FN f )
+{
+    return [f]( const float* pa, const float* pb, float* pOut, unsigned int n )
+    {
+        for( unsigned int i = 0; i < n; i += SIMD_WIDTH )
+            store( pOut + i, f( load( pa + i ), load( pb + i ) ) );
+    };
+}
+
+} // namespace SIMD_ISA
+
+// Distribution of the arguments between fMin and fMax
+enum ARG_DIST
+{
+    AD_UNIFORM,                     // uniform in [fMin, fMax]
+    AD_LOG,                         // 2^u with u uniform in [fMin, fMax]
+    AD_LOG_SIGNED,                  // the same with a random sign
+};
+
+struct MATH_ENTRY
+{
+    const char* szName;
+    const char* szDomain;
+    float fMin, fMax;
+    ARG_DIST eDist;
+    float fMinB, fMaxB;             // second argument of two-argument functions
+    ARG_DIST eDistB;
+    bool bAbsolute;                 // report the absolute error as well as the ULP
+    double ( *pfnReference )( double a, double b );
+    float ( *pfnLibm )( float a, float b );
+    MATHBATCH precise, fast;
+};
+
+static void RandomArguments( float fMin, float fMax, ARG_DIST eDist, unsigned int seed, std::vector<float>* pOut )
+{
+    for( size_t i = 0; i < pOut->size(); ++i )
+    {
+        seed = seed * 1664525u + 1013904223u;
+        float u = fMin + ( fMax - fMin ) * ( ( seed >> 8 ) / 16777216.0f );
+        if( eDist == AD_UNIFORM )
+        {
+            ( *pOut )[i] = u;
+            continue;
+        }
+        seed = seed * 1664525u + 1013904223u;
+        ( *pOut )[i] = ( eDist == AD_LOG_SIGNED && ( seed >> 31 ) ) ? -exp2f( u ) : exp2f( u );
+    }
+}
+
+// Size of one float ULP at the exact value r
+static double UlpOf( double r )
+{
+    int e;
+    frexp( fmax( fabs( r ), ( double )FLT_MIN ), &e );
+    return ldexp( 1.0, e - 24 );
+}
+
+// The functions are far faster than memory, so they are timed on the first nBlock
+// arguments, nRuns times per argument in the arrays; the fastest run counts
+static double TimeMathBatch( const MATHBATCH& batch, const std::vector<float>* ab, std::vector<float>* pOut )
+{
+    const unsigned int nBlock = 1024, nRuns = 4;
+    unsigned int nCount = ( unsigned int )pOut->size() < nBlock ? ( unsigned int )pOut->size() : nBlock;
+    unsigned int nBlocks = ( unsigned int )pOut->size() / nCount / nRuns + 1;
+    double fBest = 1e30;
+    for( unsigned int r = 0; r < nRuns; ++r )
+    {
+        std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+        for( unsigned int i = 0; i < nBlocks; ++i )
+            batch( &ab[0][0], &ab[1][0], &( *pOut )[0], nCount );
+        std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+        fBest = fmin( fBest, std::chrono::duration<double, std::nano>( t1 - t0 ).count() / ( ( double )nBlocks * nCount ) );
+    }
+    return fBest;
+}
+
+void PrintMathStats( unsigned int nSamples )
+{
+    using namespace SIMD_ISA;
+    nSamples = ( nSamples + SIMD_WIDTH - 1 ) / SIMD_WIDTH * SIMD_WIDTH;
+    if( nSamples == 0 )
+        return;
+
+    float ( *pfnLibm )( float a, float b ) = NULL;
+    const MATHBATCH LibmBatch = [&pfnLibm]( const float* pa, const float* pb, float* pOut, unsigned int n )
+    {
+        for( unsigned int i = 0; i < n; ++i )
+            pOut[i] = pfnLibm( pa[i], pb[i] );
+    };
+
+    const MATH_ENTRY functions[] =
+    {
+        { "atan2", "|y|, |x| in [2^-20, 2^20]", -20, 20, AD_LOG_SIGNED, -20, 20, AD_LOG_SIGNED, false,
+          []( double a, double b ) { return atan2( a, b ); }, []( float a, float b ) { return atan2f( a, b ); },
+          MathBatch( []( vfloat a, vfloat b ) { return vatan2( a, b ); } ),
+          MathBatch( []( vfloat a, vfloat b ) { return vatan2Fast( a, b ); } ) },
+        { "asin", "|x| in [2^-20, 1]", -20, 0, AD_LOG_SIGNED, 0, 0, AD_UNIFORM, false,
+          []( double a, double ) { return asin( a ); }, []( float a, float ) { return asinf( a ); },
+          MathBatch( []( vfloat a, vfloat ) { return vasin( a ); } ),
+          MathBatch( []( vfloat a, vfloat ) { return vasinFast( a ); } ) },
+        { "sin", "x in [-16 pi, 16 pi]", -50.26548f, 50.26548f, AD_UNIFORM, 0, 0, AD_UNIFORM, true,
+          []( double a, double ) { return sin( a ); }, []( float a, float ) { return sinf( a ); },
+          MathBatch( []( vfloat a, vfloat ) { vfloat s, c; vsincos( a, &s, &c ); return s; } ),
+          MathBatch( []( vfloat a, vfloat ) { vfloat s, c; vsincosFast( a, &s, &c ); return s; } ) },
+        { "cos", "x in [-16 pi, 16 pi]", -50.26548f, 50.26548f, AD_UNIFORM, 0, 0, AD_UNIFORM, true,
+          []( double a, double ) { return cos( a ); }, []( float a, float ) { return cosf( a ); },
+          MathBatch( []( vfloat a, vfloat ) { vfloat s, c; vsincos( a, &s, &c ); return c; } ),
+          MathBatch( []( vfloat a, vfloat ) { vfloat s, c; vsincosFast( a, &s, &c ); return c; } ) },
+        { "log", "x in [2^-126, 2^127]", -126, 127, AD_LOG, 0, 0, AD_UNIFORM, false,
+          []( double a, double ) { return log( a ); }, []( float a, float ) { return logf( a ); },
+          MathBatch( []( vfloat a, vfloat ) { return vlog( a ); } ),
+          MathBatch( []( vfloat a, vfloat ) { return vlogFast( a ); } ) },
+        { "exp", "x in [-87, 88]", -87, 88, AD_UNIFORM, 0, 0, AD_UNIFORM, false,
+          []( double a, double ) { return exp( a ); }, []( float a, float ) { return expf( a ); },
+          MathBatch( []( vfloat a, vfloat ) { return vexp( a ); } ),
+          MathBatch( []( vfloat a, vfloat ) { return vexpFast( a ); } ) },
+        { "pow", "x in [1/16, 4], y in [-16, 16]", -4, 2, AD_LOG, -16, 16, AD_UNIFORM, false,
+          []( double a, double b ) { return pow( a, b ); }, []( float a, float b ) { return powf( a, b ); },
+          MathBatch( []( vfloat a, vfloat b ) { return vpow( a, b ); } ),
+          MathBatch( []( vfloat a, vfloat b ) { return vpowFast( a, b ); } ) },
+    };
+
+    printf( "vmath.h against double precision libm, %u arguments per function, %d lanes\n", nSamples, SIMD_WIDTH );
+    printf( "%-6s %-32s %8s | %8s %9s %9s | %8s %9s %9s\n", "", "", "libm", "precise", "", "", "fast", "", "" );
+    printf( "%-6s %-32s %8s | %8s %9s %9s | %8s %9s %9s\n", "", "domain", "ns", "ns", "max ulp", "mean ulp", "ns", "max ulp", "mean ulp" );
+    for( size_t f = 0; f < sizeof( functions ) / sizeof( functions[0] ); ++f )
+    {
+        const MATH_ENTRY& e = functions[f];
+        std::vector<float> ab[2] = { std::vector<float>( nSamples ), std::vector<float>( nSamples ) };
+        RandomArguments( e.fMin, e.fMax, e.eDist, 12345, &ab[0] );
+        RandomArguments( e.fMinB, e.fMaxB, e.eDistB, 67890, &ab[1] );
+
+        std::vector<double> exact( nSamples );
+        std::vector<float> out( nSamples );
+        for( unsigned int i = 0; i < nSamples; ++i )
+            exact[i] = e.pfnReference( ab[0][i], ab[1][i] );
+
+        pfnLibm = e.pfnLibm;
+        printf( "%-6s %-32s %8.2f", e.szName, e.szDomain, TimeMathBatch( LibmBatch, ab, &out ) );
+
+        double fMaxAbs[2] = { 0, 0 };
+        for( int v = 0; v < 2; ++v )
+        {
+            const MATHBATCH& batch = ( v == 0 ) ? e.precise : e.fast;
+            double fTime = TimeMathBatch( batch, ab, &out );
+            batch( &ab[0][0], &ab[1][0], &out[0], nSamples );
+            double fMax = 0, fSum = 0;
+            for( unsigned int i = 0; i < nSamples; ++i )
+            {
+                double d = fabs( out[i] - exact[i] );
+                double ulp = d / UlpOf( exact[i] );
+                fMax = fmax( fMax, ulp );
+                fSum += ulp;
+                fMaxAbs[v] = fmax( fMaxAbs[v], d );
+            }
+            printf( " | %8.2f %9.3g %9.3g", fTime, fMax, fSum / nSamples );
+        }
+        printf( "\n" );
+        if( e.bAbsolute )
+            printf( "%-6s %-32s %8s   max absolute error: precise %.3g, fast %.3g\n", "", "", "", fMaxAbs[0], fMaxAbs[1] );
+    }
+    printf( "\n" );
+}
@@ -0,0 +1,19 @@
+//--------------------------------------------------------------------------------------
+// File: destats.h
+//
+// Accuracy and throughput of the CPU distance estimator kernels against the scalar
+// reference (the float port of the shader DE), and of the vmath.h functions they are
+// built from against libm.
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef DESTATS_H
+#define DESTATS_H
+
+// Evaluates every kernel on nSamples random points and prints one line per kernel
+void PrintDEStats( unsigned int nSamples );
+
+// Compares the precise and fast vmath.h functions with double precision libm on nSamples
+// random arguments per function and prints their maximum and mean ULP error and speed
+void PrintMathStats( unsigned int nSamples );
+
+#endif // DESTATS_H
@@ -0,0 +1,492 @@
+//--------------------------------------------------------------------------------------
+// File: distcache.cpp
+//
+// Sparse brick map of the distance estimator, see distcache.h.
+//--------------------------------------------------------------------------------------
+#include "distcache.h"
+#include <algorithm>
+#include <string.h>
+
+static const unsigned int BRICK_VOLUME = DISTCACHE_BRICK * DISTCACHE_BRICK * DISTCACHE_BRICK;
+
+// Bricks per EvaluateDE batch while building
+static const unsigned int BRICK_BATCH = 256;
+
+// Longest march on the bounds
+static const unsigned int MAX_MARCH_STEPS = 256;
+
+// How far ahead of a march its next brick is prefetched, in cells
+static const float PREFETCH_CELLS = 2;
+
+CDistanceCache::CDistanceCache()
+{
+    m_Fractal = MakeCpuFractal();
+    m_Symmetry = GetFractalSymmetry( m_Fractal );
+    Clear();
+}
+
+void CDistanceCache::Clear()
+{
+    m_pPager.reset();
+    m_fExtent = 0;
+    m_vMin = float3( 0.0f );
+    m_fCell = m_fInvCell = m_fSample = m_fNear = 0;
+    m_nCells = 0;
+    m_nGridLo[0] = m_nGridLo[1] = m_nGridLo[2] = 0;
+    m_nGridSize[0] = m_nGridSize[1] = m_nGridSize[2] = 0;
+    m_vGridLo = m_vGridHi = float3( 0.0f );
+    m_nBricks = 0;
+    m_nDomainCells = 0;
+    m_nBuildSamples = 0;
+    m_CellDE.clear();
+    m_BrickIndex.clear();
+    m_Bricks.clear();
+}
+
+void CDistanceCache::SetGeometry( const CpuFractal& fractal, float fExtent, unsigned int nCells, bool bSymmetry )
+{
+    m_Fractal = fractal;
+    m_Symmetry = GetFractalSymmetry( fractal );
+    if( !bSymmetry )
+    {
+        m_Symmetry.bMirror[0] = m_Symmetry.bMirror[1] = m_Symmetry.bMirror[2] = false;
+        m_Symmetry.bPermute = false;
+        SetSymmetryRotations( &m_Symmetry, 1 );
+    }
+    m_nCells = nCells;
+    m_fExtent = fExtent;
+    m_vMin = float3( -fExtent );
+    m_fCell = 2 * fExtent / nCells;
+    m_fInvCell = 1 / m_fCell;
+    m_fSample = m_fCell / ( DISTCACHE_BRICK - 1 );
+    m_fNear = m_fSample;
+}
+
+// Interleaves the bits of x, y and z, so that bricks close in space are close in the
+// brick array too, and a paged chunk of them covers a compact block of cells
+static unsigned long long MortonCode( unsigned int x, unsigned int y, unsigned int z )
+{
+    unsigned long long n = 0;
+    for( int i = 0; i < 21; ++i )
+        n |= ( ( unsigned long long )( ( x >> i ) & 1 ) << ( 3 * i ) ) |
+             ( ( unsigned long long )( ( y >> i ) & 1 ) << ( 3 * i + 1 ) ) |
+             ( ( unsigned long long )( ( z >> i ) & 1 ) << ( 3 * i + 2 ) );
+    return n;
+}
+
+bool CDistanceCache::BuildGrid( std::vector<unsigned int>* pBrickCells )
+{
+    const unsigned int nCells = m_nCells;
+
+    // DE at the centers of the cells that reach into the fundamental domain; no lookup
+    // lands in the others. The grid is stored for their bounding box only, and a lookup
+    // a rounding error outside the domain finds a bound of 0.
+    const float fHalfDiagonal = 0.5f * sqrtf( 3.0f ) * m_fCell;
+    std::vector<unsigned int> cells;
+    std::vector<float3> points;
+    unsigned int nLo[3] = { nCells, nCells, nCells }, nHi[3] = { 0, 0, 0 };
+    for( unsigned int z = 0; z < nCells; ++z )
+        for( unsigned int y = 0; y < nCells; ++y )
+            for( unsigned int x = 0; x < nCells; ++x )
+            {
+                const float3 c = m_vMin + ( float3( ( float )x, ( float )y, ( float )z ) + float3( 0.5f ) ) * m_fCell;
+                if( FundamentalDomainDistance( m_Symmetry, c ) > fHalfDiagonal )
+                    continue;
+                const unsigned int xyz[3] = { x, y, z };
+                for( int a = 0; a < 3; ++a )
+                {
+                    nLo[a] = ( xyz[a] < nLo[a] ) ? xyz[a] : nLo[a];
+                    nHi[a] = ( xyz[a] > nHi[a] ) ? xyz[a] : nHi[a];
+                }
+                cells.insert( cells.end(), xyz, xyz + 3 );
+                points.push_back( c );
+            }
+    m_nDomainCells = points.size();
+    if( m_nDomainCells == 0 )
+        return false;
+    for( int a = 0; a < 3; ++a )
+    {
+        m_nGridLo[a] = nLo[a];
+        m_nGridSize[a] = nHi[a] - nLo[a] + 1;
+    }
+    m_vGridLo = float3( ( float )nLo[0], ( float )nLo[1], ( float )nLo[2] );
+    m_vGridHi = float3( ( float )( nHi[0] + 1 ), ( float )( nHi[1] + 1 ), ( float )( nHi[2] + 1 ) ) * ( 1 - 1e-6f );
+    std::vector<float> de( m_nDomainCells );
+    EvaluateDE( m_Fractal, &points[0], m_nDomainCells, &de[0] );
+
+    // Bricks for the cells the surface may cross or pass within a cell of. Cells with
+    // the center deeper inside than half the diagonal are inside the fractal as a whole.
+    const size_t nGridCells = ( size_t )m_nGridSize[0] * m_nGridSize[1] * m_nGridSize[2];
+    std::vector<std::pair<unsigned long long, size_t> > brickCells;
+    m_CellDE.assign( nGridCells, 0.0f );
+    m_BrickIndex.assign( nGridCells, -1 );
+    for( size_t i = 0; i < m_nDomainCells; ++i )
+    {
+        const unsigned int* xyz = &cells[3 * i];
+        m_CellDE[GridIndex( xyz[0], xyz[1], xyz[2] )] = de[i];
+        if( de[i] > -fHalfDiagonal && de[i] < fHalfDiagonal + m_fCell )
+            brickCells.push_back( std::make_pair( MortonCode( xyz[0], xyz[1], xyz[2] ), i ) );
+    }
+    std::sort( brickCells.begin(), brickCells.end() );
+    m_nBricks = ( unsigned int )brickCells.size();
+    pBrickCells->resize( 3 * brickCells.size() );
+    for( unsigned int b = 0; b < m_nBricks; ++b )
+    {
+        const unsigned int* xyz = &cells[3 * brickCells[b].second];
+        m_BrickIndex[GridIndex( xyz[0], xyz[1], xyz[2] )] = ( int )b;
+        std::copy( xyz, xyz + 3, &( *pBrickCells )[3 * b] );
+    }
+    m_nBuildSamples = m_nDomainCells + ( size_t )m_nBricks * BRICK_VOLUME;
+    return true;
+}
+
+void CDistanceCache::SampleBricks( const unsigned int* pBrickCells, unsigned int n, std::vector<float3>* pPoints,
+                                   float* pSamples ) const
+{
+    pPoints->resize( ( size_t )n * BRICK_VOLUME );
+    float3* p = &( *pPoints )[0];
+    for( unsigned int b = 0; b < n; ++b )
+    {
+        const unsigned int* xyz = &pBrickCells[3 * b];
+        const float3 vCorner = m_vMin + float3( ( float )xyz[0], ( float )xyz[1], ( float )xyz[2] ) * m_fCell;
+        for( unsigned int z = 0; z < DISTCACHE_BRICK; ++z )
+            for( unsigned int y = 0; y < DISTCACHE_BRICK; ++y )
+                for( unsigned int x = 0; x < DISTCACHE_BRICK; ++x )
+                    *p++ = vCorner + float3( ( float )x, ( float )y, ( float )z ) * m_fSample;
+    }
+    EvaluateDE( m_Fractal, &( *pPoints )[0], ( size_t )n * BRICK_VOLUME, pSamples );
+}
+
+void CDistanceCache::Build( const CpuFractal& fractal, float fExtent, unsigned int nCells, bool bSymmetry )
+{
+    Clear();
+    if( nCells == 0 )
+        return;
+    SetGeometry( fractal, fExtent, nCells, bSymmetry );
+    std::vector<unsigned int> brickCells;
+    if( !BuildGrid( &brickCells ) )
+    {
+        Clear();
+        return;
+    }
+
+    // Sampled BRICK_BATCH bricks at a time, so the points never take more memory than a
+    // small part of the bricks
+    m_Bricks.resize( ( size_t )m_nBricks * BRICK_VOLUME );
+    std::vector<float3> points;
+    for( unsigned int b0 = 0; b0 < m_nBricks; b0 += BRICK_BATCH )
+    {
+        const unsigned int n = ( m_nBricks - b0 < BRICK_BATCH ) ? m_nBricks - b0 : BRICK_BATCH;
+        SampleBricks( &brickCells[3 * b0], n, &points, &m_Bricks[( size_t )b0 * BRICK_VOLUME] );
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Cache files: the header, the grid (m_CellDE, then m_BrickIndex), zeros up to the next
+// multiple of BRICKPAGER_ALIGNMENT, then the bricks. In the byte order of the machine
+// that wrote it.
+//--------------------------------------------------------------------------------------
+static const unsigned int CACHEFILE_MAGIC = 0x43445246; // "FRDC"
+static const unsigned int CACHEFILE_VERSION = 2;
+
+struct CacheFileHeader
+{
+    unsigned int nMagic;
+    unsigned int nVersion;
+    unsigned int nBrick;            // DISTCACHE_BRICK
+    CpuFractal Fractal;
+    FractalSymmetry Symmetry;
+    float fExtent;
+    unsigned int nCells;
+    unsigned int nGridLo[3];
+    unsigned int nGridSize[3];
+    unsigned int nBricks;
+    unsigned long long nDomainCells;
+    unsigned long long nBrickOffset;
+};
+
+bool CDistanceCache::BuildFile( const wchar_t* szFile, const CpuFractal& fractal, float fExtent, unsigned int nCells,
+                                bool bSymmetry )
+{
+    Clear();
+    if( nCells == 0 )
+        return false;
+    SetGeometry( fractal, fExtent, nCells, bSymmetry );
+    std::vector<unsigned int> brickCells;
+    FILE* pFile = NULL;
+    bool bOK = BuildGrid( &brickCells ) && ( pFile = OpenFileW( szFile, L"wb" ) ) != NULL;
+    if( bOK )
+    {
+        const size_t nGridCells = m_CellDE.size();
+        const unsigned long long nGridEnd = sizeof( CacheFileHeader ) + nGridCells * ( sizeof( float ) + sizeof( int ) );
+        CacheFileHeader header;
+        memset( ( void* )&header, 0, sizeof( header ) );   // padding too, it goes to the file
+        header.nMagic = CACHEFILE_MAGIC;
+        header.nVersion = CACHEFILE_VERSION;
+        header.nBrick = DISTCACHE_BRICK;
+        header.Fractal = m_Fractal;
+        header.Symmetry = m_Symmetry;
+        header.fExtent = m_fExtent;
+        header.nCells = m_nCells;
+        for( int a = 0; a < 3; ++a )
+        {
+            header.nGridLo[a] = m_nGridLo[a];
+            header.nGridSize[a] = m_nGridSize[a];
+        }
+        header.nBricks = m_nBricks;
+        header.nDomainCells = m_nDomainCells;
+        header.nBrickOffset = ( nGridEnd + BRICKPAGER_ALIGNMENT - 1 ) / BRICKPAGER_ALIGNMENT * BRICKPAGER_ALIGNMENT;
+        bOK = fwrite( &header, sizeof( header ), 1, pFile ) == 1 &&
+              fwrite( &m_CellDE[0], sizeof( float ), nGridCells, pFile ) == nGridCells &&
+              fwrite( &m_BrickIndex[0], sizeof( int ), nGridCells, pFile ) == nGridCells;
+        const std::vector<char> padding( ( size_t )( header.nBrickOffset - nGridEnd ), 0 );
+        if( bOK && !padding.empty() )
+            bOK = fwrite( &padding[0], padding.size(), 1, pFile ) == 1;
+
+        std::vector<float3> points;
+        std::vector<float> samples( ( size_t )BRICK_BATCH * BRICK_VOLUME );
+        for( unsigned int b0 = 0; b0 < m_nBricks && bOK; b0 += BRICK_BATCH )
+        {
+            const unsigned int n = ( m_nBricks - b0 < BRICK_BATCH ) ? m_nBricks - b0 : BRICK_BATCH;
+            SampleBricks( &brickCells[3 * b0], n, &points, &samples[0] );
+            bOK = fwrite( &samples[0], sizeof( float ) * BRICK_VOLUME, n, pFile ) == n;
+        }
+        bOK = ( fclose( pFile ) == 0 ) && bOK;
+    }
+
+    const size_t nBuildSamples = m_nBuildSamples;
+    Clear();
+    m_nBuildSamples = nBuildSamples;
+    return bOK;
+}
+
+bool CDistanceCache::Open( const wchar_t* szFile, size_t nBudget, unsigned int nPrefetchThreads )
+{
+    Clear();
+    FILE* pFile = OpenFileW( szFile, L"rb" );
+    if( !pFile )
+        return false;
+
+    CacheFileHeader header;
+    bool bOK = fread( &header, sizeof( header ), 1, pFile ) == 1 && header.nMagic == CACHEFILE_MAGIC &&
+               header.nVersion == CACHEFILE_VERSION && header.nBrick == DISTCACHE_BRICK && header.nCells > 0;
+    if( bOK )
+    {
+        SetGeometry( header.Fractal, header.fExtent, header.nCells, true );
+        // The sector table is rebuilt rather than trusted from the file
+        m_Symmetry = header.Symmetry;
+        bOK = SetSymmetryRotations( &m_Symmetry, header.Symmetry.nRotations );
+        for( int a = 0; a < 3; ++a )
+        {
+            m_nGridLo[a] = header.nGridLo[a];
+            m_nGridSize[a] = header.nGridSize[a];
+        }
+        m_vGridLo = float3( ( float )m_nGridLo[0], ( float )m_nGridLo[1], ( float )m_nGridLo[2] );
+        m_vGridHi = ( m_vGridLo + float3( ( float )m_nGridSize[0], ( float )m_nGridSize[1], ( float )m_nGridSize[2] ) ) *
+                    ( 1 - 1e-6f );
+        m_nBricks = header.nBricks;
+        m_nDomainCells = ( size_t )header.nDomainCells;
+
+        const size_t nGridCells = ( size_t )m_nGridSize[0] * m_nGridSize[1] * m_nGridSize[2];
+        m_CellDE.resize( nGridCells );
+        m_BrickIndex.resize( nGridCells );
+        bOK = nGridCells > 0 && fread( &m_CellDE[0], sizeof( float ), nGridCells, pFile ) == nGridCells &&
+              fread( &m_BrickIndex[0], sizeof( int ), nGridCells, pFile ) == nGridCells;
+    }
+    fclose( pFile );
+
+    if( bOK && m_nBricks > 0 )
+    {
+        m_pPager.reset( new CBrickPager );
+        bOK = m_pPager->Open( szFile, header.nBrickOffset, sizeof( float ) * BRICK_VOLUME, m_nBricks, nBudget,
+                              nPrefetchThreads );
+    }
+    if( !bOK )
+        Clear();
+    return bOK;
+}
+
+float CDistanceCache::Bound( const float3& p ) const
+{
+    const float3 q = ( ToFundamentalDomain( m_Symmetry, p ) - m_vMin ) * m_fInvCell;
+    const float n = ( float )m_nCells;
+    if( !( q.x >= 0 && q.x < n && q.y >= 0 && q.y < n && q.z >= 0 && q.z < n ) )
+        return 0;
+    BrickLock lock = { -1, NULL };
+    const float b = CellBound( clamp( q, m_vGridLo, m_vGridHi ), &lock );
+    Release( &lock );
+    return b;
+}
+
+float CDistanceCache::March( const Ray& ray, float t, unsigned int* pnSteps ) const
+{
+    if( m_nCells == 0 )
+        return t;
+
+    float tNear, tFar;
+    if( !ClipRay( ray, &tNear, &tFar ) || tFar <= t )
+        return t;
+
+    // The cube is symmetric too, so the image of a point in it is in the domain's part of
+    // the grid. Points a rounding error outside it are moved onto its faces.
+    // With paged bricks, entering a brick has the one PREFETCH_CELLS further along the
+    // ray mapped in the background, while the march goes on through this one.
+    unsigned int nSteps = 0;
+    BrickLock lock = { -1, NULL };
+    for( t = fmaxf( t, tNear ); t < tFar && nSteps < MAX_MARCH_STEPS; ++nSteps )
+    {
+        const float3 p = ToFundamentalDomain( m_Symmetry, ray.pos + t * ray.dir );
+        const float3 q = clamp( ( p - m_vMin ) * m_fInvCell, m_vGridLo, m_vGridHi );
+        const int nLocked = lock.nBrick;
+        float b = CellBound( q, &lock );
+        if( m_pPager && lock.nBrick != nLocked && lock.nBrick >= 0 )
+        {
+            const float3 pAhead = ToFundamentalDomain( m_Symmetry, ray.pos + ( t + PREFETCH_CELLS * m_fCell ) * ray.dir );
+            const float3 qAhead = clamp( ( pAhead - m_vMin ) * m_fInvCell, m_vGridLo, m_vGridHi );
+            const int nAhead = m_BrickIndex[GridIndex( ( unsigned int )qAhead.x, ( unsigned int )qAhead.y,
+                                                       ( unsigned int )qAhead.z )];
+            if( nAhead >= 0 )
+                m_pPager->Prefetch( ( unsigned int )nAhead );
+        }
+        if( b <= 0 )
+            break;
+        t += b;
+    }
+    Release( &lock );
+    *pnSteps += nSteps;
+    return t;
+}
+
+void CDistanceCache::PrefetchRay( const Ray& ray, float t, unsigned int nBricks ) const
+{
+    float tNear, tFar;
+    if( !m_pPager || !ClipRay( ray, &tNear, &tFar ) || tFar <= t )
+        return;
+
+    // The bound of a cell without a brick holds in the whole cell; in one with a brick the
+    // march slows down to half a cell, as the real one would be near the surface there
+    int nLast = -1;
+    for( t = fmaxf( t, tNear ); t < tFar && nBricks > 0; )
+    {
+        const float3 p = ToFundamentalDomain( m_Symmetry, ray.pos + t * ray.dir );
+        const float3 q = clamp( ( p - m_vMin ) * m_fInvCell, m_vGridLo, m_vGridHi );
+        const unsigned int x = ( unsigned int )q.x, y = ( unsigned int )q.y, z = ( unsigned int )q.z;
+        const size_t nCell = GridIndex( x, y, z );
+        const int nBrick = m_BrickIndex[nCell];
+        float b = 0.5f * m_fCell;
+        if( nBrick >= 0 )
+        {
+            if( nBrick != nLast )
+            {
+                m_pPager->Prefetch( ( unsigned int )nBrick );
+                nLast = nBrick;
+                --nBricks;
+            }
+        }
+        else
+        {
+            if( m_CellDE[nCell] <= 0 )
+                break;              // inside the fractal
+            const float3 c = float3( ( float )x, ( float )y, ( float )z ) + float3( 0.5f );
+            b = fmaxf( b, m_CellDE[nCell] - length( q - c ) * m_fCell );
+        }
+        t += b;
+    }
+}
+
+bool CDistanceCache::ClipRay( const Ray& ray, float* ptNear, float* ptFar ) const
+{
+    const float o[3] = { ray.pos.x, ray.pos.y, ray.pos.z };
+    const float d[3] = { ray.dir.x, ray.dir.y, ray.dir.z };
+    float tNear = -1e30f, tFar = 1e30f;
+    for( int a = 0; a < 3; ++a )
+    {
+        if( d[a] == 0 )
+        {
+            if( fabsf( o[a] ) > m_fExtent )
+                return false;
+            continue;
+        }
+        float t0 = ( -m_fExtent - o[a] ) / d[a], t1 = ( m_fExtent - o[a] ) / d[a];
+        tNear = fmaxf( tNear, fminf( t0, t1 ) );
+        tFar = fminf( tFar, fmaxf( t0, t1 ) );
+    }
+    *ptNear = tNear;
+    *ptFar = tFar;
+    return tNear <= tFar;
+}
+
+void CDistanceCache::Release( BrickLock* pLock ) const
+{
+    if( m_pPager && pLock->nBrick >= 0 )
+        m_pPager->Unlock( ( unsigned int )pLock->nBrick );
+    pLock->nBrick = -1;
+    pLock->pSamples = NULL;
+}
+
+float CDistanceCache::CellBound( const float3& q, BrickLock* pLock ) const
+{
+    const unsigned int x = ( unsigned int )q.x, y = ( unsigned int )q.y, z = ( unsigned int )q.z;
+    const size_t nCell = GridIndex( x, y, z );
+    const int nBrick = m_BrickIndex[nCell];
+
+    float d;
+    if( nBrick < 0 )
+    {
+        const float3 c = float3( ( float )x, ( float )y, ( float )z ) + float3( 0.5f );
+        d = m_CellDE[nCell] - length( q - c ) * m_fCell;
+    }
+    else
+    {
+        // Position in the brick in samples; the last sample is on the far face of the cell
+        const unsigned int B = DISTCACHE_BRICK, nLast = DISTCACHE_BRICK - 2;
+        float fx = ( q.x - x ) * ( B - 1 ), fy = ( q.y - y ) * ( B - 1 ), fz = ( q.z - z ) * ( B - 1 );
+        unsigned int ix = ( unsigned int )fx, iy = ( unsigned int )fy, iz = ( unsigned int )fz;
+        ix = ( ix < nLast ) ? ix : nLast;
+        iy = ( iy < nLast ) ? iy : nLast;
+        iz = ( iz < nLast ) ? iz : nLast;
+        fx -= ix;
+        fy -= iy;
+        fz -= iz;
+        if( pLock->nBrick != nBrick )
+        {
+            Release( pLock );
+            pLock->pSamples = m_pPager ? ( const float* )m_pPager->Lock( ( unsigned int )nBrick )
+                                       : &m_Bricks[( size_t )nBrick * BRICK_VOLUME];
+            if( !pLock->pSamples )
+                return 0;
+            pLock->nBrick = nBrick;
+        }
+        const float* s = pLock->pSamples + ( iz * B + iy ) * B + ix;
+        const float s00 = lerp( s[0], s[1], fx ), s10 = lerp( s[B], s[B + 1], fx );
+        const float s01 = lerp( s[B * B], s[B * B + 1], fx ), s11 = lerp( s[B * B + B], s[B * B + B + 1], fx );
+        d = lerp( lerp( s00, s10, fy ), lerp( s01, s11, fy ), fz );
+
+        // Every sample exceeds DE(p) by at most its distance from p. The trilinear weights
+        // of those distances sum to at most the root of the weighted squares (Jensen),
+        // which is m_fSample * sqrt( sum t (1 - t) ) over the axes: 0 on a sample, 0.87
+        // m_fSample half way between 8 of them.
+        d -= m_fSample * sqrtf( fx * ( 1 - fx ) + fy * ( 1 - fy ) + fz * ( 1 - fz ) );
+    }
+    return ( d > m_fNear ) ? d : 0;
+}
+
+size_t CDistanceCache::GetMemorySize() const
+{
+    return m_CellDE.size() * sizeof( float ) + m_BrickIndex.size() * sizeof( int ) + m_Bricks.size() * sizeof( float );
+}
+
+BrickPagerStats CDistanceCache::GetPagerStats() const
+{
+    if( m_pPager )
+        return m_pPager->GetStats();
+    BrickPagerStats stats;
+    memset( &stats, 0, sizeof( stats ) );
+    return stats;
+}
+
+float GetDistanceCacheExtent( const CpuFractal& fractal )
+{
+    // 10% more than the outermost surface, for the cells to be sampled around it
+    return 1.1f * GetFractalRadius( fractal );
+}
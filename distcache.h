@@ -0,0 +1,142 @@
+//--------------------------------------------------------------------------------------
+// File: distcache.h
+//
+// Sparse brick map of the distance estimator, so that marching through empty space
+// costs a few memory reads per step instead of a DE evaluation.
+//
+// A cube around the fractal is split into a coarse grid of cells. Every cell holds the
+// DE at its center, which bounds the distance anywhere in the cell from below (the DE
+// grows by at most 1 per unit of distance, the assumption sphere tracing makes anyway).
+// Only the cells the surface may pass through or come close to get a brick of
+// DISTCACHE_BRICK^3 DE samples, interpolated trilinearly. Near the surface and inside
+// the fractal the cache gives up and the marcher goes on with the exact DE.
+//
+// Only the cells of the fundamental domain of the fractal's symmetries (cpude.h) are
+// sampled; lookups map the point into it first. That takes the memory and build time
+// of the bricks down by the order of the symmetry group, 28 for the power 8 mandelbulb
+// and 48 for the default mandelbox, or buys that much finer cells for the same budget.
+//
+// For grids whose bricks outgrow memory, BuildFile streams them to disk and Open pages
+// them back in through a CBrickPager: only the coarse grid stays in memory, and the
+// bricks take at most the budget given, least recently used ones unmapped first.
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef DISTCACHE_H
+#define DISTCACHE_H
+
+#include "brickpager.h"
+#include "cpude.h"
+#include <memory>
+#include <vector>
+
+// Samples along each edge of a brick; neighbouring bricks share the samples on their
+// common face
+static const unsigned int DISTCACHE_BRICK = 8;
+
+class CDistanceCache
+{
+public:
+    CDistanceCache();
+
+    // Samples the DE of fractal in the cube of half size fExtent around the origin, split
+    // into nCells^3 cells. The cube must contain the fractal: March takes the space
+    // outside it to be empty. GetDistanceCacheExtent gives one that does. bSymmetry false
+    // samples the whole cube.
+    void Build( const CpuFractal& fractal, float fExtent, unsigned int nCells, bool bSymmetry = true );
+    void Clear();
+
+    // Build, but writes the cache to szFile instead of keeping it, sampling the bricks a
+    // batch at a time so that they never have to fit in memory. Leaves the cache empty.
+    bool BuildFile( const wchar_t* szFile, const CpuFractal& fractal, float fExtent, unsigned int nCells,
+                    bool bSymmetry = true );
+    // Loads the grid of a file from BuildFile and maps its bricks on demand, keeping at
+    // most nBudget bytes of them mapped. nPrefetchThreads map the bricks March will
+    // need next in the background.
+    bool Open( const wchar_t* szFile, size_t nBudget, unsigned int nPrefetchThreads = 1 );
+
+    bool IsEmpty() const { return m_nCells == 0; }
+    bool IsPaged() const { return m_pPager.get() != NULL; }
+    // The fractal of the last Build
+    const CpuFractal& GetFractal() const { return m_Fractal; }
+    // The symmetries the cache maps lookups with
+    const FractalSymmetry& GetSymmetry() const { return m_Symmetry; }
+
+    // Lower bound on DE(p), or 0 where the cache can't give one worth stepping by: near
+    // the surface, inside the fractal, outside the cube
+    float Bound( const float3& p ) const;
+
+    // Sphere traces ray from t on the bounds alone. Returns the distance up to which the
+    // ray is empty: where the cache first gives up, or where the ray leaves the cube (t
+    // itself if it misses the cube). Adds the steps taken to *pnSteps.
+    float March( const Ray& ray, float t, unsigned int* pnSteps ) const;
+
+    // Has the pager map the first nBricks bricks a march of ray from t would lock, in the
+    // background. Walks the coarse grid only and never waits. Nothing unless Open.
+    void PrefetchRay( const Ray& ray, float t, unsigned int nBricks ) const;
+
+    // The bound below which Bound and March give up, one sample spacing: closer to the
+    // surface than about twice this a march gains nothing from the cache
+    float GetNearBound() const { return m_fNear; }
+    // Cells per axis, and how many of them reach into the fundamental domain
+    unsigned int GetCellCount() const { return m_nCells; }
+    size_t GetDomainCellCount() const { return m_nDomainCells; }
+    unsigned int GetBrickCount() const { return m_nBricks; }
+    // Bytes held in memory, not counting paged bricks
+    size_t GetMemorySize() const;
+    // Statistics of the paged bricks, all 0 unless Open
+    BrickPagerStats GetPagerStats() const;
+    // DE evaluations of the last Build
+    size_t GetBuildSamples() const { return m_nBuildSamples; }
+
+private:
+    // The brick a march has locked in the pager, so consecutive steps in one brick
+    // don't lock it again
+    struct BrickLock
+    {
+        int nBrick;
+        const float* pSamples;
+    };
+
+    // Where ray enters and leaves the cube; false if it misses it
+    bool ClipRay( const Ray& ray, float* ptNear, float* ptFar ) const;
+    void SetGeometry( const CpuFractal& fractal, float fExtent, unsigned int nCells, bool bSymmetry );
+    // The grid of Build; the cells that get bricks, as x, y, z triples in brick order
+    bool BuildGrid( std::vector<unsigned int>* pBrickCells );
+    // Samples n bricks of the cells at pBrickCells into pSamples
+    void SampleBricks( const unsigned int* pBrickCells, unsigned int n, std::vector<float3>* pPoints,
+                       float* pSamples ) const;
+    // Bound at q, in cells from m_vMin and inside the stored grid
+    float CellBound( const float3& q, BrickLock* pLock ) const;
+    void Release( BrickLock* pLock ) const;
+    size_t GridIndex( unsigned int x, unsigned int y, unsigned int z ) const
+    {
+        return ( ( size_t )( z - m_nGridLo[2] ) * m_nGridSize[1] + y - m_nGridLo[1] ) * m_nGridSize[0] + x - m_nGridLo[0];
+    }
+
+    CpuFractal m_Fractal;
+    FractalSymmetry m_Symmetry;
+    float m_fExtent;
+    float3 m_vMin;                  // corner of the cube
+    float m_fCell;                  // cell size
+    float m_fInvCell;
+    float m_fSample;                // distance between the samples of a brick
+    float m_fNear;                  // bound below which the cache gives up
+    unsigned int m_nCells;          // per axis
+    unsigned int m_nGridLo[3];      // first cell of the stored grid per axis
+    unsigned int m_nGridSize[3];    // its cells per axis
+    float3 m_vGridLo, m_vGridHi;    // its bounds in cells, the upper one rounded in
+    unsigned int m_nBricks;
+    size_t m_nDomainCells;
+    size_t m_nBuildSamples;
+
+    // Over the stored grid, x fastest
+    std::vector<float> m_CellDE;    // DE at the center of every cell, 0 outside the domain
+    std::vector<int> m_BrickIndex;  // brick of every cell, -1 if it has none
+    std::vector<float> m_Bricks;    // DISTCACHE_BRICK^3 samples per brick, x fastest
+    std::unique_ptr<CBrickPager> m_pPager;  // the bricks instead, if Open
+};
+
+// Half size of a cube around the origin that contains the fractal
+float GetDistanceCacheExtent( const CpuFractal& fractal );
+
+#endif // DISTCACHE_H
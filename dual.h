@@ -0,0 +1,108 @@
+//--------------------------------------------------------------------------------------
+// File: dual.h
+//
+// Forward-mode automatic differentiation for the CPU distance estimators.
+//
+// A dual holds a value together with its gradient with respect to the point the DE is
+// evaluated at. Seeding the coordinates of that point with the unit vectors and running
+// the ordinary DE code on duals gives DE(p) and grad DE(p) in one pass, with the
+// derivative of every operation taken analytically instead of from the difference of
+// two nearly equal float DE values.
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef DUAL_H
+#define DUAL_H
+
+#include "cpumath.h"
+
+// Every dual operation is a handful of multiply-adds on a value and a float3, less than
+// the cost of a call, and the DE templates (fracde.h) chain hundreds of them; left to the
+// compiler's inlining budget the dual instantiations end up several times slower than the
+// four float DEs of forward differences, so they are always inlined
+#ifdef _MSC_VER
+#define DUAL_INLINE __forceinline
+#else
+#define DUAL_INLINE inline __attribute__( ( always_inline ) )
+#endif
+
+struct dual
+{
+    float v;                    // value
+    float3 g;                   // gradient d v / d p
+
+    DUAL_INLINE dual() {}
+    DUAL_INLINE dual( float _v ) : v( _v ), g( 0, 0, 0 ) {}
+    DUAL_INLINE dual( float _v, const float3& _g ) : v( _v ), g( _g ) {}
+};
+
+DUAL_INLINE dual operator + ( const dual& a, const dual& b ) { return dual( a.v + b.v, a.g + b.g ); }
+DUAL_INLINE dual operator - ( const dual& a, const dual& b ) { return dual( a.v - b.v, a.g - b.g ); }
+DUAL_INLINE dual operator - ( const dual& a ) { return dual( -a.v, -a.g ); }
+DUAL_INLINE dual operator * ( const dual& a, const dual& b ) { return dual( a.v * b.v, a.g * b.v + b.g * a.v ); }
+DUAL_INLINE dual operator * ( const dual& a, float s ) { return dual( a.v * s, a.g * s ); }
+DUAL_INLINE dual operator * ( float s, const dual& a ) { return dual( a.v * s, a.g * s ); }
+DUAL_INLINE dual operator / ( const dual& a, const dual& b )
+{
+    float inv = 1.0f / b.v;
+    return dual( a.v * inv, ( a.g - b.g * ( a.v * inv ) ) * inv );
+}
+DUAL_INLINE dual operator / ( const dual& a, float s ) { return a * ( 1.0f / s ); }
+DUAL_INLINE dual operator / ( float s, const dual& b )
+{
+    float inv = 1.0f / b.v;
+    return dual( s * inv, b.g * ( -s * inv * inv ) );
+}
+DUAL_INLINE dual operator + ( const dual& a, float s ) { return dual( a.v + s, a.g ); }
+DUAL_INLINE dual operator + ( float s, const dual& a ) { return dual( a.v + s, a.g ); }
+DUAL_INLINE dual operator - ( const dual& a, float s ) { return dual( a.v - s, a.g ); }
+DUAL_INLINE dual operator - ( float s, const dual& a ) { return dual( s - a.v, -a.g ); }
+
+DUAL_INLINE dual sqrt( const dual& a )
+{
+    float s = sqrtf( a.v );
+    return dual( s, a.g * ( 0.5f / s ) );
+}
+DUAL_INLINE dual log( const dual& a ) { return dual( logf( a.v ), a.g / a.v ); }
+DUAL_INLINE dual sin( const dual& a ) { return dual( sinf( a.v ), a.g * cosf( a.v ) ); }
+DUAL_INLINE dual cos( const dual& a ) { return dual( cosf( a.v ), a.g * -sinf( a.v ) ); }
+DUAL_INLINE dual asin( const dual& a ) { return dual( asinf( a.v ), a.g / sqrtf( 1 - a.v * a.v ) ); }
+DUAL_INLINE dual atan2( const dual& y, const dual& x )
+{
+    float inv = 1.0f / ( x.v * x.v + y.v * y.v );
+    return dual( atan2f( y.v, x.v ), ( y.g * x.v - x.g * y.v ) * inv );
+}
+DUAL_INLINE dual pow( const dual& a, float n )
+{
+    float p = powf( a.v, n );
+    return dual( p, a.g * ( a.v != 0 ? n * p / a.v : 0 ) );
+}
+
+DUAL_INLINE void SinCos( const dual& a, dual* pSin, dual* pCos )
+{
+    float s = sinf( a.v ), c = cosf( a.v );
+    *pSin = dual( s, a.g * c );
+    *pCos = dual( c, a.g * -s );
+}
+DUAL_INLINE dual madd( const dual& a, const dual& b, const dual& c ) { return a * b + c; }
+
+// Comparisons and clamp look at the value only and take the derivative of
+// the branch the value is on
+DUAL_INLINE bool operator <  ( const dual& a, const dual& b ) { return a.v < b.v; }
+DUAL_INLINE bool operator >  ( const dual& a, const dual& b ) { return a.v > b.v; }
+DUAL_INLINE dual clamp( const dual& s, const dual& lo, const dual& hi ) { return s.v < lo.v ? lo : ( s.v > hi.v ? hi : s ); }
+
+struct dual3
+{
+    dual x, y, z;
+
+    dual3() {}
+    dual3( const dual& _x, const dual& _y, const dual& _z ) : x( _x ), y( _y ), z( _z ) {}
+};
+
+// The DE argument itself: each coordinate has the unit vector of its axis as gradient
+DUAL_INLINE dual3 SeedGradient( const float3& p )
+{
+    return dual3( dual( p.x, float3( 1, 0, 0 ) ), dual( p.y, float3( 0, 1, 0 ) ), dual( p.z, float3( 0, 0, 1 ) ) );
+}
+
+#endif // DUAL_H
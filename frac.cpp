@@ -14,6 +14,10 @@
 #include <D3DX11.h>
 #include <D3DX11core.h>
 #include <D3DX11async.h>
+#include "cpurender.h"
+#include "cpukernels.h"
+#include "cpude.h"
+#include "headless.h"
 
 #define ENABLE_MODEL_VIEW_CAMERA
 
@@ -51,10 +55,11 @@ struct CbMandelbulb
     D3DXMATRIX mInvWorld;
     D3DXMATRIX mInvView;
     float dist;
-    float pad0;
-    float pad1;
-    float pad2;
+    float relax;
+    float pixelSize;
+    float refine;
 };
+C_ASSERT( sizeof( CbMandelbulb ) == sizeof( CpuView ) );
 
 ID3D11Buffer*               g_pcbMandelbulb = NULL;         // Constant buffer for passing parameters into the CS
 
@@ -62,17 +67,58 @@ CbMandelbulb                g_cbMandelbulb;                 // mandelbulb time f
 bool                        g_bBloom = false;               // Bloom effect on/off
 bool                        g_bFullScrBlur = false;         // Full screen blur on/off
 bool                        g_bPostProcessON = true;        // All post-processing effect on/off
+bool                        g_bCaptureFrame = false;        // Save the next frame and its view for the CPU renderer
+float                       g_fRelax = 1.0f;                // Over-relaxation factor of the ray marcher, 1 = off
+bool                        g_bFootprint = false;           // Pixel footprint hit epsilon and iteration LOD on/off
+float                       g_fRefine = 0.0f;               // Loose hit threshold in hit epsilons before refinement, 0 = off
 
 CDXUTStatic*                g_pStaticTech = NULL;           // Sample specific UI
 CDXUTComboBox*              g_pComboBoxTech = NULL;
 CDXUTCheckBox*              g_pCheckBloom = NULL;
 CDXUTCheckBox*              g_pCheckScrBlur = NULL;
+CDXUTStatic*                g_pStaticRelax = NULL;
+CDXUTStatic*                g_pStaticRefine = NULL;
 ID3D11PixelShader*          g_pMandelbulbPS = NULL;
 ID3D11PixelShader*          g_pMandelboxPS = NULL;
 
+// Bounding sphere of the mandelbox for MandelboxPS, probed once on the CPU
+struct CbMandelbox
+{
+    float BoundRadius;
+    float pad[3];
+};
+
+ID3D11Buffer*               g_pcbMandelbox = NULL;
+
 ID3D11SamplerState*         g_pSampleStatePoint = NULL;
 ID3D11SamplerState*         g_pSampleStateLinear = NULL;
 
+// Compute shader path: cone marching pre-pass over coarse and fine pixel blocks, then
+// one thread per pixel writing into a structured buffer which is blitted to the screen
+struct CbCone
+{
+    UINT Size[2];
+    UINT BlockSize;
+    UINT BlocksX;
+    UINT ParentBlockSize;
+    UINT ParentBlocksX;
+    UINT pad[2];
+};
+
+#define CONE_COARSE_BLOCK       32
+#define CONE_FINE_BLOCK         8
+
+ID3D11ComputeShader*        g_pConeCS = NULL;
+ID3D11ComputeShader*        g_pMandelbulbCS = NULL;
+ID3D11PixelShader*          g_pBlitPS = NULL;
+ID3D11Buffer*               g_pcbCone = NULL;
+ID3D11Buffer*               g_pConeBuf[2] = { NULL, NULL };     // coarse, fine block distances
+ID3D11ShaderResourceView*   g_pConeSRV[2] = { NULL, NULL };
+ID3D11UnorderedAccessView*  g_pConeUAV[2] = { NULL, NULL };
+ID3D11Buffer*               g_pImageBuf = NULL;                 // float4 per pixel
+ID3D11ShaderResourceView*   g_pImageSRV = NULL;
+ID3D11UnorderedAccessView*  g_pImageUAV = NULL;
+
 
 //--------------------------------------------------------------------------------------
 // UI control IDs
@@ -84,6 +130,10 @@ ID3D11SamplerState*         g_pSampleStateLinear = NULL;
 #define IDC_BLOOM               6
 #define IDC_POSTPROCESSON       7
 #define IDC_SCREENBLUR          8
+#define IDC_CAPTUREFRAME        9
+#define IDC_RELAX               10
+#define IDC_FOOTPRINT           11
+#define IDC_REFINE              12
 
 //--------------------------------------------------------------------------------------
 // Forward declarations 
@@ -120,49 +170,6 @@ HRESULT CopyToBuffer(ID3D11DeviceContext* pContext, T* pData, ID3D11Buffer* pcbB
     return hr;
 }
 
-double DE(D3DXVECTOR3 p)
-{
-    D3DXVECTOR3 c = p;
-    float r = D3DXVec3Length(&c);
-    float dr = 1;
-    for (int i = 0; i < 4 && r < 3; ++i)
-    {
-        float xr = pow(r, 7);
-        dr = 6 * xr * dr + 1;
-  
-        float theta = atan2(c.y, c.x) * 8;
-        float phi = asin(c.z / r) * 8;
-        r = xr * r;
-        c = r * D3DXVECTOR3(cos(phi) * cos(theta), cos(phi) * sin(theta), sin(phi));
-   
-        c += p;
-        r = D3DXVec3Length(&c);
-    }
-
-    return 0.35 * log(r) * r / dr;
-}
-
-float DE2(D3DXVECTOR3 p)
-{
-    D3DXVECTOR3 c = p;
-    float r = D3DXVec3Length(&c);
-    float dr = 1;
-    for (int i = 0; i < 4 && r < 3; ++i)
-    {
-        float xr = pow(r, 7);
-        dr = 6 * xr * dr + 1;
-  
-        float theta = atan2(c.y, c.x) * 8;
-        float phi = asin(c.z / r) * 8;
-        r = xr * r;
-        c = r * D3DXVECTOR3(cos(phi) * cos(theta), cos(phi) * sin(theta), sin(phi));
-   
-        c += p;
-        r = D3DXVec3Length(&c);
-    }
-    return 0.35 * logf(r) * r / dr;
-}
-
 //--------------------------------------------------------------------------------------
 // Find and compile the specified shader
 //--------------------------------------------------------------------------------------
@@ -198,6 +205,42 @@ HRESULT CompileShaderFromFile( WCHAR* szFileName, LPCSTR szEntryPoint, LPCSTR sz
     return S_OK;
 }
 
+//--------------------------------------------------------------------------------------
+// Creates a structured buffer usable as UAV in a CS and as SRV afterwards
+//--------------------------------------------------------------------------------------
+HRESULT CreateStructuredBuffer( ID3D11Device* pd3dDevice, UINT nStride, UINT nCount, ID3D11Buffer** ppBuffer,
+                                ID3D11ShaderResourceView** ppSRV, ID3D11UnorderedAccessView** ppUAV )
+{
+    HRESULT hr;
+
+    D3D11_BUFFER_DESC Desc;
+    ZeroMemory( &Desc, sizeof( Desc ) );
+    Desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE;
+    Desc.ByteWidth = nStride * nCount;
+    Desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+    Desc.StructureByteStride = nStride;
+    Desc.Usage = D3D11_USAGE_DEFAULT;
+    V_RETURN( pd3dDevice->CreateBuffer( &Desc, NULL, ppBuffer ) );
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC SRVDesc;
+    ZeroMemory( &SRVDesc, sizeof( SRVDesc ) );
+    SRVDesc.Format = DXGI_FORMAT_UNKNOWN;
+    SRVDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+    SRVDesc.Buffer.FirstElement = 0;
+    SRVDesc.Buffer.NumElements = nCount;
+    V_RETURN( pd3dDevice->CreateShaderResourceView( *ppBuffer, &SRVDesc, ppSRV ) );
+
+    D3D11_UNORDERED_ACCESS_VIEW_DESC UAVDesc;
+    ZeroMemory( &UAVDesc, sizeof( UAVDesc ) );
+    UAVDesc.Format = DXGI_FORMAT_UNKNOWN;
+    UAVDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+    UAVDesc.Buffer.FirstElement = 0;
+    UAVDesc.Buffer.NumElements = nCount;
+    V_RETURN( pd3dDevice->CreateUnorderedAccessView( *ppBuffer, &UAVDesc, ppUAV ) );
+
+    return S_OK;
+}
+
 //--------------------------------------------------------------------------------------
 // Entry point to the program. Initializes everything and goes into a message processing 
 // loop. Idle time is used to render the scene.
@@ -209,6 +252,17 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdL
     _CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF );
 #endif
 
+    // Batch rendering on the CPU, no window or D3D device is created
+    if( IsHeadlessCommandLine( lpCmdLine ) )
+    {
+        if( AttachConsole( ATTACH_PARENT_PROCESS ) )
+        {
+            FILE* pFile = NULL;
+            _wfreopen_s( &pFile, L"CONOUT$", L"w", stdout );
+        }
+        return RunHeadless( lpCmdLine );
+    }
+
     // Disable gamma correction on this sample
     DXUTSetIsInGammaCorrectMode( false );
 
@@ -254,6 +308,7 @@ void InitApp()
     g_HUD.AddButton( IDC_TOGGLEFULLSCREEN, L"Toggle full screen", 0, iY, 170, 23 );
     g_HUD.AddButton( IDC_TOGGLEREF, L"Toggle REF (F3)", 0, iY += 26, 170, 23, VK_F3 );
     g_HUD.AddButton( IDC_CHANGEDEVICE, L"Change device (F2)", 0, iY += 26, 170, 23, VK_F2 );
+    g_HUD.AddButton( IDC_CAPTUREFRAME, L"Capture frame (F8)", 0, iY += 26, 170, 23, VK_F8 );
 
     g_SampleUI.AddCheckBox( IDC_POSTPROCESSON, L"(P)ost process on:", -20, 150-50, 140, 18, g_bPostProcessON, 'P' );
 
@@ -265,6 +320,16 @@ void InitApp()
     g_SampleUI.AddCheckBox( IDC_BLOOM, L"Show (B)loom", 0, 195, 140, 18, g_bBloom, 'B', false, &g_pCheckBloom );
     g_SampleUI.AddCheckBox( IDC_SCREENBLUR, L"Full (S)creen Blur", 0, 195+20, 140, 18, g_bFullScrBlur, 'S', false, &g_pCheckScrBlur );
 
+    // Over-relaxation factor k of ray_marching in hundredths, 100 is plain sphere tracing
+    g_SampleUI.AddStatic( 0, L"Relaxation: 1.00", 0, 195+45, 140, 18, false, &g_pStaticRelax );
+    g_SampleUI.AddSlider( IDC_RELAX, 0, 195+65, 140, 22, 100, 190, ( int )( g_fRelax * 100 ) );
+    g_SampleUI.AddCheckBox( IDC_FOOTPRINT, L"Pixel footprint LOD", 0, 195+95, 140, 18, g_bFootprint );
+
+    // Loose hit threshold of ray_marching in hit epsilons, 0 turns the refinement off. For
+    // comparing hit errors only: it saves no steps against a plain march of the same error.
+    g_SampleUI.AddStatic( 0, L"Hit refinement: off", 0, 195+120, 140, 18, false, &g_pStaticRefine );
+    g_SampleUI.AddSlider( IDC_REFINE, 0, 195+140, 140, 22, 0, 32, ( int )g_fRefine );
+
     g_SampleUI.SetCallback( OnGUIEvent ); 
 }
 
@@ -320,6 +385,7 @@ void RenderText()
     g_pTxtHelper->SetForegroundColor( D3DXCOLOR( 1.0f, 0.0f, 1.0f, 1.0f ) );
     g_pTxtHelper->DrawTextLine( DXUTGetFrameStats( DXUTIsVsyncEnabled() ) );
     g_pTxtHelper->DrawTextLine( DXUTGetDeviceStats() );
+    g_pTxtHelper->DrawFormattedTextLine( L"CPU kernels: %ls", GetCpuKernelsInfo() );
 
     g_pTxtHelper->End();
 }
@@ -371,6 +437,8 @@ void CALLBACK OnGUIEvent( UINT nEvent, int nControlID, CDXUTControl* pControl, v
             DXUTToggleREF(); break;
         case IDC_CHANGEDEVICE:
             g_D3DSettingsDlg.SetActive( !g_D3DSettingsDlg.IsActive() ); break;
+        case IDC_CAPTUREFRAME:
+            g_bCaptureFrame = true; break;
 
         case IDC_BLOOM:
             g_bBloom = !g_bBloom; break;
@@ -384,6 +452,28 @@ void CALLBACK OnGUIEvent( UINT nEvent, int nControlID, CDXUTControl* pControl, v
         case IDC_SCREENBLUR:
             g_bFullScrBlur = !g_bFullScrBlur;
             break;
+        case IDC_FOOTPRINT:
+            g_bFootprint = !g_bFootprint;
+            break;
+        case IDC_REFINE:
+        {
+            WCHAR sz[64];
+            g_fRefine = ( float )( ( CDXUTSlider* )pControl )->GetValue();
+            if( g_fRefine > 0 )
+                swprintf_s( sz, 64, L"Hit refinement: %.0fx eps", g_fRefine );
+            else
+                wcscpy_s( sz, 64, L"Hit refinement: off" );
+            g_pStaticRefine->SetText( sz );
+            break;
+        }
+        case IDC_RELAX:
+        {
+            WCHAR sz[64];
+            g_fRelax = ( ( CDXUTSlider* )pControl )->GetValue() / 100.0f;
+            swprintf_s( sz, 64, L"Relaxation: %.2f", g_fRelax );
+            g_pStaticRelax->SetText( sz );
+            break;
+        }
 
         case IDC_POSTPROCESS_MODE:
         {
@@ -447,6 +537,21 @@ HRESULT CALLBACK OnD3D11CreateDevice( ID3D11Device* pd3dDevice, const DXGI_SURFA
     SAFE_RELEASE( pBlob );
     DXUT_SetDebugName( g_pMandelboxPS, "MandelboxPS" );
 
+    V_RETURN( CompileShaderFromFile( L"ConeCS.hlsl", "ConeCS", "cs_4_0", &pBlob ) );
+    V_RETURN( pd3dDevice->CreateComputeShader( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), NULL, &g_pConeCS ) );
+    SAFE_RELEASE( pBlob );
+    DXUT_SetDebugName( g_pConeCS, "ConeCS" );
+
+    V_RETURN( CompileShaderFromFile( L"MandelbulbCS.hlsl", "MandelbulbCS", "cs_4_0", &pBlob ) );
+    V_RETURN( pd3dDevice->CreateComputeShader( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), NULL, &g_pMandelbulbCS ) );
+    SAFE_RELEASE( pBlob );
+    DXUT_SetDebugName( g_pMandelbulbCS, "MandelbulbCS" );
+
+    V_RETURN( CompileShaderFromFile( L"MandelbulbCS.hlsl", "BlitPS", "ps_4_0", &pBlob ) );
+    V_RETURN( pd3dDevice->CreatePixelShader( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), NULL, &g_pBlitPS ) );
+    SAFE_RELEASE( pBlob );
+    DXUT_SetDebugName( g_pBlitPS, "BlitPS" );
+
     V_RETURN( CompileShaderFromFile( L"QuadVS.hlsl", "QuadVS", "vs_4_0", &pBlob ) );
     V_RETURN( pd3dDevice->CreateVertexShader( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), NULL, &g_pQuadVS ) );
     DXUT_SetDebugName( g_pQuadVS, "QuadVS" );
@@ -470,6 +575,17 @@ HRESULT CALLBACK OnD3D11CreateDevice( ID3D11Device* pd3dDevice, const DXGI_SURFA
     V_RETURN( pd3dDevice->CreateBuffer( &Desc, NULL, &g_pcbMandelbulb ) );
     DXUT_SetDebugName( g_pcbMandelbulb, "CbMandelbulb" );
 
+    Desc.ByteWidth = sizeof( CbCone );
+    V_RETURN( pd3dDevice->CreateBuffer( &Desc, NULL, &g_pcbCone ) );
+    DXUT_SetDebugName( g_pcbCone, "CbCone" );
+
+    // The shader's DE has the default parameters hard-coded
+    CbMandelbox cbMandelbox = { 1.1f * GetFractalRadius( MakeCpuFractal( FT_MANDELBOX ) ), { 0, 0, 0 } };
+    D3D11_SUBRESOURCE_DATA InitData = { &cbMandelbox, 0, 0 };
+    Desc.ByteWidth = sizeof( CbMandelbox );
+    V_RETURN( pd3dDevice->CreateBuffer( &Desc, &InitData, &g_pcbMandelbox ) );
+    DXUT_SetDebugName( g_pcbMandelbox, "CbMandelbox" );
+
     // Samplers
     D3D11_SAMPLER_DESC SamplerDesc;
     ZeroMemory( &SamplerDesc, sizeof(SamplerDesc) );
@@ -539,6 +655,17 @@ HRESULT CALLBACK OnD3D11ResizedSwapChain( ID3D11Device* pd3dDevice, IDXGISwapCha
     g_SampleUI.SetLocation( pBackBufferSurfaceDesc->Width - 170, pBackBufferSurfaceDesc->Height - 240 );
     g_SampleUI.SetSize( 150, 110 );
 
+    // Buffers of the compute shader path
+    UINT W = pBackBufferSurfaceDesc->Width, H = pBackBufferSurfaceDesc->Height;
+    UINT nCoarse = ( ( W + CONE_COARSE_BLOCK - 1 ) / CONE_COARSE_BLOCK ) * ( ( H + CONE_COARSE_BLOCK - 1 ) / CONE_COARSE_BLOCK );
+    UINT nFine = ( ( W + CONE_FINE_BLOCK - 1 ) / CONE_FINE_BLOCK ) * ( ( H + CONE_FINE_BLOCK - 1 ) / CONE_FINE_BLOCK );
+    V_RETURN( CreateStructuredBuffer( pd3dDevice, sizeof( float ), nCoarse, &g_pConeBuf[0], &g_pConeSRV[0], &g_pConeUAV[0] ) );
+    V_RETURN( CreateStructuredBuffer( pd3dDevice, sizeof( float ), nFine, &g_pConeBuf[1], &g_pConeSRV[1], &g_pConeUAV[1] ) );
+    V_RETURN( CreateStructuredBuffer( pd3dDevice, 4 * sizeof( float ), W * H, &g_pImageBuf, &g_pImageSRV, &g_pImageUAV ) );
+    DXUT_SetDebugName( g_pConeBuf[0], "ConeCoarse" );
+    DXUT_SetDebugName( g_pConeBuf[1], "ConeFine" );
+    DXUT_SetDebugName( g_pImageBuf, "Image" );
+
     return S_OK;
 }
 
@@ -676,7 +803,10 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
     D3DXMATRIXA16 mProj;
     D3DXMATRIXA16 mWorldViewProjection;
 
-    float distEst = (float)DE(*g_pCamera->GetEyePt());
+    // Distance of the eye from the surface, scales the camera speed and the hit epsilon
+    const D3DXVECTOR3* pEye = g_pCamera->GetEyePt();
+    static const CpuFractal s_Mandelbulb = MakeCpuFractal( FT_MANDELBULB );
+    float distEst = EvaluateDE( s_Mandelbulb, float3( pEye->x, pEye->y, pEye->z ) );
     // Get the projection & view matrix from the camera class
 #ifdef ENABLE_MODEL_VIEW_CAMERA
     mWorld = *g_MVCamera.GetWorldMatrix();
@@ -693,6 +823,9 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
     D3DXMatrixInverse(&g_cbMandelbulb.mInvView, NULL, &mView);
     D3DXMatrixInverse(&g_cbMandelbulb.mInvWorld, NULL, &mWorld);
     g_cbMandelbulb.dist = distEst;
+    g_cbMandelbulb.relax = g_fRelax;
+    g_cbMandelbulb.refine = g_fRefine;
+    g_cbMandelbulb.pixelSize = g_bFootprint ? 2 / ( mProj._22 * DXUTGetDXGIBackBufferSurfaceDesc()->Height ) : 0;
     CopyToBuffer<CbMandelbulb>(pd3dImmediateContext, (CbMandelbulb*)&g_cbMandelbulb, g_pcbMandelbulb);
 
     if ( g_bPostProcessON )
@@ -705,15 +838,59 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
     // Tone-mapping
     if ( g_ePostProcessMode == PM_COMPUTE_SHADER )
     {
-        // TODO Compute shader implementation
+        UINT W = pBackBufferDesc->Width, H = pBackBufferDesc->Height;
+        ID3D11Buffer* ppCB[2] = { g_pcbMandelbulb, g_pcbCone };
+
+        CbCone cbCone;
+        ZeroMemory( &cbCone, sizeof( cbCone ) );
+        cbCone.Size[0] = W;
+        cbCone.Size[1] = H;
+
+        // Cone pre-pass: coarse blocks from the eye, then fine blocks from their coarse block
+        UINT nCoarseX = ( W + CONE_COARSE_BLOCK - 1 ) / CONE_COARSE_BLOCK;
+        UINT nCoarseY = ( H + CONE_COARSE_BLOCK - 1 ) / CONE_COARSE_BLOCK;
+        cbCone.BlockSize = CONE_COARSE_BLOCK;
+        cbCone.BlocksX = nCoarseX;
+        CopyToBuffer<CbCone>( pd3dImmediateContext, &cbCone, g_pcbCone );
+        pd3dImmediateContext->CSSetConstantBuffers( 1, 1, &ppCB[1] );
+        RunComputeShader( pd3dImmediateContext, g_pConeCS, 0, NULL, g_pcbMandelbulb, &g_cbMandelbulb, sizeof( CbMandelbulb ),
+                          g_pConeUAV[0], ( nCoarseX + 7 ) / 8, ( nCoarseY + 7 ) / 8, 1 );
+
+        UINT nFineX = ( W + CONE_FINE_BLOCK - 1 ) / CONE_FINE_BLOCK;
+        UINT nFineY = ( H + CONE_FINE_BLOCK - 1 ) / CONE_FINE_BLOCK;
+        cbCone.BlockSize = CONE_FINE_BLOCK;
+        cbCone.BlocksX = nFineX;
+        cbCone.ParentBlockSize = CONE_COARSE_BLOCK;
+        cbCone.ParentBlocksX = nCoarseX;
+        CopyToBuffer<CbCone>( pd3dImmediateContext, &cbCone, g_pcbCone );
+        ID3D11ShaderResourceView* aCoarseViews[ 2 ] = { NULL, g_pConeSRV[0] };
+        RunComputeShader( pd3dImmediateContext, g_pConeCS, 2, aCoarseViews, g_pcbMandelbulb, &g_cbMandelbulb, sizeof( CbMandelbulb ),
+                          g_pConeUAV[1], ( nFineX + 7 ) / 8, ( nFineY + 7 ) / 8, 1 );
+
+        // Full resolution, every ray starting at its fine block's distance. CS4.0 can't
+        // write to the back buffer, so the image goes through a structured buffer.
+        ID3D11ShaderResourceView* aFineViews[ 2 ] = { NULL, g_pConeSRV[1] };
+        RunComputeShader( pd3dImmediateContext, g_pMandelbulbCS, 2, aFineViews, g_pcbMandelbulb, &g_cbMandelbulb, sizeof( CbMandelbulb ),
+                          g_pImageUAV, ( W + 7 ) / 8, ( H + 7 ) / 8, 1 );
+
+        ID3D11Buffer* ppCBNULL[1] = { NULL };
+        pd3dImmediateContext->CSSetConstantBuffers( 1, 1, ppCBNULL );
+
+        ID3D11ShaderResourceView* aRViews[ 3 ] = { NULL, NULL, g_pImageSRV };
+        pd3dImmediateContext->PSSetShaderResources( 0, 3, aRViews );
+        pd3dImmediateContext->PSSetConstantBuffers( 0, 2, ppCB );
+        DrawFullScreenQuad11( pd3dImmediateContext, g_pBlitPS, W, H );
+
+        ID3D11ShaderResourceView* ppSRVNULL[3] = { NULL, NULL, NULL };
+        pd3dImmediateContext->PSSetShaderResources( 0, 3, ppSRVNULL );
     }
     else //if ( g_ePostProcessMode == PM_PIXEL_SHADER )
     {
         ID3D11ShaderResourceView* aRViews[ 1 ] = { NULL };
         pd3dImmediateContext->PSSetShaderResources( 0, 1, aRViews );
 
-        ID3D11Buffer* ppCB[1] = { g_pcbMandelbulb };
-        pd3dImmediateContext->PSSetConstantBuffers( 0, 1, ppCB );
+        ID3D11Buffer* ppCB[3] = { g_pcbMandelbulb, NULL, g_pcbMandelbox };
+        pd3dImmediateContext->PSSetConstantBuffers( 0, 3, ppCB );
 
         ID3D11SamplerState* aSamplers[] = { g_pSampleStatePoint, g_pSampleStateLinear };
         pd3dImmediateContext->PSSetSamplers( 0, 2, aSamplers );
@@ -722,6 +899,18 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
         DrawFullScreenQuad11( pd3dImmediateContext, g_pMandelbulbPS, pBackBufferDesc->Width, pBackBufferDesc->Height );
     }
 
+    // Save the shader output before the HUD is drawn, together with the view it was
+    // rendered with, so "frac -headless -view:frac_gpu.txt -fdnormals -reference:frac_gpu.bmp"
+    // can check the CPU renderer against it
+    if ( g_bCaptureFrame )
+    {
+        g_bCaptureFrame = false;
+        CpuView view;
+        memcpy( &view, &g_cbMandelbulb, sizeof( view ) );
+        DXUTSnapD3D11Screenshot( L"frac_gpu.bmp", D3DX11_IFF_BMP );
+        SaveCpuView( L"frac_gpu.txt", view );
+    }
+
     ID3D11ShaderResourceView* ppSRVNULL[1] = { NULL };
     pd3dImmediateContext->PSSetShaderResources( 0, 1, ppSRVNULL );
 
@@ -748,6 +937,11 @@ void CALLBACK OnD3D11DestroyDevice( void* pUserContext )
     SAFE_RELEASE( g_pMandelbulbPS );
     SAFE_RELEASE( g_pMandelboxPS );
     SAFE_RELEASE( g_pcbMandelbulb );
+    SAFE_RELEASE( g_pConeCS );
+    SAFE_RELEASE( g_pMandelbulbCS );
+    SAFE_RELEASE( g_pBlitPS );
+    SAFE_RELEASE( g_pcbCone );
+    SAFE_RELEASE( g_pcbMandelbox );
 
     SAFE_RELEASE( g_pSampleStateLinear );
     SAFE_RELEASE( g_pSampleStatePoint );
@@ -760,4 +954,14 @@ void CALLBACK OnD3D11DestroyDevice( void* pUserContext )
 void CALLBACK OnD3D11ReleasingSwapChain( void* pUserContext )
 {
     g_DialogResourceManager.OnD3D11ReleasingSwapChain();
+
+    for( int i = 0; i < 2; ++i )
+    {
+        SAFE_RELEASE( g_pConeUAV[i] );
+        SAFE_RELEASE( g_pConeSRV[i] );
+        SAFE_RELEASE( g_pConeBuf[i] );
+    }
+    SAFE_RELEASE( g_pImageUAV );
+    SAFE_RELEASE( g_pImageSRV );
+    SAFE_RELEASE( g_pImageBuf );
 }
@@ -11,9 +11,21 @@ cbuffer cbView : register( b0 )
     row_major matrix mInvWorld;               // inverse world matrix
     row_major matrix mInvView;                // inverse view matrix
     float dist;
-    float pad0;
-    float pad1;
-    float pad2;
+    float relax;                              // over-relaxation factor of ray_marching, 1 = plain sphere tracing
+    float pixelSize;                          // pixel size at unit distance from the eye, 0 = global hit epsilon
+    float refine;                             // loose hit threshold of ray_marching in hit epsilons, 0 = no refinement;
+                                              // costs about the steps of a plain march at a larger error (see CpuView)
+}
+
+// Cone marching pre-pass of the compute shader path
+cbuffer cbCone : register( b1 )
+{
+    uint2 Size;                               // screen size in pixels
+    uint BlockSize;                           // block size of the level being written (ConeCS) or read
+    uint BlocksX;                             // blocks per row of that level
+    uint ParentBlockSize;                     // level ConeCS starts from, 0 for the top level
+    uint ParentBlocksX;
+    uint2 padCone;
 }
 
 struct QuadVS_Output
@@ -33,15 +45,36 @@ Texture2D s0 : register(t0);
 SamplerState PointSampler : register (s0);
 SamplerState LinearSampler : register (s1);
 
+float3 GetEye()
+{
+    float3 eye = float3(mInvView[3][0], mInvView[3][1], mInvView[3][2]);
+    return (float3)mul(float4(eye, 1), mInvWorld);
+}
+
 void GetRay(in float2 pt, out Ray ray)
 {
     float u = (pt.x * 2 - 1) / mProj[0][0];
     float v = (-pt.y * 2 + 1) / mProj[1][1];
 
-    ray.pos = float3(mInvView[3][0], mInvView[3][1], mInvView[3][2]);
-    ray.pos = (float3)mul(float4(ray.pos, 1), mInvWorld);
+    ray.pos = GetEye();
 
     ray.dir = normalize(float3(u, v, 1.0f));
     ray.dir = mul(ray.dir, (float3x3)mInvView);
     ray.dir = normalize(mul(ray.dir, (float3x3)mInvWorld));
 }
+
+// Cone from the eye around the rays through the pixel centers p0 .. p1 (inclusive) of a
+// screen of the given size: ray is the axis, k the tangent of the largest angle between
+// the axis and a corner ray. The rays through the other pixels lie inside.
+void GetBlockCone(float2 p0, float2 p1, float2 size, out Ray ray, out float k)
+{
+    GetRay((p0 + p1 + 1) * 0.5 / size, ray);
+
+    float c = 1;
+    Ray corner;
+    GetRay((float2(p0.x, p0.y) + 0.5) / size, corner); c = min(c, dot(corner.dir, ray.dir));
+    GetRay((float2(p1.x, p0.y) + 0.5) / size, corner); c = min(c, dot(corner.dir, ray.dir));
+    GetRay((float2(p0.x, p1.y) + 0.5) / size, corner); c = min(c, dot(corner.dir, ray.dir));
+    GetRay((float2(p1.x, p1.y) + 0.5) / size, corner); c = min(c, dot(corner.dir, ray.dir));
+    k = sqrt(max(1 - c * c, 0)) / c;
+}
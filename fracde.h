@@ -0,0 +1,338 @@
+//--------------------------------------------------------------------------------------
+// File: fracde.h
+//
+// CPU versions of the distance estimators in mandelbulb.fx and MandelboxPS.hlsl.
+//
+// Each estimator is written once as a template over its number type and instantiated
+// for float (the reference), double, dual numbers (value and gradient, dual.h) and the
+// SIMD packets of fracde_simd.h. They are ports of the shader code and must be kept in
+// sync with it; the CPU renderer relies on them to reproduce the GPU image.
+//
+// A template works on the coordinates of p and only uses arithmetic, sqrt, clamp and the
+// helpers below, which every number type provides, and takes its transcendental
+// functions from a MATH policy (DEMath, or VMathFast in fracde_simd.h). Where lanes of a
+// packet take different branches both sides are computed and LaneSelect picks per lane;
+// for the scalar types the masks are plain bools.
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef FRACDE_H
+#define FRACDE_H
+
+#include "cpumath.h"
+#include "dual.h"
+#include <cmath>
+
+// The mandelbulb DEs stop iterating at r >= 3, where they return at least
+// 0.35 * log(3) * 3 > 1, so no ray can hit outside this sphere
+#define MANDELBULB_BOUND_RADIUS     3.0f
+
+// Iterations of the mandelbulb DEs in the shaders, the most any caller asks for
+#define MANDELBULB_ITERATIONS       4
+
+// Powers of the mandelbulb with a compiled kernel; the shaders render power 8
+#define MANDELBULB_MIN_POWER        2
+#define MANDELBULB_MAX_POWER        16
+#define MANDELBULB_DEFAULT_POWER    8
+
+// Implementation of the mandelbulb iteration
+enum DE_KERNEL
+{
+    DK_TRIG,            // spherical coordinates with atan2/asin/cos/sin, as in the shaders
+    DK_TRIPLEX,         // polynomial triplex algebra, no transcendental functions
+};
+
+// Iteration LOD: the iteration count needed to resolve a surface down to the hit epsilon
+// eps. Compared with 4 iterations, the hit point along a ray moves by 0.007 on average
+// with 3 and by 0.018 with 2, so those are used once a pixel (2 * eps) is larger.
+inline int MandelbulbLodIterations( float eps )
+{
+    return eps < 0.0035f ? 4 : eps < 0.009f ? 3 : 2;
+}
+
+//--------------------------------------------------------------------------------------
+// Helpers of the scalar instantiations; dual.h and fracde_simd.h overload them for their
+// types
+//--------------------------------------------------------------------------------------
+template<class T> DUAL_INLINE T LaneSelect( bool bMask, const T& a, const T& b ) { return bMask ? a : b; }
+inline bool AnyLane( bool bMask ) { return bMask; }
+inline bool LaneAnd( bool a, bool b ) { return a && b; }
+
+inline float  madd( float a, float b, float c ) { return a * b + c; }
+inline double madd( double a, double b, double c ) { return a * b + c; }
+inline void   SinCos( float a, float* pSin, float* pCos ) { *pSin = sinf( a ); *pCos = cosf( a ); }
+inline void   SinCos( double a, double* pSin, double* pCos ) { *pSin = sin( a ); *pCos = cos( a ); }
+inline double clamp( double s, double lo, double hi ) { double t = s < lo ? lo : s; return t > hi ? hi : t; }
+
+template<class T> DUAL_INLINE T Length3( const T& x, const T& y, const T& z )
+{
+    using std::sqrt;
+    return sqrt( x * x + y * y + z * z );
+}
+
+// Transcendental functions of the templates: the overloads of the number type, i.e. libm
+// for float and double, dual.h and the precise functions of vmath.h for packets
+struct DEMath
+{
+    template<class T> DUAL_INLINE static T Atan2( const T& y, const T& x ) { using std::atan2; return atan2( y, x ); }
+    template<class T> DUAL_INLINE static T Asin( const T& x ) { using std::asin; return asin( x ); }
+    template<class T> DUAL_INLINE static T Log( const T& x ) { using std::log; return log( x ); }
+    template<class T> DUAL_INLINE static void SinCos( const T& x, T* pSin, T* pCos ) { using ::SinCos; SinCos( x, pSin, pCos ); }
+};
+
+//--------------------------------------------------------------------------------------
+// Integer powers by squaring, expanded at compile time: x^N takes about log2(N)
+// multiplications and (re + i im)^N as many complex ones
+//--------------------------------------------------------------------------------------
+template<int N> struct IntPow
+{
+    template<class T> DUAL_INLINE static T Eval( const T& x )
+    {
+        T h = IntPow<N / 2>::Eval( x );
+        return ( N & 1 ) ? h * h * x : h * h;
+    }
+};
+template<> struct IntPow<1>
+{
+    template<class T> DUAL_INLINE static T Eval( const T& x ) { return x; }
+};
+
+template<int N> struct ComplexPow
+{
+    template<class T> DUAL_INLINE static void Eval( T& re, T& im )
+    {
+        T hr = re, hi = im;
+        ComplexPow<N / 2>::Eval( hr, hi );
+        T sr = hr * hr - hi * hi;
+        T si = ( hr + hr ) * hi;
+        if( N & 1 )
+        {
+            T t = sr * re - si * im;
+            im = sr * im + si * re;
+            re = t;
+        }
+        else
+        {
+            re = sr;
+            im = si;
+        }
+    }
+};
+template<> struct ComplexPow<1>
+{
+    template<class T> DUAL_INLINE static void Eval( T&, T& ) {}
+};
+
+//--------------------------------------------------------------------------------------
+// Power N mandelbulb, DE(p, iterations) in mandelbulb.fx for N = 8. nIterations may
+// differ per lane and is at most MANDELBULB_ITERATIONS; a lane stops at r >= 3 or after
+// nIterations and keeps its r and dr while the others iterate on.
+//
+// The derivative is scaled with the power like in the shader, which uses 6 = 0.75 * 8
+// instead of the analytic 8, so every power gets the same safety margin.
+//--------------------------------------------------------------------------------------
+template<int N, class T, class MATH = DEMath>
+T MandelbulbDE( const T& px, const T& py, const T& pz, const T& nIterations = T( ( float )MANDELBULB_ITERATIONS ) )
+{
+    T cx = px, cy = py, cz = pz;
+    T r = Length3( cx, cy, cz );
+    T dr = T( 1.0f );
+    auto active = LaneAnd( r < T( 3.0f ), T( 0.0f ) < nIterations );
+    for( int i = 0; i < MANDELBULB_ITERATIONS && AnyLane( active ); ++i )
+    {
+        T xr = IntPow<N - 1>::Eval( r );
+        dr = LaneSelect( active, madd( ( 0.75f * N ) * xr, dr, T( 1.0f ) ), dr );
+
+        T theta = MATH::Atan2( cy, cx ) * ( float )N;
+        T phi = MATH::Asin( cz / r ) * ( float )N;
+        T rn = xr * r;
+
+        T st, ct, sp, cp;
+        MATH::SinCos( theta, &st, &ct );
+        MATH::SinCos( phi, &sp, &cp );
+        T cxn = cp * ct * rn + px;
+        T cyn = cp * st * rn + py;
+        T czn = sp * rn + pz;
+
+        cx = LaneSelect( active, cxn, cx );
+        cy = LaneSelect( active, cyn, cy );
+        cz = LaneSelect( active, czn, cz );
+        r = LaneSelect( active, Length3( cxn, cyn, czn ), r );
+        active = LaneAnd( active, LaneAnd( r < T( 3.0f ), T( ( float )( i + 1 ) ) < nIterations ) );
+    }
+    return 0.35f * MATH::Log( r ) * r / dr;
+}
+
+//--------------------------------------------------------------------------------------
+// Same power N map as MandelbulbDE without any transcendental functions.
+//
+// With rho = sqrt(x^2 + y^2), theta = atan2(y, x) and phi = asin(z / r):
+//   cos(N theta) + i sin(N theta) = ((x + i y) / rho)^N
+//   r^N (cos(N phi) + i sin(N phi)) = (rho + i z)^N
+// so both angle multiplications become complex powers (three squarings each for N = 8).
+//--------------------------------------------------------------------------------------
+template<int N, class T, class MATH = DEMath>
+T MandelbulbDETriplex( const T& px, const T& py, const T& pz, const T& nIterations = T( ( float )MANDELBULB_ITERATIONS ) )
+{
+    using std::sqrt;
+
+    T cx = px, cy = py, cz = pz;
+    T r = Length3( cx, cy, cz );
+    T dr = T( 1.0f );
+    auto active = LaneAnd( r < T( 3.0f ), T( 0.0f ) < nIterations );
+    for( int i = 0; i < MANDELBULB_ITERATIONS && AnyLane( active ); ++i )
+    {
+        T xr = IntPow<N - 1>::Eval( r );
+        dr = LaneSelect( active, madd( ( 0.75f * N ) * xr, dr, T( 1.0f ) ), dr );
+
+        // On the z axis atan2(0, 0) = 0, i.e. theta = 0
+        T rho = sqrt( madd( cx, cx, cy * cy ) );
+        auto offaxis = rho > T( 0.0f );
+        T inv = 1.0f / rho;
+        T ax = LaneSelect( offaxis, cx * inv, T( 1.0f ) );     // ((x + iy) / rho)^N
+        T ay = LaneSelect( offaxis, cy * inv, T( 0.0f ) );
+        T bx = rho, bz = cz;                                    // (rho + iz)^N
+        ComplexPow<N>::Eval( ax, ay );
+        ComplexPow<N>::Eval( bx, bz );
+        T cxn = bx * ax + px;
+        T cyn = bx * ay + py;
+        T czn = bz + pz;
+
+        cx = LaneSelect( active, cxn, cx );
+        cy = LaneSelect( active, cyn, cy );
+        cz = LaneSelect( active, czn, cz );
+        r = LaneSelect( active, Length3( cxn, cyn, czn ), r );
+        active = LaneAnd( active, LaneAnd( r < T( 3.0f ), T( ( float )( i + 1 ) ) < nIterations ) );
+    }
+    return 0.35f * MATH::Log( r ) * r / dr;
+}
+
+//--------------------------------------------------------------------------------------
+// Mandelbox parameters. MandelboxPS.hlsl hard-codes the defaults; the derived constants
+// are computed once by MakeMandelboxParams instead of on every DE evaluation.
+//--------------------------------------------------------------------------------------
+struct MandelboxParams
+{
+    float scale;
+    float3 boxfold;
+    float spherefold;
+    int iterations;
+
+    float fScaleMinusOne;       // scale - 1
+    float fScalePowMinus3;      // pow(scale, -3)
+};
+
+inline MandelboxParams MakeMandelboxParams( float scale = 9, const float3& boxfold = float3( 1, 1, 1 ),
+                                            float spherefold = 0.2f, int iterations = 4 )
+{
+    MandelboxParams params;
+    params.scale = scale;
+    params.boxfold = boxfold;
+    params.spherefold = spherefold;
+    params.iterations = iterations;
+    params.fScaleMinusOne = scale - 1;
+    params.fScalePowMinus3 = powf( scale, -3 );
+    return params;
+}
+
+// DE in MandelboxPS.hlsl, with c.w kept in w. It needs no transcendental functions; MATH
+// only keeps the instantiations of different instruction set builds apart (cpukernels.h).
+template<class T, class MATH = DEMath>
+T MandelboxDE( const T& px, const T& py, const T& pz, const MandelboxParams& params )
+{
+    const T bx = params.boxfold.x, by = params.boxfold.y, bz = params.boxfold.z;
+    const float sf = params.spherefold;
+    const float scale = params.scale;
+
+    T cx = px, cy = py, cz = pz;
+    T w = T( 1.0f );
+    for( int i = 0; i < params.iterations; ++i )
+    {
+        cx = clamp( cx, -bx, bx ) * 2.0f - cx;
+        cy = clamp( cy, -by, by ) * 2.0f - cy;
+        cz = clamp( cz, -bz, bz ) * 2.0f - cz;
+        T rr = cx * cx + cy * cy + cz * cz;
+        T k = clamp( sf / rr, T( sf ), T( 1.0f ) ) * scale;    // saturate(max(spherefold / rr, spherefold))
+        cx = madd( cx, k, px );
+        cy = madd( cy, k, py );
+        cz = madd( cz, k, pz );
+        w = madd( w, k, T( 1.0f ) );
+    }
+    return ( Length3( cx, cy, cz ) - params.fScaleMinusOne ) / w - params.fScalePowMinus3;
+}
+
+//--------------------------------------------------------------------------------------
+// float instantiations, the reference for everything else, and dual instantiations: the
+// DE value is returned and its analytic gradient, which the shaders get from four DE
+// calls with 1e-5 offsets, is written to *pGrad.
+//--------------------------------------------------------------------------------------
+template<int N, class MATH = DEMath> inline float MandelbulbDE( const float3& p, int nIterations )
+{
+    return MandelbulbDE<N, float, MATH>( p.x, p.y, p.z, ( float )nIterations );
+}
+
+template<int N, class MATH = DEMath> inline float MandelbulbDETriplex( const float3& p, int nIterations )
+{
+    return MandelbulbDETriplex<N, float, MATH>( p.x, p.y, p.z, ( float )nIterations );
+}
+
+template<int N, class MATH = DEMath> inline float MandelbulbDEGrad( const float3& p, float3* pGrad )
+{
+    const dual3 c = SeedGradient( p );
+    dual de = MandelbulbDE<N, dual, MATH>( c.x, c.y, c.z );
+    *pGrad = de.g;
+    return de.v;
+}
+
+template<int N, class MATH = DEMath> inline float MandelbulbDETriplexGrad( const float3& p, float3* pGrad )
+{
+    const dual3 c = SeedGradient( p );
+    dual de = MandelbulbDETriplex<N, dual, MATH>( c.x, c.y, c.z );
+    *pGrad = de.g;
+    return de.v;
+}
+
+// The power of the shaders
+inline float MandelbulbDE( const float3& p, int nIterations = MANDELBULB_ITERATIONS )
+{
+    return MandelbulbDE<MANDELBULB_DEFAULT_POWER>( p, nIterations );
+}
+
+inline float MandelbulbDETriplex( const float3& p, int nIterations = MANDELBULB_ITERATIONS )
+{
+    return MandelbulbDETriplex<MANDELBULB_DEFAULT_POWER>( p, nIterations );
+}
+
+inline float MandelbulbDEGrad( const float3& p, float3* pGrad )
+{
+    return MandelbulbDEGrad<MANDELBULB_DEFAULT_POWER>( p, pGrad );
+}
+
+inline float MandelbulbDETriplexGrad( const float3& p, float3* pGrad )
+{
+    return MandelbulbDETriplexGrad<MANDELBULB_DEFAULT_POWER>( p, pGrad );
+}
+
+template<class MATH> inline float MandelboxDE( const float3& p, const MandelboxParams& params )
+{
+    return MandelboxDE<float, MATH>( p.x, p.y, p.z, params );
+}
+
+template<class MATH> inline float MandelboxDEGrad( const float3& p, const MandelboxParams& params, float3* pGrad )
+{
+    const dual3 c = SeedGradient( p );
+    dual de = MandelboxDE<dual, MATH>( c.x, c.y, c.z, params );
+    *pGrad = de.g;
+    return de.v;
+}
+
+inline float MandelboxDE( const float3& p, const MandelboxParams& params )
+{
+    return MandelboxDE<DEMath>( p, params );
+}
+
+inline float MandelboxDEGrad( const float3& p, const MandelboxParams& params, float3* pGrad )
+{
+    return MandelboxDEGrad<DEMath>( p, params, pGrad );
+}
+
+#endif // FRACDE_H
@@ -0,0 +1,643 @@
+//--------------------------------------------------------------------------------------
+// File: headless.cpp
+//
+// Command line driver for batch rendering with the CPU renderer (no window, no GPU).
+//
+// Usage: frac.exe -headless [options]
+//   -fractal:mandelbulb|mandelbox   fractal to render (default mandelbulb)
+//   -width:N -height:N              image size (default 640x480)
+//   -eye:x,y,z -at:x,y,z            camera (default eye 3,0,0 looking at the origin)
+//   -view:file                      use a view captured from the interactive app instead
+//   -frames:N -orbit:degrees        render N frames orbiting the camera around the y axis
+//   -threads:N                      worker threads (default: all hardware threads)
+//   -threadstats                    print per-thread busy/idle time after every frame
+//   -nobalance                      fixed size tiles instead of sizing and ordering them by
+//                                   the previous frame's step counts
+//   -tilecosts:file.csv             write predicted vs actual steps per tile of every frame
+//   -reproject                      start rays at the previous frame's reprojected hits
+//   -cone                           start rays after a cone marching pre-pass
+//   -bundles                        march 8x8 pixel bundles together through empty space
+//   -wavefront                      march and shade the rays of a tile through queues that
+//                                   keep the SIMD lanes full
+//   -lanestats                      print the SIMD lane utilization after every frame
+//   -cache[:N]                      march shadow rays through a brick map of the DE with N^3
+//                                   cells (default 128) where they are far from the surface;
+//                                   the first frame is also rendered without it to compare
+//   -nosymmetry                     cache the whole cube instead of the fundamental domain
+//                                   of the fractal's symmetries
+//   -cachefile:file                 page the bricks of the cache from file, building it there
+//                                   first if it doesn't exist
+//   -cachebudget:MB                 memory the paged bricks may take (default 64)
+//   -prefetch                       page in the bricks ahead of the camera's extrapolated
+//                                   path before every frame; a frame of -orbit counts as
+//                                   1/30 s of camera motion
+//   -mesh:file.sdkmesh              extract the surface DE = iso with dual contouring on all
+//                                   threads, write it as .sdkmesh and exit
+//   -meshcells:N                    cells along each side of the grid (default 256)
+//   -meshiso:f                      iso value (default: the size of a cell)
+//   -footprint                      hit epsilon from the pixel footprint and iteration LOD
+//                                   instead of the global epsilon from the DE at the eye
+//   -refine:f                       march to f times the hit epsilon, then refine the hit with
+//                                   secant/bisection steps; the first frame is compared with
+//                                   the same loose epsilon without refinement and the plain march.
+//                                   An experiment, not a speedup: the plain march reaches a
+//                                   lower error in about the same steps
+//   -relax:k                        over-relaxed sphere tracing with step k * DE, 1 <= k < 2;
+//                                   the first frame is also rendered with k = 1 to compare
+//   -scalar                         use the scalar reference distance estimator only
+//   -fdnormals                      normals from forward differences as in the shaders
+//                                   instead of the dual number gradient (for -reference)
+//   -kernel:trig|triplex            mandelbulb iteration (default trig, as in the shader)
+//   -fastmath                       packet DEs with the fast vmath.h functions; the first
+//                                   frame is also rendered with the precise ones to compare
+//   -power:N                        mandelbulb power, 2 to 16 (default 8, as in the shader)
+//   -scale:f -boxfold:x,y,z         mandelbox parameters (defaults as in MandelboxPS.hlsl:
+//   -spherefold:f -iterations:N      scale 9, boxfold 1,1,1, spherefold 0.2, 4 iterations)
+//   -destats[:N]                    print DE kernel accuracy/speed on N points and exit
+//   -mathstats[:N]                  print vmath.h accuracy against libm on N arguments and exit
+//   -out:prefix                     output files are <prefix>_0000.bmp, ... (default frac)
+//   -reference:file.bmp             compare the first frame against a GPU capture
+//
+// The kernels are the widest build the CPU supports; set FRAC_ISA to sse2, sse4.2, avx2
+// or avx512 to force a narrower one.
+//--------------------------------------------------------------------------------------
+#include "headless.h"
+#include "cpurender.h"
+#include "cpukernels.h"
+#include "cpude.h"
+#include "distcache.h"
+#include "cameraprefetch.h"
+#include "meshextract.h"
+#include "destats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <wctype.h>
+
+static std::vector<std::wstring> SplitCommandLine( const wchar_t* szCmdLine )
+{
+    std::vector<std::wstring> args;
+    std::wstring cur;
+    bool bQuoted = false;
+    for( const wchar_t* p = szCmdLine; p && *p; ++p )
+    {
+        if( *p == L'"' )
+            bQuoted = !bQuoted;
+        else if( iswspace( *p ) && !bQuoted )
+        {
+            if( !cur.empty() ) args.push_back( cur );
+            cur.clear();
+        }
+        else
+            cur += *p;
+    }
+    if( !cur.empty() ) args.push_back( cur );
+    return args;
+}
+
+// Case insensitive match of "-name" or "/name"; on success *pszValue points past "name:"
+static bool IsArg( const std::wstring& arg, const wchar_t* szName, const wchar_t** pszValue = NULL )
+{
+    if( arg.size() < 2 || ( arg[0] != L'-' && arg[0] != L'/' ) )
+        return false;
+    const wchar_t* p = arg.c_str() + 1;
+    for( ; *szName; ++szName, ++p )
+        if( towlower( *p ) != towlower( *szName ) )
+            return false;
+    if( *p == L':' )
+    {
+        if( pszValue ) *pszValue = p + 1;
+        return pszValue != NULL;
+    }
+    return *p == 0 && pszValue == NULL;
+}
+
+static bool ParseFloat3( const wchar_t* sz, float3* pV )
+{
+    return swscanf( sz, L"%f,%f,%f", &pV->x, &pV->y, &pV->z ) == 3;
+}
+
+bool IsHeadlessCommandLine( const wchar_t* szCmdLine )
+{
+    std::vector<std::wstring> args = SplitCommandLine( szCmdLine );
+    for( size_t i = 0; i < args.size(); ++i )
+        if( IsArg( args[i], L"headless" ) )
+            return true;
+    return false;
+}
+
+static void CompareImages( const CpuImage& a, const CpuImage& b )
+{
+    if( a.Width != b.Width || a.Height != b.Height )
+    {
+        wprintf( L"reference: size mismatch (%ux%u vs %ux%u)\n", a.Width, a.Height, b.Width, b.Height );
+        return;
+    }
+
+    unsigned int nMax = 0;
+    size_t nBad = 0;
+    double fSum = 0, fSumSq = 0;
+    for( size_t i = 0; i < a.Pixels.size(); ++i )
+    {
+        unsigned int nPixelMax = 0;
+        for( int c = 0; c < 3; ++c )
+        {
+            int d = abs( ( int )( ( a.Pixels[i] >> ( 8 * c ) ) & 0xff ) - ( int )( ( b.Pixels[i] >> ( 8 * c ) ) & 0xff ) );
+            fSum += d;
+            fSumSq += d * d;
+            if( ( unsigned int )d > nPixelMax ) nPixelMax = d;
+        }
+        if( nPixelMax > nMax ) nMax = nPixelMax;
+        if( nPixelMax > 2 ) ++nBad;
+    }
+    double n = 3.0 * a.Pixels.size();
+    wprintf( L"reference: max %u, mean %.4f, rmse %.4f, %.3f%% pixels off by more than 2/255\n",
+             nMax, fSum / n, sqrt( fSumSq / n ), 100.0 * nBad / a.Pixels.size() );
+}
+
+// Busy/idle time per thread; efficiency is total busy time over threads * frame time
+static void PrintThreadStats( const std::vector<TileThreadStats>& stats )
+{
+    double fBusy = 0, fMinBusy = 1e30, fMaxBusy = 0;
+    unsigned int nTiles = 0, nStolen = 0;
+    for( size_t i = 0; i < stats.size(); ++i )
+    {
+        const TileThreadStats& s = stats[i];
+        wprintf( L"  thread %3u: busy %8.2f ms, idle %7.2f ms, %5u tiles (%u stolen)\n",
+                 ( unsigned int )i, s.fBusyMs, s.fIdleMs, s.nTiles, s.nStolen );
+        fBusy += s.fBusyMs;
+        if( s.fBusyMs < fMinBusy ) fMinBusy = s.fBusyMs;
+        if( s.fBusyMs > fMaxBusy ) fMaxBusy = s.fBusyMs;
+        nTiles += s.nTiles;
+        nStolen += s.nStolen;
+    }
+    double fFrame = stats.empty() ? 0 : stats[0].fBusyMs + stats[0].fIdleMs;
+    wprintf( L"  %u threads: busy min %.2f / avg %.2f / max %.2f ms, %u of %u tiles stolen, efficiency %.1f%%\n",
+             ( unsigned int )stats.size(), fMinBusy, fBusy / stats.size(), fMaxBusy, nStolen, nTiles,
+             fFrame > 0 ? 100.0 * fBusy / ( fFrame * stats.size() ) : 0.0 );
+}
+
+// Share of the SIMD lanes of the packet DE calls that carried a ray still marching; "-"
+// where there were none (scalar shading, or no shadow rays)
+static void PrintLaneStats( const CpuLaneStats& stats )
+{
+    static const wchar_t* s_szQueue[LQ_COUNT] = { L"primary", L"shadow", L"samples" };
+    wprintf( L"  lane utilization:" );
+    for( int q = 0; q < LQ_COUNT; ++q )
+    {
+        const CpuLaneCount& c = stats.Queue[q];
+        if( c.nLanes > 0 )
+            wprintf( L" %ls %.1f%% of %.2fM", s_szQueue[q], 100.0 * c.nActive / c.nLanes, c.nLanes / 1e6 );
+        else
+            wprintf( L" %ls -", s_szQueue[q] );
+    }
+    wprintf( L"\n" );
+}
+
+// Appends the tiles of one frame to a CSV file and prints how well they were predicted
+static bool WriteTileCosts( FILE* pFile, unsigned int iFrame, const std::vector<TileCost>& tiles )
+{
+    double fPredicted = 0, fActual = 0, fError = 0;
+    bool bOK = true;
+    for( size_t i = 0; i < tiles.size() && bOK; ++i )
+    {
+        const TileCost& t = tiles[i];
+        bOK = fprintf( pFile, "%u,%u,%u,%u,%u,%.0f,%.0f\n", iFrame, t.x, t.y, t.w, t.h, t.fPredicted, t.fActual ) > 0;
+        fPredicted += t.fPredicted;
+        fActual += t.fActual;
+        fError += fabs( t.fPredicted - t.fActual );
+    }
+    if( fPredicted > 0 )
+        wprintf( L"  %u tiles, predicted %.0f steps, actual %.0f, per-tile error %.1f%%\n",
+                 ( unsigned int )tiles.size(), fPredicted, fActual, fActual > 0 ? 100.0 * fError / fActual : 0.0 );
+    return bOK;
+}
+
+// Primary ray DE evaluations of the last frame per pixel
+static double MeanSteps( const CCpuRenderer& renderer, unsigned int nPixels )
+{
+    double fSteps = 0;
+    const std::vector<TileCost>& tiles = renderer.GetTileCosts();
+    for( size_t i = 0; i < tiles.size(); ++i )
+        fSteps += tiles[i].fActual;
+    return fSteps / nPixels;
+}
+
+// Mean absolute difference per 8 bit channel
+static double ImageError( const CpuImage& a, const CpuImage& b, unsigned int* pnDiff )
+{
+    *pnDiff = 0;
+    double fError = 0;
+    for( size_t i = 0; i < a.Pixels.size(); ++i )
+    {
+        if( a.Pixels[i] == b.Pixels[i] )
+            continue;
+        ++*pnDiff;
+        for( int c = 0; c < 24; c += 8 )
+            fError += abs( ( int )( ( a.Pixels[i] >> c ) & 0xff ) - ( int )( ( b.Pixels[i] >> c ) & 0xff ) );
+    }
+    return fError / ( 3.0 * a.Pixels.size() );
+}
+
+// Renders the frame with a variation of the view on pOther, a second renderer set up like
+// the main one so the main one's cost map and history are not disturbed, and prints its
+// time, step count and how much its image differs from reference
+static void PrintComparison( const wchar_t* szLabel, CCpuRenderer* pOther, const CpuView& view, FRACTAL_TYPE eFractal,
+                             const CpuImage& reference, CpuImage* pImage = NULL )
+{
+    CpuImage image;
+    if( !pImage ) pImage = &image;
+    pImage->Resize( reference.Width, reference.Height );
+    std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+    pOther->Render( view, eFractal, pImage );
+    std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+
+    unsigned int nDiff;
+    double fError = ImageError( *pImage, reference, &nDiff );
+    wprintf( L"  %ls: %.1f ms, %.1f steps/ray, %u pixels differ, mean error %.3f\n", szLabel,
+             std::chrono::duration<double, std::milli>( t1 - t0 ).count(),
+             MeanSteps( *pOther, pImage->Width * pImage->Height ), nDiff, fError );
+}
+
+// Epsilon of ray_marching scaled by f (it is linear in pixelSize and quadratic in dist)
+static CpuView ScaleEpsilon( CpuView view, float f )
+{
+    if( view.pixelSize > 0 )
+        view.pixelSize *= f;
+    else
+        view.dist *= sqrtf( f );
+    return view;
+}
+
+int RunHeadless( const wchar_t* szCmdLine )
+{
+    FRACTAL_TYPE eFractal = FT_MANDELBULB;
+    unsigned int nWidth = 640, nHeight = 480, nFrames = 1, nThreads = 0;
+    float fOrbit = 0, fRelax = 1, fRefine = 0;
+    bool bScalar = false, bFastMath = false, bFDNormals = false, bThreadStats = false, bBalance = true, bReproject = false, bCone = false, bBundles = false, bWavefront = false, bLaneStats = false,
+         bFootprint = false;
+    DE_KERNEL eKernel = DK_TRIG;
+    int nPower = MANDELBULB_DEFAULT_POWER;
+    float fScale = 9, fSphereFold = 0.2f;
+    float3 vBoxFold( 1, 1, 1 );
+    int nIterations = 4;
+    unsigned int nCacheCells = 0;
+    bool bCacheSymmetry = true;
+    unsigned int nCacheBudget = 64;
+    bool bPrefetch = false;
+    unsigned int nMeshCells = 256;
+    float fMeshIso = 0;
+    float3 vEye( 3.0f, 0.0f, 0.0f ), vAt( 0.0f, 0.0f, 0.0f );
+    std::wstring strOut = L"frac", strView, strReference, strTileCosts, strCacheFile, strMesh;
+
+    std::vector<std::wstring> args = SplitCommandLine( szCmdLine );
+    for( size_t i = 0; i < args.size(); ++i )
+    {
+        const wchar_t* szValue = NULL;
+        bool bOK = true;
+        if( IsArg( args[i], L"headless" ) )
+            continue;
+        else if( IsArg( args[i], L"scalar" ) ) bScalar = true;
+        else if( IsArg( args[i], L"fastmath" ) ) bFastMath = true;
+        else if( IsArg( args[i], L"fdnormals" ) ) bFDNormals = true;
+        else if( IsArg( args[i], L"threadstats" ) ) bThreadStats = true;
+        else if( IsArg( args[i], L"lanestats" ) ) bLaneStats = true;
+        else if( IsArg( args[i], L"wavefront" ) ) bWavefront = true;
+        else if( IsArg( args[i], L"nobalance" ) ) bBalance = false;
+        else if( IsArg( args[i], L"reproject" ) ) bReproject = true;
+        else if( IsArg( args[i], L"cone" ) ) bCone = true;
+        else if( IsArg( args[i], L"bundles" ) ) bBundles = true;
+        else if( IsArg( args[i], L"footprint" ) ) bFootprint = true;
+        else if( IsArg( args[i], L"cache" ) ) nCacheCells = 128;
+        else if( IsArg( args[i], L"nosymmetry" ) ) bCacheSymmetry = false;
+        else if( IsArg( args[i], L"cache", &szValue ) )
+        {
+            nCacheCells = wcstoul( szValue, NULL, 10 );
+            bOK = nCacheCells > 0;
+        }
+        else if( IsArg( args[i], L"cachefile", &szValue ) ) strCacheFile = szValue;
+        else if( IsArg( args[i], L"prefetch" ) ) bPrefetch = true;
+        else if( IsArg( args[i], L"cachebudget", &szValue ) )
+        {
+            nCacheBudget = wcstoul( szValue, NULL, 10 );
+            bOK = nCacheBudget > 0;
+        }
+        else if( IsArg( args[i], L"mesh", &szValue ) ) strMesh = szValue;
+        else if( IsArg( args[i], L"meshcells", &szValue ) )
+        {
+            nMeshCells = wcstoul( szValue, NULL, 10 );
+            bOK = nMeshCells > 0;
+        }
+        else if( IsArg( args[i], L"meshiso", &szValue ) )
+        {
+            fMeshIso = ( float )wcstod( szValue, NULL );
+            bOK = fMeshIso > 0;
+        }
+        else if( IsArg( args[i], L"tilecosts", &szValue ) ) strTileCosts = szValue;
+        else if( IsArg( args[i], L"destats" ) || IsArg( args[i], L"destats", &szValue ) )
+        {
+            PrintDEStats( szValue ? wcstoul( szValue, NULL, 10 ) : 1 << 20 );
+            return 0;
+        }
+        else if( IsArg( args[i], L"mathstats" ) || IsArg( args[i], L"mathstats", &szValue ) )
+        {
+            PrintMathStats( szValue ? wcstoul( szValue, NULL, 10 ) : 1 << 22 );
+            return 0;
+        }
+        else if( IsArg( args[i], L"kernel", &szValue ) )
+        {
+            std::wstring s = szValue;
+            if( s == L"trig" ) eKernel = DK_TRIG;
+            else if( s == L"triplex" ) eKernel = DK_TRIPLEX;
+            else bOK = false;
+        }
+        else if( IsArg( args[i], L"power", &szValue ) )
+        {
+            nPower = ( int )wcstol( szValue, NULL, 10 );
+            bOK = nPower >= MANDELBULB_MIN_POWER && nPower <= MANDELBULB_MAX_POWER;
+        }
+        else if( IsArg( args[i], L"fractal", &szValue ) )
+        {
+            std::wstring s = szValue;
+            if( s == L"mandelbulb" ) eFractal = FT_MANDELBULB;
+            else if( s == L"mandelbox" ) eFractal = FT_MANDELBOX;
+            else bOK = false;
+        }
+        else if( IsArg( args[i], L"scale", &szValue ) ) fScale = ( float )wcstod( szValue, NULL );
+        else if( IsArg( args[i], L"boxfold", &szValue ) ) bOK = ParseFloat3( szValue, &vBoxFold );
+        else if( IsArg( args[i], L"spherefold", &szValue ) ) fSphereFold = ( float )wcstod( szValue, NULL );
+        else if( IsArg( args[i], L"iterations", &szValue ) ) nIterations = ( int )wcstol( szValue, NULL, 10 );
+        else if( IsArg( args[i], L"width", &szValue ) ) nWidth = wcstoul( szValue, NULL, 10 );
+        else if( IsArg( args[i], L"height", &szValue ) ) nHeight = wcstoul( szValue, NULL, 10 );
+        else if( IsArg( args[i], L"frames", &szValue ) ) nFrames = wcstoul( szValue, NULL, 10 );
+        else if( IsArg( args[i], L"threads", &szValue ) ) nThreads = wcstoul( szValue, NULL, 10 );
+        else if( IsArg( args[i], L"orbit", &szValue ) ) fOrbit = ( float )wcstod( szValue, NULL );
+        else if( IsArg( args[i], L"refine", &szValue ) )
+        {
+            fRefine = ( float )wcstod( szValue, NULL );
+            bOK = fRefine >= 1;
+        }
+        else if( IsArg( args[i], L"relax", &szValue ) )
+        {
+            fRelax = ( float )wcstod( szValue, NULL );
+            bOK = fRelax >= 1 && fRelax < 2;
+        }
+        else if( IsArg( args[i], L"eye", &szValue ) ) bOK = ParseFloat3( szValue, &vEye );
+        else if( IsArg( args[i], L"at", &szValue ) ) bOK = ParseFloat3( szValue, &vAt );
+        else if( IsArg( args[i], L"out", &szValue ) ) strOut = szValue;
+        else if( IsArg( args[i], L"view", &szValue ) ) strView = szValue;
+        else if( IsArg( args[i], L"reference", &szValue ) ) strReference = szValue;
+        // Anything else is left for DXUT (e.g. -forceapi) and ignored here
+
+        if( !bOK || nWidth == 0 || nHeight == 0 )
+        {
+            wprintf( L"invalid argument: %ls\n", args[i].c_str() );
+            return 1;
+        }
+    }
+
+    CpuView view;
+    if( !strView.empty() && !LoadCpuView( strView.c_str(), &view ) )
+    {
+        wprintf( L"failed to load view %ls\n", strView.c_str() );
+        return 1;
+    }
+
+    MandelboxParams boxParams = MakeMandelboxParams( fScale, vBoxFold, fSphereFold, nIterations );
+    // The camera distance uses the trig kernel of the shaders whatever the renderer uses
+    CpuFractal fractal = MakeCpuFractal( eFractal );
+    fractal.nPower = nPower;
+    fractal.Mandelbox = boxParams;
+    if( !strMesh.empty() )
+    {
+        // The DE at a cell's size away is smooth enough to contour, the fractal itself isn't
+        CpuFractal meshed = fractal;
+        meshed.eKernel = eKernel;
+        meshed.bFastMath = bFastMath;
+        const float fExtent = GetDistanceCacheExtent( meshed );
+        FractalMesh mesh;
+        MeshExtractStats stats;
+        if( !ExtractMesh( meshed, fExtent, nMeshCells, ( fMeshIso > 0 ) ? fMeshIso : 2 * fExtent / nMeshCells, nThreads,
+                          &mesh, &stats ) )
+        {
+            wprintf( L"mesh too large\n" );
+            return 1;
+        }
+        wprintf( L"Mesh: %u^3 cells, %u of %u blocks active, %.2fM DE samples, %u vertices (%u shared, %u overflowed), "
+                 L"%u triangles in %.0f ms\n", nMeshCells, stats.nActiveBlocks, stats.nBlocks, stats.nSamples / 1e6,
+                 ( unsigned int )mesh.Vertices.size(), ( unsigned int )stats.nSharedVertices,
+                 ( unsigned int )stats.nOverflow, ( unsigned int )( mesh.Indices.size() / 3 ), stats.fMs );
+        if( !SaveSDKMesh( strMesh.c_str(), mesh ) )
+        {
+            wprintf( L"failed to write %ls\n", strMesh.c_str() );
+            return 1;
+        }
+        return 0;
+    }
+    auto Configure = [&]( CCpuRenderer& r )
+    {
+        r.SetThreadCount( nThreads );
+        r.SetPacketDE( !bScalar );
+        r.SetFastMath( bFastMath );
+        r.SetAnalyticNormals( !bFDNormals );
+        r.SetCostBalancing( bBalance );
+        r.SetTemporalReprojection( bReproject );
+        r.SetConePrepass( bCone );
+        r.SetBundleMarching( bBundles );
+        r.SetWavefront( bWavefront );
+        r.SetMandelbulbKernel( eKernel );
+        r.SetMandelbulbPower( nPower );
+        r.SetMandelboxParams( boxParams );
+    };
+    CCpuRenderer renderer;
+    Configure( renderer );
+    wprintf( L"CPU kernels: %ls\n", GetCpuKernelsInfo() );
+
+    CDistanceCache cache;
+    if( !strCacheFile.empty() && nCacheCells == 0 )
+        nCacheCells = 128;
+    if( nCacheCells > 0 )
+    {
+        CpuFractal cached = fractal;
+        cached.eKernel = eKernel;
+        cached.bFastMath = bFastMath;
+        std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+        size_t nSamples = 0;
+        if( strCacheFile.empty() )
+        {
+            cache.Build( cached, GetDistanceCacheExtent( cached ), nCacheCells, bCacheSymmetry );
+            nSamples = cache.GetBuildSamples();
+        }
+        else if( !cache.Open( strCacheFile.c_str(), ( size_t )nCacheBudget << 20 ) )
+        {
+            // Not there yet (or not a cache file): build it
+            bool bBuilt = cache.BuildFile( strCacheFile.c_str(), cached, GetDistanceCacheExtent( cached ), nCacheCells,
+                                           bCacheSymmetry );
+            nSamples = cache.GetBuildSamples();
+            if( !bBuilt || !cache.Open( strCacheFile.c_str(), ( size_t )nCacheBudget << 20 ) )
+            {
+                wprintf( L"failed to write %ls\n", strCacheFile.c_str() );
+                return 1;
+            }
+        }
+        std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+        nCacheCells = cache.GetCellCount();
+        wprintf( L"Distance cache: %u^3 cells, %d-fold symmetry (%u cells sampled), %u bricks, %.1f MB%ls, "
+                 L"%.2fM DE samples in %.0f ms\n", nCacheCells, GetSymmetryOrder( cache.GetSymmetry() ),
+                 ( unsigned int )cache.GetDomainCellCount(), cache.GetBrickCount(), cache.GetMemorySize() / 1048576.0,
+                 cache.IsPaged() ? L" + paged bricks" : L"", nSamples / 1e6,
+                 std::chrono::duration<double, std::milli>( t1 - t0 ).count() );
+        renderer.SetDistanceCache( &cache );
+    }
+    CCameraPrefetcher prefetcher;
+    if( bPrefetch )
+    {
+        prefetcher.SetCache( &cache );
+        prefetcher.SetProjection( 3.14159265f / 4, nWidth / ( float )nHeight );
+    }
+    BrickPagerStats lastStats = cache.GetPagerStats();
+
+    CpuImage image;
+    image.Resize( nWidth, nHeight );
+
+    FILE* pTileCosts = NULL;
+    if( !strTileCosts.empty() )
+    {
+        pTileCosts = OpenFileW( strTileCosts.c_str(), L"wt" );
+        if( !pTileCosts )
+        {
+            wprintf( L"failed to write %ls\n", strTileCosts.c_str() );
+            return 1;
+        }
+        fprintf( pTileCosts, "frame,x,y,w,h,predicted,actual\n" );
+    }
+
+    int nResult = 0;
+    for( unsigned int iFrame = 0; iFrame < nFrames; ++iFrame )
+    {
+        if( strView.empty() )
+        {
+            // Orbit around the y axis through the look-at point
+            float a = fOrbit * iFrame * 3.14159265f / 180.0f;
+            float3 d = vEye - vAt;
+            float3 eye = vAt + float3( d.x * cosf( a ) - d.z * sinf( a ), d.y, d.x * sinf( a ) + d.z * cosf( a ) );
+            float dist = EvaluateDE( fractal, eye );
+            BuildCpuView( eye, vAt, 3.14159265f / 4, nWidth / ( float )nHeight, 0.1f, 5000.0f, dist, &view );
+        }
+        // A view loaded from a capture keeps the factor it was rendered with unless overridden
+        if( fRelax > 1 )
+            view.relax = fRelax;
+        if( fRefine > 0 )
+            view.refine = fRefine;
+        if( bFootprint )
+            view.pixelSize = 2 / ( view.mProj.m[1][1] * nHeight );
+
+        if( bPrefetch )
+        {
+            Ray ahead;
+            GetRay( view, 0.5f, 0.5f, &ahead );
+            prefetcher.FrameMove( ahead.pos, ahead.dir, 1.0f / 30 );
+        }
+
+        std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+        renderer.Render( view, eFractal, &image );
+        std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+
+        wchar_t szFile[512];
+        swprintf( szFile, 512, L"%ls_%04u.bmp", strOut.c_str(), iFrame );
+        if( !SaveBMP( szFile, image ) )
+        {
+            wprintf( L"failed to write %ls\n", szFile );
+            nResult = 1;
+            break;
+        }
+        const std::vector<TileCost>& tiles = renderer.GetTileCosts();
+        double fSteps = MeanSteps( renderer, nWidth * nHeight );
+        wprintf( L"%ls: %.1f ms, %.1f steps/ray", szFile, std::chrono::duration<double, std::milli>( t1 - t0 ).count(),
+                 fSteps );
+        if( bCone || bBundles )
+            wprintf( L" + %.2f cone steps/pixel", renderer.GetConeSteps() / ( ( double )nWidth * nHeight ) );
+        if( nCacheCells > 0 )
+            wprintf( L" + %.2f cache steps/pixel", renderer.GetCacheSteps() / ( ( double )nWidth * nHeight ) );
+        wprintf( L"\n" );
+        if( cache.IsPaged() )
+        {
+            // Of this frame; misses are the Locks the render threads waited in
+            const BrickPagerStats stats = cache.GetPagerStats();
+            wprintf( L"  bricks: %llu hits, %llu misses, %llu prefetched, %llu evicted, %.1f MB mapped\n",
+                     stats.nHits - lastStats.nHits, stats.nMisses - lastStats.nMisses,
+                     stats.nPrefetched - lastStats.nPrefetched, stats.nEvicted - lastStats.nEvicted,
+                     stats.nResident / 1048576.0 );
+            lastStats = stats;
+        }
+        if( iFrame == 0 && view.relax > 1 )
+        {
+            CCpuRenderer other;
+            Configure( other );
+            CpuView plain = view;
+            plain.relax = 1;
+            PrintComparison( L"k = 1", &other, plain, eFractal, image );
+        }
+        if( iFrame == 0 && nCacheCells > 0 )
+        {
+            CCpuRenderer other;
+            Configure( other );
+            PrintComparison( L"no cache", &other, view, eFractal, image );
+        }
+        if( iFrame == 0 && bFastMath )
+        {
+            CCpuRenderer other;
+            Configure( other );
+            other.SetFastMath( false );
+            PrintComparison( L"precise math", &other, view, eFractal, image );
+        }
+        if( iFrame == 0 && view.refine > 0 )
+        {
+            // Shading is very sensitive to the exact hit point on this surface, so the
+            // errors are measured against a plain march with a 16x finer epsilon
+            CCpuRenderer other;
+            Configure( other );
+            CpuView plain = view;
+            plain.refine = 0;
+            CpuImage reference;
+            reference.Resize( image.Width, image.Height );
+            other.Render( ScaleEpsilon( plain, 1.0f / 16 ), eFractal, &reference );
+            wprintf( L"  errors against a plain march with epsilon / 16 (%.1f steps/ray):\n",
+                     MeanSteps( other, reference.Width * reference.Height ) );
+            unsigned int nDiff;
+            double fError = ImageError( image, reference, &nDiff );
+            wprintf( L"  refined: %.1f steps/ray, %u pixels differ, mean error %.3f\n", fSteps, nDiff, fError );
+            PrintComparison( L"loose, no refinement", &other, ScaleEpsilon( plain, view.refine ), eFractal, reference );
+            PrintComparison( L"plain", &other, plain, eFractal, reference );
+            PrintComparison( L"plain, epsilon / 4", &other, ScaleEpsilon( plain, 0.25f ), eFractal, reference );
+        }
+        if( bThreadStats )
+            PrintThreadStats( renderer.GetThreadStats() );
+        if( bLaneStats )
+            PrintLaneStats( renderer.GetLaneStats() );
+        if( pTileCosts && !WriteTileCosts( pTileCosts, iFrame, tiles ) )
+        {
+            wprintf( L"failed to write %ls\n", strTileCosts.c_str() );
+            nResult = 1;
+            break;
+        }
+
+        if( iFrame == 0 && !strReference.empty() )
+        {
+            CpuImage reference;
+            if( !LoadBMP( strReference.c_str(), &reference ) )
+            {
+                wprintf( L"failed to load reference %ls\n", strReference.c_str() );
+                nResult = 1;
+                break;
+            }
+            CompareImages( image, reference );
+        }
+    }
+
+    if( pTileCosts )
+        fclose( pTileCosts );
+    return nResult;
+}
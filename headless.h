@@ -0,0 +1,16 @@
+//--------------------------------------------------------------------------------------
+// File: headless.h
+//
+// Command line driver for batch rendering with the CPU renderer (no window, no GPU).
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+// True if the command line asks for headless rendering (-headless)
+bool IsHeadlessCommandLine( const wchar_t* szCmdLine );
+
+// Renders the frames described by the command line, returns the process exit code
+int RunHeadless( const wchar_t* szCmdLine );
+
+#endif // HEADLESS_H
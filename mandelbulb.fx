@@ -0,0 +1,77 @@
+//--------------------------------------------------------------------------------------
+// File: mandelbulb.fx
+//
+// Mandelbulb distance estimator and shading, shared by the pixel shader and the
+// compute shader path.
+//
+//--------------------------------------------------------------------------------------
+
+// MandelbulbDE<T> in fracde.h is the CPU version of this function, change both together
+float DE(float3 p, int iterations)
+{
+  float3 c = p;
+  float r = length(c);
+  float dr = 1;
+  for (int i = 0; i < iterations && r < 3; ++i)
+  {
+    float r2 = r * r;
+    float xr = r2 * r2 * r2 * r; // pow(r, 7)
+    dr = 6 * xr * dr + 1;
+  
+    float theta = atan2(c.y, c.x) * 8;
+    float phi = asin(c.z / r) * 8;
+    r = xr * r;
+    float st, ct, sp, cp;
+    sincos(theta, st, ct);
+    sincos(phi, sp, cp);
+    c = r * float3(cp * ct, cp * st, sp);
+   
+    c += p;
+    r = length(c);
+  }
+  return 0.35 * log(r) * r / dr;
+}
+
+float DE(float3 p)
+{
+  return DE(p, 4);
+}
+
+// Iteration LOD, see MandelbulbLodIterations in fracde.h
+float DELod(float3 p, float eps)
+{
+  return DE(p, eps < 0.0035 ? 4 : eps < 0.009 ? 3 : 2);
+}
+
+// DE stops iterating at r >= 3 and is > 1 there, see raymarch.fx
+static const float BoundRadius = 3;
+
+#include "raymarch.fx"
+
+float4 shade(Ray ray)
+{
+  float4 rm = ray_marching(ray);
+  if (rm.w < 0) return float4(0, 0, 0, 0);
+  
+  float3 p = rm.xyz;
+  float k = DE(p);
+  float gx = DE(p + float3(1e-5, 0, 0)) - k;
+  float gy = DE(p + float3(0, 1e-5, 0)) - k;
+  float gz = DE(p + float3(0, 0, 1e-5)) - k;
+  float3 N = normalize(float3(gx, gy, gz));
+  
+  float ao = 0;
+  ao += DE(p + 0.1 * N) * 2.5;
+  ao += DE(p + 0.2 * N) * 1.0;
+
+  float3 L = normalize(float3(-1, 1, 2));
+  ray.pos = p + N * 0.01;
+  ray.dir = L;
+  float4 S = ray_marching(ray);
+  float3 C = lerp(float3(0.6, 0.8, 0.6), float3(1.0, 0.0, 0.0), rm.w / 64);
+  float D = 0.7 * (S.w < 0 ? 1 : 0);
+  
+  float A = 0.1;
+  float3 col = (A + D * saturate(dot(L, N))) * ao * C;
+  return float4(col , 1);
+}
@@ -0,0 +1,686 @@
+//--------------------------------------------------------------------------------------
+// File: meshextract.cpp
+//
+// Dual contouring of the DE and .sdkmesh output, see meshextract.h.
+//--------------------------------------------------------------------------------------
+#include "meshextract.h"
+#include "tilescheduler.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <unordered_map>
+
+// Points per EvaluateDE call of a block task; batches this small run on the calling
+// thread instead of taking turns on the shared pool
+static const size_t SAMPLE_BATCH = 2048;
+
+// Weight of the mass point of the crossings in a vertex's QEF, which keeps the solution
+// in place where the tangent planes are nearly parallel
+static const float MASS_POINT_WEIGHT = 0.05f;
+
+// Slots an insert probes before it gives up on the table for the locked overflow map
+static const unsigned int MAX_PROBES = 64;
+
+static const unsigned long long NO_VALUE = ~0ull;
+
+//--------------------------------------------------------------------------------------
+// Open addressing hash from cell to vertex, filled by all block tasks at once. A key is
+// claimed by a compare-and-swap on its slot, and its value stored right after; a lookup
+// that finds the key before the value spins for the few instructions in between.
+//--------------------------------------------------------------------------------------
+class CSharedVertexHash
+{
+public:
+    explicit CSharedVertexHash( size_t nMinCapacity );
+
+    // The value of nKey: nValue if this call inserted it, else the one stored by the call
+    // that did
+    unsigned long long InsertOrFind( unsigned long long nKey, unsigned long long nValue );
+    size_t GetOverflowCount() const { return m_Overflow.size(); }
+
+private:
+    size_t m_nMask;
+    std::unique_ptr<std::atomic<unsigned long long>[]> m_pKeys;     // key + 1, 0 for a free slot
+    std::unique_ptr<std::atomic<unsigned long long>[]> m_pValues;   // NO_VALUE until stored
+    std::mutex m_OverflowLock;
+    std::unordered_map<unsigned long long, unsigned long long> m_Overflow;
+};
+
+CSharedVertexHash::CSharedVertexHash( size_t nMinCapacity )
+{
+    size_t nCapacity = 4096;
+    while( nCapacity < nMinCapacity )
+        nCapacity *= 2;
+    m_nMask = nCapacity - 1;
+    m_pKeys.reset( new std::atomic<unsigned long long>[nCapacity] );
+    m_pValues.reset( new std::atomic<unsigned long long>[nCapacity] );
+    for( size_t i = 0; i < nCapacity; ++i )
+    {
+        m_pKeys[i].store( 0, std::memory_order_relaxed );
+        m_pValues[i].store( NO_VALUE, std::memory_order_relaxed );
+    }
+}
+
+unsigned long long CSharedVertexHash::InsertOrFind( unsigned long long nKey, unsigned long long nValue )
+{
+    // splitmix64 finalizer: neighbouring cells must not take neighbouring slots
+    unsigned long long h = nKey;
+    h = ( h ^ ( h >> 30 ) ) * 0xbf58476d1ce4e5b9ull;
+    h = ( h ^ ( h >> 27 ) ) * 0x94d049bb133111ebull;
+    h ^= h >> 31;
+
+    // Every caller with the same key walks the same slots, and a slot never frees up, so
+    // they all agree on where the key is, or that it went to the overflow map
+    const unsigned long long nStored = nKey + 1;
+    for( unsigned int i = 0; i < MAX_PROBES; ++i, ++h )
+    {
+        const size_t nSlot = ( size_t )h & m_nMask;
+        unsigned long long nFound = m_pKeys[nSlot].load( std::memory_order_acquire );
+        if( nFound == 0 )
+        {
+            if( m_pKeys[nSlot].compare_exchange_strong( nFound, nStored, std::memory_order_acq_rel ) )
+            {
+                m_pValues[nSlot].store( nValue, std::memory_order_release );
+                return nValue;
+            }
+            // nFound is now the key that took the slot
+        }
+        if( nFound == nStored )
+        {
+            unsigned long long v;
+            while( ( v = m_pValues[nSlot].load( std::memory_order_acquire ) ) == NO_VALUE )
+                std::this_thread::yield();
+            return v;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock( m_OverflowLock );
+    return m_Overflow.insert( std::make_pair( nKey, nValue ) ).first->second;
+}
+
+//--------------------------------------------------------------------------------------
+// Dual contouring
+//--------------------------------------------------------------------------------------
+struct MeshGrid
+{
+    CpuFractal Fractal;
+    float3 vMin;                    // corner of the cube, grid point 0
+    float fCell;
+    float fIso;
+    unsigned int nCells;
+};
+
+struct MeshBlock
+{
+    unsigned int nFirst[3];                 // first cell
+    std::vector<MeshVertex> Vertices;       // the ones the block owns
+    std::vector<unsigned long long> Refs;   // all it uses: owner's slot << 32 | index there
+    std::vector<unsigned int> Indices;      // into Refs
+    size_t nShared;                         // owned vertices on block faces
+};
+
+// Per thread
+struct MeshScratch
+{
+    std::vector<float3> Points;
+    std::vector<float> Samples;
+    std::vector<int> CellVertex;            // into Refs, -1 for none yet
+};
+
+// Gradient of the trilinear interpolation of the corner values d (x in bit 0 of the
+// index, y in bit 1, z in bit 2) at p in the unit cell
+static float3 TrilinearGradient( const float d[8], const float3& p )
+{
+    const float x = p.x, y = p.y, z = p.z;
+    return float3( ( 1 - y ) * ( 1 - z ) * ( d[1] - d[0] ) + y * ( 1 - z ) * ( d[3] - d[2] ) +
+                   ( 1 - y ) * z * ( d[5] - d[4] ) + y * z * ( d[7] - d[6] ),
+                   ( 1 - x ) * ( 1 - z ) * ( d[2] - d[0] ) + x * ( 1 - z ) * ( d[3] - d[1] ) +
+                   ( 1 - x ) * z * ( d[6] - d[4] ) + x * z * ( d[7] - d[5] ),
+                   ( 1 - x ) * ( 1 - y ) * ( d[4] - d[0] ) + x * ( 1 - y ) * ( d[5] - d[1] ) +
+                   ( 1 - x ) * y * ( d[6] - d[2] ) + x * y * ( d[7] - d[3] ) );
+}
+
+// Vertex of a cell the surface crosses, in cells from its low corner: the point closest
+// to the tangent planes at the crossings of its edges (normals from the trilinear
+// gradient), pulled slightly towards their mean and clamped to the cell
+static float3 CellVertex( const float d[8], float fIso )
+{
+    float a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+    float3 b( 0.0f ), vMass( 0.0f );
+    unsigned int nCrossings = 0;
+    for( unsigned int i = 0; i < 8; ++i )
+        for( unsigned int bit = 1; bit < 8; bit <<= 1 )
+        {
+            const unsigned int j = i | bit;
+            if( ( i & bit ) || ( d[i] < fIso ) == ( d[j] < fIso ) )
+                continue;
+            const float t = ( fIso - d[i] ) / ( d[j] - d[i] );
+            const float3 p( ( i & 1 ) ? 1.0f : ( bit == 1 ) ? t : 0.0f,
+                            ( i & 2 ) ? 1.0f : ( bit == 2 ) ? t : 0.0f,
+                            ( i & 4 ) ? 1.0f : ( bit == 4 ) ? t : 0.0f );
+            vMass += p;
+            ++nCrossings;
+            float3 n = TrilinearGradient( d, p );
+            const float l = length( n );
+            if( l == 0 )
+                continue;
+            n *= 1 / l;
+            a00 += n.x * n.x; a01 += n.x * n.y; a02 += n.x * n.z;
+            a11 += n.y * n.y; a12 += n.y * n.z; a22 += n.z * n.z;
+            b += n * dot( n, p );
+        }
+    vMass *= 1.0f / nCrossings;
+
+    // ( A + w I ) x = b + w m. A is positive semidefinite, so the determinant is at least
+    // w^3 and Cramer's rule is safe.
+    const float w = MASS_POINT_WEIGHT;
+    a00 += w; a11 += w; a22 += w;
+    b += vMass * w;
+    const float c00 = a11 * a22 - a12 * a12, c01 = a02 * a12 - a01 * a22, c02 = a01 * a12 - a02 * a11;
+    const float c11 = a00 * a22 - a02 * a02, c12 = a01 * a02 - a00 * a12, c22 = a00 * a11 - a01 * a01;
+    const float fInvDet = 1 / ( a00 * c00 + a01 * c01 + a02 * c02 );
+    const float3 x( ( c00 * b.x + c01 * b.y + c02 * b.z ) * fInvDet, ( c01 * b.x + c11 * b.y + c12 * b.z ) * fInvDet,
+                    ( c02 * b.x + c12 * b.y + c22 * b.z ) * fInvDet );
+    return clamp( x, float3( 0.0f ), float3( 1.0f ) );
+}
+
+// Samples the block's points, from one before its first cell to one past its last, and
+// emits a quad for every crossed edge that starts at one of its own points
+static void ContourBlock( const MeshGrid& grid, unsigned int nSlot, MeshBlock* pBlock, MeshScratch* pScratch,
+                          CSharedVertexHash* pHash )
+{
+    const unsigned int P = MESH_BLOCK + 2;  // points per axis
+    const unsigned int C = MESH_BLOCK + 1;  // cells per axis that can get a vertex
+    const int g0[3] = { ( int )pBlock->nFirst[0] - 1, ( int )pBlock->nFirst[1] - 1, ( int )pBlock->nFirst[2] - 1 };
+    const int N = ( int )grid.nCells;
+
+    std::vector<float3>& points = pScratch->Points;
+    std::vector<float>& samples = pScratch->Samples;
+    points.resize( P * P * P );
+    samples.resize( P * P * P );
+    float3* p = &points[0];
+    for( unsigned int z = 0; z < P; ++z )
+        for( unsigned int y = 0; y < P; ++y )
+            for( unsigned int x = 0; x < P; ++x )
+                *p++ = grid.vMin + float3( ( float )( g0[0] + ( int )x ), ( float )( g0[1] + ( int )y ),
+                                           ( float )( g0[2] + ( int )z ) ) * grid.fCell;
+    for( size_t i = 0; i < points.size(); i += SAMPLE_BATCH )
+        EvaluateDE( grid.Fractal, &points[i], ( points.size() - i < SAMPLE_BATCH ) ? points.size() - i : SAMPLE_BATCH,
+                    &samples[i] );
+    pScratch->CellVertex.assign( C * C * C, -1 );
+
+    // Cells are numbered by their low corner, so cell 0 is the last one of the blocks
+    // below, and cell C - 1 the block's own last one, which the blocks above see as their
+    // cell 0: those two layers are shared
+    pBlock->nShared = 0;
+    auto Vertex = [&]( const unsigned int c[3] ) -> unsigned int
+    {
+        int& nVertex = pScratch->CellVertex[( c[2] * C + c[1] ) * C + c[0]];
+        if( nVertex >= 0 )
+            return ( unsigned int )nVertex;
+
+        const unsigned long long gx = g0[0] + c[0], gy = g0[1] + c[1], gz = g0[2] + c[2];
+        const unsigned long long nOwn = ( ( unsigned long long )nSlot << 32 ) | pBlock->Vertices.size();
+        const bool bShared = c[0] == 0 || c[1] == 0 || c[2] == 0 || c[0] == C - 1 || c[1] == C - 1 || c[2] == C - 1;
+        const unsigned long long nRef = bShared ? pHash->InsertOrFind( ( gz * N + gy ) * N + gx, nOwn ) : nOwn;
+        if( nRef == nOwn )
+        {
+            float d[8];
+            for( unsigned int i = 0; i < 8; ++i )
+                d[i] = samples[( ( c[2] + ( i >> 2 ) ) * P + c[1] + ( ( i >> 1 ) & 1 ) ) * P + c[0] + ( i & 1 )];
+            const float3 v = CellVertex( d, grid.fIso );
+            const float3 n = TrilinearGradient( d, v );
+            const float l = length( n );
+            MeshVertex vertex;
+            vertex.Position = grid.vMin + ( float3( ( float )gx, ( float )gy, ( float )gz ) + v ) * grid.fCell;
+            vertex.Normal = ( l > 0 ) ? n * ( 1 / l ) : float3( 0, 1, 0 );
+            pBlock->Vertices.push_back( vertex );
+            if( bShared )
+                ++pBlock->nShared;
+        }
+        pBlock->Refs.push_back( nRef );
+        nVertex = ( int )pBlock->Refs.size() - 1;
+        return ( unsigned int )nVertex;
+    };
+
+    // Edges from the block's own points; the four cells around one exist if it is off
+    // the faces of the grid
+    for( unsigned int z = 1; z <= MESH_BLOCK; ++z )
+        for( unsigned int y = 1; y <= MESH_BLOCK; ++y )
+            for( unsigned int x = 1; x <= MESH_BLOCK; ++x )
+            {
+                const int g[3] = { g0[0] + ( int )x, g0[1] + ( int )y, g0[2] + ( int )z };
+                if( g[0] >= N || g[1] >= N || g[2] >= N )
+                    continue;
+                const unsigned int nPoint = ( z * P + y ) * P + x;
+                const bool bInside = samples[nPoint] < grid.fIso;
+                const unsigned int nStride[3] = { 1, P, P * P };
+                for( int a = 0; a < 3; ++a )
+                {
+                    const int u = ( a + 1 ) % 3, v = ( a + 2 ) % 3;
+                    if( g[u] == 0 || g[v] == 0 || ( samples[nPoint + nStride[a]] < grid.fIso ) == bInside )
+                        continue;
+
+                    // Around the edge counterclockwise seen from its far end: with the
+                    // inside at the near end that's clockwise seen from outside
+                    unsigned int c[3] = { x, y, z };
+                    const unsigned int v11 = Vertex( c );
+                    --c[u];
+                    const unsigned int v01 = Vertex( c );
+                    --c[v];
+                    const unsigned int v00 = Vertex( c );
+                    ++c[u];
+                    const unsigned int v10 = Vertex( c );
+                    const unsigned int quad[2][6] = { { v00, v11, v10, v00, v01, v11 }, { v00, v10, v11, v00, v11, v01 } };
+                    pBlock->Indices.insert( pBlock->Indices.end(), quad[bInside], quad[bInside] + 6 );
+                }
+            }
+}
+
+bool ExtractMesh( const CpuFractal& fractal, float fExtent, unsigned int nCells, float fIso, unsigned int nThreads,
+                  FractalMesh* pMesh, MeshExtractStats* pStats )
+{
+    std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+    pMesh->Vertices.clear();
+    pMesh->Indices.clear();
+
+    MeshGrid grid;
+    grid.Fractal = fractal;
+    grid.vMin = float3( -fExtent );
+    grid.fCell = 2 * fExtent / nCells;
+    grid.fIso = fIso;
+    grid.nCells = nCells;
+
+    // Blocks whose points are all further from the surface than the DE at the center
+    // says can't hold any of it
+    const unsigned int nBlockAxis = ( nCells + MESH_BLOCK - 1 ) / MESH_BLOCK;
+    const unsigned int nBlocks = nBlockAxis * nBlockAxis * nBlockAxis;
+    std::vector<float3> centers( nBlocks );
+    for( unsigned int i = 0; i < nBlocks; ++i )
+    {
+        const unsigned int b[3] = { i % nBlockAxis, i / nBlockAxis % nBlockAxis, i / nBlockAxis / nBlockAxis };
+        centers[i] = grid.vMin + ( float3( ( float )b[0], ( float )b[1], ( float )b[2] ) * ( float )MESH_BLOCK +
+                                   float3( ( MESH_BLOCK - 1 ) * 0.5f ) ) * grid.fCell;
+    }
+    std::vector<float> de( nBlocks );
+    EvaluateDE( fractal, &centers[0], nBlocks, &de[0] );
+    const float fRadius = 0.5f * sqrtf( 3.0f ) * ( MESH_BLOCK + 1 ) * grid.fCell;
+    std::vector<MeshBlock> blocks;
+    for( unsigned int i = 0; i < nBlocks; ++i )
+        if( de[i] - fIso <= fRadius )
+        {
+            MeshBlock block;
+            block.nFirst[0] = i % nBlockAxis * MESH_BLOCK;
+            block.nFirst[1] = i / nBlockAxis % nBlockAxis * MESH_BLOCK;
+            block.nFirst[2] = i / nBlockAxis / nBlockAxis * MESH_BLOCK;
+            block.nShared = 0;
+            blocks.push_back( block );
+        }
+    const unsigned int nActive = ( unsigned int )blocks.size();
+
+    // A slot for every third cell on the faces between active blocks; the surface of a
+    // fractal crosses many of them, but nowhere near that many
+    CSharedVertexHash hash( ( size_t )nActive * ( MESH_BLOCK + 1 ) * ( MESH_BLOCK + 1 ) );
+    CTileScheduler scheduler;
+    scheduler.SetThreadCount( nThreads );
+    std::vector<MeshScratch> scratch( scheduler.GetThreadCount() );
+    scheduler.Run( nActive, [&]( unsigned int nBlock, unsigned int nThread )
+    {
+        ContourBlock( grid, nBlock, &blocks[nBlock], &scratch[nThread], &hash );
+    } );
+    scratch.clear();
+
+    // Owned vertices go to the mesh block by block; every index is the owner's base plus
+    // the index in the owner
+    std::vector<unsigned long long> base( nActive + 1, 0 ), first( nActive + 1, 0 );
+    size_t nShared = 0;
+    for( unsigned int i = 0; i < nActive; ++i )
+    {
+        base[i + 1] = base[i] + blocks[i].Vertices.size();
+        first[i + 1] = first[i] + blocks[i].Indices.size();
+        nShared += blocks[i].nShared;
+    }
+    bool bOK = base[nActive] <= 0xffffffffull;
+    if( bOK )
+    {
+        pMesh->Vertices.resize( ( size_t )base[nActive] );
+        pMesh->Indices.resize( ( size_t )first[nActive] );
+        scheduler.Run( nActive, [&]( unsigned int nBlock, unsigned int )
+        {
+            MeshBlock& block = blocks[nBlock];
+            std::copy( block.Vertices.begin(), block.Vertices.end(), pMesh->Vertices.begin() + ( size_t )base[nBlock] );
+            unsigned int* pIndex = &pMesh->Indices[0] + first[nBlock];
+            for( size_t i = 0; i < block.Indices.size(); ++i )
+            {
+                const unsigned long long nRef = block.Refs[block.Indices[i]];
+                pIndex[i] = ( unsigned int )( base[nRef >> 32] + ( nRef & 0xffffffffu ) );
+            }
+            std::vector<MeshVertex>().swap( block.Vertices );
+            std::vector<unsigned long long>().swap( block.Refs );
+            std::vector<unsigned int>().swap( block.Indices );
+        } );
+    }
+
+    if( pStats )
+    {
+        pStats->nBlocks = nBlocks;
+        pStats->nActiveBlocks = nActive;
+        pStats->nSamples = nBlocks + ( unsigned long long )nActive * ( MESH_BLOCK + 2 ) * ( MESH_BLOCK + 2 ) * ( MESH_BLOCK + 2 );
+        pStats->nSharedVertices = nShared;
+        pStats->nOverflow = hash.GetOverflowCount();
+        pStats->fMs = std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now() - t0 ).count();
+    }
+    return bOK;
+}
+
+//--------------------------------------------------------------------------------------
+// .sdkmesh output. SDKmesh.h needs the D3D headers, so its structures are mirrored here
+// with the same members; with 8 byte alignment for the 64 bit fields, as MSVC lays them
+// out, the sizes match the ones CDXUTSDKMesh reads.
+//--------------------------------------------------------------------------------------
+static const unsigned int SDKMESH_VERSION = 101;
+static const unsigned int SDKMESH_INVALID = ~0u;
+
+struct SdkMeshHeader
+{
+    unsigned int Version;
+    unsigned char IsBigEndian;
+    unsigned long long HeaderSize;
+    unsigned long long NonBufferDataSize;
+    unsigned long long BufferDataSize;
+    unsigned int NumVertexBuffers;
+    unsigned int NumIndexBuffers;
+    unsigned int NumMeshes;
+    unsigned int NumTotalSubsets;
+    unsigned int NumFrames;
+    unsigned int NumMaterials;
+    unsigned long long VertexStreamHeadersOffset;
+    unsigned long long IndexStreamHeadersOffset;
+    unsigned long long MeshDataOffset;
+    unsigned long long SubsetDataOffset;
+    unsigned long long FrameDataOffset;
+    unsigned long long MaterialDataOffset;
+};
+
+struct SdkVertexElement             // D3DVERTEXELEMENT9
+{
+    unsigned short Stream;
+    unsigned short Offset;
+    unsigned char Type;
+    unsigned char Method;
+    unsigned char Usage;
+    unsigned char UsageIndex;
+};
+
+struct SdkVertexBufferHeader
+{
+    unsigned long long NumVertices;
+    unsigned long long SizeBytes;
+    unsigned long long StrideBytes;
+    SdkVertexElement Decl[32];
+    unsigned long long DataOffset;
+};
+
+struct SdkIndexBufferHeader
+{
+    unsigned long long NumIndices;
+    unsigned long long SizeBytes;
+    unsigned int IndexType;
+    unsigned long long DataOffset;
+};
+
+struct SdkMesh
+{
+    char Name[100];
+    unsigned char NumVertexBuffers;
+    unsigned int VertexBuffers[16];
+    unsigned int IndexBuffer;
+    unsigned int NumSubsets;
+    unsigned int NumFrameInfluences;
+    float BoundingBoxCenter[3];
+    float BoundingBoxExtents[3];
+    unsigned long long SubsetOffset;
+    unsigned long long FrameInfluenceOffset;
+};
+
+struct SdkSubset
+{
+    char Name[100];
+    unsigned int MaterialID;
+    unsigned int PrimitiveType;
+    unsigned long long IndexStart;
+    unsigned long long IndexCount;
+    unsigned long long VertexStart;
+    unsigned long long VertexCount;
+};
+
+struct SdkFrame
+{
+    char Name[100];
+    unsigned int Mesh;
+    unsigned int ParentFrame;
+    unsigned int ChildFrame;
+    unsigned int SiblingFrame;
+    float Matrix[16];
+    unsigned int AnimationDataIndex;
+};
+
+struct SdkMaterial
+{
+    char Name[100];
+    char MaterialInstancePath[260];
+    char DiffuseTexture[260];
+    char NormalTexture[260];
+    char SpecularTexture[260];
+    float Diffuse[4];
+    float Ambient[4];
+    float Specular[4];
+    float Emissive[4];
+    float Power;
+    unsigned long long Resources[6];
+};
+
+static_assert( sizeof( SdkMeshHeader ) == 104 && sizeof( SdkVertexBufferHeader ) == 288 &&
+               sizeof( SdkIndexBufferHeader ) == 32 && sizeof( SdkMesh ) == 224 && sizeof( SdkSubset ) == 144 &&
+               sizeof( SdkFrame ) == 184 && sizeof( SdkMaterial ) == 1256, "layout differs from SDKmesh.h" );
+
+// Triangles [nFirst, nFirst + nCount) of the mesh, with their own vertex buffer
+struct SdkMeshPart
+{
+    size_t nFirst, nCount;
+    unsigned int nVertices;
+    float3 vMin, vMax;
+};
+
+bool SaveSDKMesh( const wchar_t* szFile, const FractalMesh& mesh )
+{
+    // Split the triangles in order, spatially coherent as blocks emit them, so few
+    // vertices end up in two parts. remap is the part's index of a mesh vertex.
+    const size_t nTriangles = mesh.Indices.size() / 3;
+    std::vector<unsigned int> remap( mesh.Vertices.size(), SDKMESH_INVALID );
+    std::vector<SdkMeshPart> parts;
+    SdkMeshPart part = { 0, 0, 0, float3( 1e30f ), float3( -1e30f ) };
+    for( size_t t = 0; t <= nTriangles; ++t )
+    {
+        const unsigned int* pTri = ( t < nTriangles ) ? &mesh.Indices[3 * t] : NULL;
+        unsigned int nNew = 0;
+        for( int k = 0; pTri && k < 3; ++k )
+            nNew += remap[pTri[k]] == SDKMESH_INVALID;
+        if( !pTri || part.nVertices + nNew > MESH_PART_VERTICES )
+        {
+            if( part.nCount > 0 )
+            {
+                parts.push_back( part );
+                for( size_t i = 3 * part.nFirst; i < 3 * ( part.nFirst + part.nCount ); ++i )
+                    remap[mesh.Indices[i]] = SDKMESH_INVALID;
+            }
+            part.nFirst = t;
+            part.nCount = 0;
+            part.nVertices = 0;
+            part.vMin = float3( 1e30f );
+            part.vMax = float3( -1e30f );
+            if( !pTri )
+                break;
+        }
+        for( int k = 0; k < 3; ++k )
+            if( remap[pTri[k]] == SDKMESH_INVALID )
+            {
+                const float3& v = mesh.Vertices[pTri[k]].Position;
+                remap[pTri[k]] = part.nVertices++;
+                part.vMin = float3( fminf( part.vMin.x, v.x ), fminf( part.vMin.y, v.y ), fminf( part.vMin.z, v.z ) );
+                part.vMax = float3( fmaxf( part.vMax.x, v.x ), fmaxf( part.vMax.y, v.y ), fmaxf( part.vMax.z, v.z ) );
+            }
+        ++part.nCount;
+    }
+    const unsigned int nParts = ( unsigned int )parts.size();
+
+    // Headers, then for every part its subset list, then the vertex and index buffers
+    SdkMeshHeader header;
+    memset( &header, 0, sizeof( header ) );
+    header.Version = SDKMESH_VERSION;
+    header.HeaderSize = sizeof( SdkMeshHeader );
+    header.NumVertexBuffers = header.NumIndexBuffers = header.NumMeshes = nParts;
+    header.NumTotalSubsets = header.NumFrames = nParts;
+    header.NumMaterials = 1;
+    header.VertexStreamHeadersOffset = sizeof( SdkMeshHeader );
+    header.IndexStreamHeadersOffset = header.VertexStreamHeadersOffset + nParts * sizeof( SdkVertexBufferHeader );
+    header.MeshDataOffset = header.IndexStreamHeadersOffset + nParts * sizeof( SdkIndexBufferHeader );
+    header.SubsetDataOffset = header.MeshDataOffset + nParts * sizeof( SdkMesh );
+    header.FrameDataOffset = header.SubsetDataOffset + nParts * sizeof( SdkSubset );
+    header.MaterialDataOffset = header.FrameDataOffset + nParts * sizeof( SdkFrame );
+    const unsigned long long nSubsetLists = header.MaterialDataOffset + sizeof( SdkMaterial );
+    const unsigned long long nBufferData = nSubsetLists + nParts * sizeof( unsigned int );
+    header.NonBufferDataSize = nBufferData - header.HeaderSize;
+
+    std::vector<SdkVertexBufferHeader> vbs( nParts );
+    std::vector<SdkIndexBufferHeader> ibs( nParts );
+    std::vector<SdkMesh> meshes( nParts );
+    std::vector<SdkSubset> subsets( nParts );
+    std::vector<SdkFrame> frames( nParts );
+    std::vector<unsigned int> subsetLists( nParts );
+    if( nParts > 0 )
+    {
+        // Padding included, so the file doesn't carry whatever was on the heap
+        memset( &vbs[0], 0, nParts * sizeof( SdkVertexBufferHeader ) );
+        memset( &ibs[0], 0, nParts * sizeof( SdkIndexBufferHeader ) );
+        memset( &meshes[0], 0, nParts * sizeof( SdkMesh ) );
+        memset( &subsets[0], 0, nParts * sizeof( SdkSubset ) );
+        memset( &frames[0], 0, nParts * sizeof( SdkFrame ) );
+    }
+    unsigned long long nOffset = nBufferData;
+    for( unsigned int i = 0; i < nParts; ++i )
+    {
+        SdkVertexBufferHeader& vb = vbs[i];
+        vb.NumVertices = parts[i].nVertices;
+        vb.StrideBytes = sizeof( MeshVertex );
+        vb.SizeBytes = vb.NumVertices * vb.StrideBytes;
+        const SdkVertexElement decl[3] =
+        {
+            { 0, 0, 2, 0, 0, 0 },           // FLOAT3 POSITION
+            { 0, 12, 2, 0, 3, 0 },          // FLOAT3 NORMAL
+            { 0xff, 0, 17, 0, 0, 0 },       // D3DDECL_END
+        };
+        memcpy( vb.Decl, decl, sizeof( decl ) );
+        vb.DataOffset = nOffset;
+        nOffset += vb.SizeBytes;
+    }
+    for( unsigned int i = 0; i < nParts; ++i )
+    {
+        SdkIndexBufferHeader& ib = ibs[i];
+        ib.NumIndices = 3 * ( unsigned long long )parts[i].nCount;
+        ib.SizeBytes = ib.NumIndices * sizeof( unsigned int );
+        ib.IndexType = 1;                   // IT_32BIT
+        ib.DataOffset = nOffset;
+        nOffset += ib.SizeBytes;
+
+        SdkMesh& m = meshes[i];
+        snprintf( m.Name, sizeof( m.Name ), "fractal%u", i );
+        m.NumVertexBuffers = 1;
+        m.VertexBuffers[0] = i;
+        m.IndexBuffer = i;
+        m.NumSubsets = 1;
+        const float3 vCenter = ( parts[i].vMin + parts[i].vMax ) * 0.5f, vExtents = ( parts[i].vMax - parts[i].vMin ) * 0.5f;
+        memcpy( m.BoundingBoxCenter, &vCenter, sizeof( m.BoundingBoxCenter ) );
+        memcpy( m.BoundingBoxExtents, &vExtents, sizeof( m.BoundingBoxExtents ) );
+        m.SubsetOffset = nSubsetLists + i * sizeof( unsigned int );
+        m.FrameInfluenceOffset = 0;
+
+        SdkSubset& s = subsets[i];
+        snprintf( s.Name, sizeof( s.Name ), "fractal%u", i );
+        s.MaterialID = 0;
+        s.PrimitiveType = 0;                // PT_TRIANGLE_LIST
+        s.IndexCount = ib.NumIndices;
+        s.VertexCount = parts[i].nVertices;
+        subsetLists[i] = i;
+
+        // Siblings under no parent; CDXUTSDKMesh renders frame 0 and its siblings
+        SdkFrame& f = frames[i];
+        snprintf( f.Name, sizeof( f.Name ), "fractal%u", i );
+        f.Mesh = i;
+        f.ParentFrame = f.ChildFrame = SDKMESH_INVALID;
+        f.SiblingFrame = ( i + 1 < nParts ) ? i + 1 : SDKMESH_INVALID;
+        f.Matrix[0] = f.Matrix[5] = f.Matrix[10] = f.Matrix[15] = 1;
+        f.AnimationDataIndex = SDKMESH_INVALID;
+    }
+    header.BufferDataSize = nOffset - nBufferData;
+
+    SdkMaterial material;
+    memset( &material, 0, sizeof( material ) );
+    strcpy( material.Name, "fractal" );
+    const float vDiffuse[4] = { 0.8f, 0.8f, 0.8f, 1 }, vAmbient[4] = { 0.2f, 0.2f, 0.2f, 1 };
+    memcpy( material.Diffuse, vDiffuse, sizeof( vDiffuse ) );
+    memcpy( material.Ambient, vAmbient, sizeof( vAmbient ) );
+
+    FILE* pFile = OpenFileW( szFile, L"wb" );
+    if( !pFile )
+        return false;
+    bool bOK = fwrite( &header, sizeof( header ), 1, pFile ) == 1;
+    if( nParts > 0 )
+        bOK = bOK && fwrite( &vbs[0], sizeof( SdkVertexBufferHeader ), nParts, pFile ) == nParts &&
+              fwrite( &ibs[0], sizeof( SdkIndexBufferHeader ), nParts, pFile ) == nParts &&
+              fwrite( &meshes[0], sizeof( SdkMesh ), nParts, pFile ) == nParts &&
+              fwrite( &subsets[0], sizeof( SdkSubset ), nParts, pFile ) == nParts &&
+              fwrite( &frames[0], sizeof( SdkFrame ), nParts, pFile ) == nParts;
+    bOK = bOK && fwrite( &material, sizeof( material ), 1, pFile ) == 1;
+    if( nParts > 0 )
+        bOK = bOK && fwrite( &subsetLists[0], sizeof( unsigned int ), nParts, pFile ) == nParts;
+
+    // Vertex buffers, rebuilding each part's remap, then the index buffers
+    std::vector<MeshVertex> vertices;
+    for( unsigned int i = 0; i < nParts && bOK; ++i )
+    {
+        vertices.resize( parts[i].nVertices );
+        unsigned int nVertices = 0;
+        for( size_t j = 3 * parts[i].nFirst; j < 3 * ( parts[i].nFirst + parts[i].nCount ); ++j )
+            if( remap[mesh.Indices[j]] == SDKMESH_INVALID )
+            {
+                remap[mesh.Indices[j]] = nVertices;
+                vertices[nVertices++] = mesh.Vertices[mesh.Indices[j]];
+            }
+        bOK = fwrite( &vertices[0], sizeof( MeshVertex ), nVertices, pFile ) == nVertices;
+        for( size_t j = 3 * parts[i].nFirst; j < 3 * ( parts[i].nFirst + parts[i].nCount ); ++j )
+            remap[mesh.Indices[j]] = SDKMESH_INVALID;
+    }
+    std::vector<unsigned int> indices;
+    for( unsigned int i = 0; i < nParts && bOK; ++i )
+    {
+        unsigned int nVertices = 0;
+        indices.resize( 3 * parts[i].nCount );
+        for( size_t j = 0; j < indices.size(); ++j )
+        {
+            unsigned int& n = remap[mesh.Indices[3 * parts[i].nFirst + j]];
+            if( n == SDKMESH_INVALID )
+                n = nVertices++;
+            indices[j] = n;
+        }
+        bOK = fwrite( &indices[0], sizeof( unsigned int ), indices.size(), pFile ) == indices.size();
+        for( size_t j = 3 * parts[i].nFirst; j < 3 * ( parts[i].nFirst + parts[i].nCount ); ++j )
+            remap[mesh.Indices[j]] = SDKMESH_INVALID;
+    }
+
+    bOK = ( fclose( pFile ) == 0 ) && bOK;
+    return bOK;
+}
@@ -0,0 +1,66 @@
+//--------------------------------------------------------------------------------------
+// File: meshextract.h
+//
+// Polygon meshes of the fractal surface for other tools, written as .sdkmesh.
+//
+// The surface is the level set DE = fIso, extracted by dual contouring on a grid of
+// nCells^3 cells over a cube around the fractal: one vertex per cell the surface
+// crosses, placed by minimizing the distance to the tangent planes at the crossings of
+// its edges, and a quad across every crossed grid edge joining the vertices of the four
+// cells around it.
+//
+// The grid is never held as a whole. It is split into blocks of MESH_BLOCK^3 cells that
+// are sampled and contoured independently on all threads; blocks the DE at their center
+// shows to be empty are skipped unsampled. A block samples one layer of points beyond
+// its low faces, so it can build the vertices of the neighbouring cells its quads share;
+// those on block faces go through a lock-free hash keyed by cell, and the first block to
+// insert one owns it. Only the mesh itself grows with the grid.
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef MESHEXTRACT_H
+#define MESHEXTRACT_H
+
+#include "cpude.h"
+#include <vector>
+
+// Cells along each edge of a block, the unit of work and of culling
+static const unsigned int MESH_BLOCK = 32;
+
+struct MeshVertex
+{
+    float3 Position;
+    float3 Normal;                  // unit, pointing out of the fractal
+};
+
+struct FractalMesh
+{
+    std::vector<MeshVertex> Vertices;
+    std::vector<unsigned int> Indices;  // triangle list, clockwise seen from outside as D3D expects
+};
+
+struct MeshExtractStats
+{
+    unsigned int nBlocks;
+    unsigned int nActiveBlocks;     // not culled, sampled
+    unsigned long long nSamples;    // DE evaluations
+    size_t nSharedVertices;         // vertices of cells on block faces, found through the hash
+    size_t nOverflow;               // of those, ones that didn't fit in the hash
+    double fMs;
+};
+
+// Extracts the surface DE = fIso over nCells^3 cells of the cube of half size fExtent
+// around the origin (GetDistanceCacheExtent gives one that holds the fractal) on
+// nThreads threads, 0 for all hardware threads. False if the mesh needs more than 2^32
+// vertices.
+bool ExtractMesh( const CpuFractal& fractal, float fExtent, unsigned int nCells, float fIso, unsigned int nThreads,
+                  FractalMesh* pMesh, MeshExtractStats* pStats = NULL );
+
+// Writes mesh as version 101 .sdkmesh, the layout CDXUTSDKMesh loads: position and
+// normal per vertex, 32 bit indices, one material. Meshes over MESH_PART_VERTICES
+// vertices are split into several meshes, each a frame of its own, so that no vertex
+// buffer exceeds the 128 MB every D3D11 device can create.
+bool SaveSDKMesh( const wchar_t* szFile, const FractalMesh& mesh );
+
+static const unsigned int MESH_PART_VERTICES = 1 << 22;
+
+#endif // MESHEXTRACT_H
@@ -5,13 +5,133 @@
 //
 //--------------------------------------------------------------------------------------
 
+// Hit epsilon at p. With pixelSize set it is half the footprint of a pixel at the
+// distance of p from the eye, so close-up detail is resolved down to the pixel and
+// distant geometry no finer than it can be seen; otherwise it is the global threshold
+// derived from the DE at the eye.
+float HitEpsilon(float3 p, float3 eye)
+{
+    return pixelSize > 0 ? 0.5 * pixelSize * length(p - eye) : dist * dist * 0.0001;
+}
+
+// The including file defines DELod(p, eps), the DE with no detail below eps resolved,
+// which is used instead of DE when pixelSize is set
+float MarchDE(float3 p, float eps)
+{
+    return pixelSize > 0 ? DELod(p, eps) : DE(p);
+}
+
+// Puts a hit found with the loose threshold refine * eps on the surface. Along the ray
+// f(s) = DE(pos + s * dir) - eps, with the previous sample at sa and the current one at
+// 0. While both samples are outside the steps go to the secant root of f, at most 4 DE
+// far; once a sample is inside (f < 0) the root is bracketed and the steps use false
+// position. Stops as soon as DE is within [0, eps] and then takes the same last DE step
+// as a hit of the plain march.
+float3 refine_hit(float3 pos, float3 dir, float sa, float fa, float fb, float eps)
+{
+    float sb = 0;
+    for (int j = 0; j < 8 && (fb > 0 || fb < -eps); ++j)
+    {
+        float sc;
+        if (fb < 0) sc = sb + (sa - sb) * fb / (fb - fa);
+        else if (fa > fb) sc = sb + min(fb * (sb - sa) / (fa - fb), 4 * (fb + eps));
+        else sc = sb + fb + eps;
+        float fc = MarchDE(pos + sc * dir, eps) - eps;
+        if (fb < 0 && fc >= 0)
+        {
+            sa = sc;
+            fa = fc;
+            continue;
+        }
+        if (fb >= 0)
+        {
+            sa = sb;
+            fa = fb;
+        }
+        sb = sc;
+        fb = fc;
+    }
+    return pos + (fb >= -eps ? sb + fb + eps : min(sa + fa + eps, sb)) * dir;
+}
+
+// The including file defines BoundRadius, the radius of a sphere around the origin
+// outside of which DE never gets down to the hit epsilon, or 0 if there is none. Rays
+// start where they enter that sphere and are misses as soon as they leave it.
 float4 ray_marching(Ray ray)
 {
+    float3 eye = GetEye();
+    float tmax = 1e30;
+    if (BoundRadius > 0)
+    {
+        float b = dot(ray.pos, ray.dir);
+        float h = b * b - dot(ray.pos, ray.pos) + BoundRadius * BoundRadius;
+        if (h < 0 || -b + sqrt(h) < 0) return float4(ray.pos, -1);
+        float t0 = max(-b - sqrt(h), 0);
+        ray.pos += t0 * ray.dir;
+        tmax = -b + sqrt(h) - t0;
+    }
+
+    // Over-relaxed sphere tracing: steps are relax * d. As long as the unbounding sphere at
+    // the new point overlaps the previous one the skipped segment is still known to be empty;
+    // when they stop overlapping the step may have jumped over a surface, so it is redone as
+    // a plain step from the previous point and the rest of the ray is marched with k = 1.
+    float k = max(relax, 1);
+    float3 pprev = ray.pos;
+    float dprev = 0;
+    float sprev = 0;
+    float t = 0;
     for (int i = 0; i < 128; ++i)
     {
-        float d = DE(ray.pos);
-        ray.pos += d * ray.dir;
-        if (d < (dist * dist * 0.0001)) return float4(ray.pos, i);
+        float eps = HitEpsilon(ray.pos, eye);
+        float d = MarchDE(ray.pos, eps);
+        if (abs(d) + dprev < sprev)
+        {
+            ray.pos = pprev + dprev * ray.dir;
+            t += dprev - sprev;
+            k = 1;
+            sprev = 0;
+            continue;
+        }
+        if (refine > 0 && d < refine * eps)
+            return float4(refine_hit(ray.pos, ray.dir, -sprev, dprev - eps, d - eps, eps), i);
+        if (d < eps) return float4(ray.pos + d * ray.dir, i);
+        float s = k * d;
+        pprev = ray.pos;
+        dprev = abs(d);
+        sprev = s;
+        ray.pos += s * ray.dir;
+        float tprev = t;
+        t += s;
+        if (t > tmax)
+        {
+            // Only the sphere at pprev is known to be empty: a miss if it reaches past the
+            // exit, else the unchecked relaxed part of the step is redone as a plain one
+            if (tprev + dprev > tmax)
+                break;
+            ray.pos = pprev + dprev * ray.dir;
+            t = tprev + dprev;
+            k = 1;
+            sprev = 0;
+        }
     }
     return float4(ray.pos, -1);
 }
+
+// Marches the cone with apex ray.pos, axis ray.dir and half angle atan(k) from distance t
+// along the axis. A step only goes as far as the DE sphere still contains the whole cone
+// cross section: from t to t + s the cone radius grows to (t + s) * k, so s is limited to
+// (d - t * k) / (1 + k). Returns the distance up to which the cone is empty, i.e. a safe
+// start for ray_marching of every ray inside it. Past tfar the whole cone is outside
+// the bounding sphere and the march can stop.
+float cone_marching(Ray ray, float k, float t)
+{
+    float tfar = BoundRadius > 0 ? length(ray.pos) + BoundRadius : 1e30;
+    for (int i = 0; i < 64 && t < tfar; ++i)
+    {
+        float d = DE(ray.pos + t * ray.dir);
+        float s = (d - t * k) / (1 + k);
+        if (s < (dist * dist * 0.0001)) break;
+        t += s;
+    }
+    return t;
+}
@@ -0,0 +1,314 @@
+//--------------------------------------------------------------------------------------
+// File: simd.h
+//
+// Thin wrappers around SSE2 / SSE4.2 / AVX2 / AVX-512 intrinsics for the CPU fractal
+// kernels.
+//
+// The widest instruction set enabled for the translation unit is used (/arch:AVX2,
+// /arch:AVX512 or -mavx2 -mfma, -mavx512f; MSVC has no switch for SSE4, so files built
+// for it define SIMD_SSE42, gcc and clang -msse4.2). vfloat holds SIMD_WIDTH lanes, vint the
+// same number of 32 bit integers and vmask one bit per lane. Everything lives in a
+// namespace named after the instruction set so translation units built for different
+// targets never see conflicting definitions of the same inline function.
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <immintrin.h>
+
+#if defined( __AVX512F__ )
+#define SIMD_ISA            avx512
+#define SIMD_WIDTH          16
+#elif defined( __AVX2__ )
+#define SIMD_ISA            avx2
+#define SIMD_WIDTH          8
+#elif defined( __SSE4_2__ ) || defined( SIMD_SSE42 )
+#define SIMD_ISA            sse42
+#define SIMD_WIDTH          4
+#define SIMD_SSE4           1
+#else
+#define SIMD_ISA            sse2
+#define SIMD_WIDTH          4
+#endif
+
+namespace SIMD_ISA
+{
+
+#if SIMD_WIDTH == 16
+
+//--------------------------------------------------------------------------------------
+// AVX-512
+//--------------------------------------------------------------------------------------
+struct vmask
+{
+    __mmask16 m;
+    vmask() {}
+    vmask( __mmask16 _m ) : m( _m ) {}
+};
+inline vmask operator & ( vmask a, vmask b ) { return vmask( ( __mmask16 )( a.m & b.m ) ); }
+inline vmask operator | ( vmask a, vmask b ) { return vmask( ( __mmask16 )( a.m | b.m ) ); }
+inline vmask operator ~ ( vmask a ) { return vmask( ( __mmask16 )~a.m ); }
+inline vmask andnot( vmask a, vmask b ) { return vmask( ( __mmask16 )( ~a.m & b.m ) ); }  // ~a & b
+inline bool  any( vmask a ) { return a.m != 0; }
+inline bool  all( vmask a ) { return a.m == 0xffff; }
+inline int   movemask( vmask a ) { return a.m; }
+
+struct vint
+{
+    __m512i v;
+    vint() {}
+    vint( __m512i _v ) : v( _v ) {}
+    vint( int s ) : v( _mm512_set1_epi32( s ) ) {}
+};
+inline vint operator + ( vint a, vint b ) { return _mm512_add_epi32( a.v, b.v ); }
+inline vint operator - ( vint a, vint b ) { return _mm512_sub_epi32( a.v, b.v ); }
+inline vint operator & ( vint a, vint b ) { return _mm512_and_epi32( a.v, b.v ); }
+inline vint operator | ( vint a, vint b ) { return _mm512_or_epi32( a.v, b.v ); }
+inline vint operator ^ ( vint a, vint b ) { return _mm512_xor_epi32( a.v, b.v ); }
+template<int N> inline vint shl( vint a ) { return _mm512_slli_epi32( a.v, N ); }
+template<int N> inline vint shr( vint a ) { return _mm512_srli_epi32( a.v, N ); }
+inline vmask operator == ( vint a, vint b ) { return _mm512_cmpeq_epi32_mask( a.v, b.v ); }
+inline vint  select( vmask m, vint a, vint b ) { return _mm512_mask_blend_epi32( m.m, b.v, a.v ); }
+
+struct vfloat
+{
+    __m512 v;
+    vfloat() {}
+    vfloat( __m512 _v ) : v( _v ) {}
+    vfloat( float s ) : v( _mm512_set1_ps( s ) ) {}
+};
+inline vfloat load( const float* p ) { return _mm512_loadu_ps( p ); }
+inline void   store( float* p, vfloat a ) { _mm512_storeu_ps( p, a.v ); }
+inline vint   loadi( const int* p ) { return _mm512_loadu_si512( p ); }
+inline void   storei( int* p, vint a ) { _mm512_storeu_si512( p, a.v ); }
+inline vfloat operator + ( vfloat a, vfloat b ) { return _mm512_add_ps( a.v, b.v ); }
+inline vfloat operator - ( vfloat a, vfloat b ) { return _mm512_sub_ps( a.v, b.v ); }
+inline vfloat operator * ( vfloat a, vfloat b ) { return _mm512_mul_ps( a.v, b.v ); }
+inline vfloat operator / ( vfloat a, vfloat b ) { return _mm512_div_ps( a.v, b.v ); }
+inline vfloat min( vfloat a, vfloat b ) { return _mm512_min_ps( a.v, b.v ); }
+inline vfloat max( vfloat a, vfloat b ) { return _mm512_max_ps( a.v, b.v ); }
+inline vfloat sqrt( vfloat a ) { return _mm512_sqrt_ps( a.v ); }
+inline vfloat madd( vfloat a, vfloat b, vfloat c ) { return _mm512_fmadd_ps( a.v, b.v, c.v ); }   // a * b + c
+inline vmask  operator <  ( vfloat a, vfloat b ) { return _mm512_cmp_ps_mask( a.v, b.v, _CMP_LT_OQ ); }
+inline vmask  operator <= ( vfloat a, vfloat b ) { return _mm512_cmp_ps_mask( a.v, b.v, _CMP_LE_OQ ); }
+inline vmask  operator >  ( vfloat a, vfloat b ) { return _mm512_cmp_ps_mask( a.v, b.v, _CMP_GT_OQ ); }
+inline vmask  operator >= ( vfloat a, vfloat b ) { return _mm512_cmp_ps_mask( a.v, b.v, _CMP_GE_OQ ); }
+inline vmask  operator == ( vfloat a, vfloat b ) { return _mm512_cmp_ps_mask( a.v, b.v, _CMP_EQ_OQ ); }
+inline vfloat select( vmask m, vfloat a, vfloat b ) { return _mm512_mask_blend_ps( m.m, b.v, a.v ); }
+inline vint   asint( vfloat a ) { return _mm512_castps_si512( a.v ); }
+inline vfloat asfloat( vint a ) { return _mm512_castsi512_ps( a.v ); }
+inline vint   roundi( vfloat a ) { return _mm512_cvtps_epi32( a.v ); }      // round to nearest even
+inline vint   trunci( vfloat a ) { return _mm512_cvttps_epi32( a.v ); }
+inline vfloat tofloat( vint a ) { return _mm512_cvtepi32_ps( a.v ); }
+
+#elif SIMD_WIDTH == 8
+
+//--------------------------------------------------------------------------------------
+// AVX2
+//--------------------------------------------------------------------------------------
+struct vmask
+{
+    __m256 m;
+    vmask() {}
+    vmask( __m256 _m ) : m( _m ) {}
+};
+inline vmask operator & ( vmask a, vmask b ) { return _mm256_and_ps( a.m, b.m ); }
+inline vmask operator | ( vmask a, vmask b ) { return _mm256_or_ps( a.m, b.m ); }
+inline vmask operator ~ ( vmask a ) { return _mm256_xor_ps( a.m, _mm256_castsi256_ps( _mm256_set1_epi32( -1 ) ) ); }
+inline vmask andnot( vmask a, vmask b ) { return _mm256_andnot_ps( a.m, b.m ); }  // ~a & b
+inline int   movemask( vmask a ) { return _mm256_movemask_ps( a.m ); }
+inline bool  any( vmask a ) { return movemask( a ) != 0; }
+inline bool  all( vmask a ) { return movemask( a ) == 0xff; }
+
+struct vint
+{
+    __m256i v;
+    vint() {}
+    vint( __m256i _v ) : v( _v ) {}
+    vint( int s ) : v( _mm256_set1_epi32( s ) ) {}
+};
+inline vint operator + ( vint a, vint b ) { return _mm256_add_epi32( a.v, b.v ); }
+inline vint operator - ( vint a, vint b ) { return _mm256_sub_epi32( a.v, b.v ); }
+inline vint operator & ( vint a, vint b ) { return _mm256_and_si256( a.v, b.v ); }
+inline vint operator | ( vint a, vint b ) { return _mm256_or_si256( a.v, b.v ); }
+inline vint operator ^ ( vint a, vint b ) { return _mm256_xor_si256( a.v, b.v ); }
+template<int N> inline vint shl( vint a ) { return _mm256_slli_epi32( a.v, N ); }
+template<int N> inline vint shr( vint a ) { return _mm256_srli_epi32( a.v, N ); }
+inline vmask operator == ( vint a, vint b ) { return _mm256_castsi256_ps( _mm256_cmpeq_epi32( a.v, b.v ) ); }
+inline vint  select( vmask m, vint a, vint b ) { return _mm256_castps_si256( _mm256_blendv_ps( _mm256_castsi256_ps( b.v ), _mm256_castsi256_ps( a.v ), m.m ) ); }
+
+struct vfloat
+{
+    __m256 v;
+    vfloat() {}
+    vfloat( __m256 _v ) : v( _v ) {}
+    vfloat( float s ) : v( _mm256_set1_ps( s ) ) {}
+};
+inline vfloat load( const float* p ) { return _mm256_loadu_ps( p ); }
+inline void   store( float* p, vfloat a ) { _mm256_storeu_ps( p, a.v ); }
+inline vint   loadi( const int* p ) { return _mm256_loadu_si256( ( const __m256i* )p ); }
+inline void   storei( int* p, vint a ) { _mm256_storeu_si256( ( __m256i* )p, a.v ); }
+inline vfloat operator + ( vfloat a, vfloat b ) { return _mm256_add_ps( a.v, b.v ); }
+inline vfloat operator - ( vfloat a, vfloat b ) { return _mm256_sub_ps( a.v, b.v ); }
+inline vfloat operator * ( vfloat a, vfloat b ) { return _mm256_mul_ps( a.v, b.v ); }
+inline vfloat operator / ( vfloat a, vfloat b ) { return _mm256_div_ps( a.v, b.v ); }
+inline vfloat min( vfloat a, vfloat b ) { return _mm256_min_ps( a.v, b.v ); }
+inline vfloat max( vfloat a, vfloat b ) { return _mm256_max_ps( a.v, b.v ); }
+inline vfloat sqrt( vfloat a ) { return _mm256_sqrt_ps( a.v ); }
+#if defined( __FMA__ ) || defined( _MSC_VER )
+inline vfloat madd( vfloat a, vfloat b, vfloat c ) { return _mm256_fmadd_ps( a.v, b.v, c.v ); }   // a * b + c
+#else
+inline vfloat madd( vfloat a, vfloat b, vfloat c ) { return a * b + c; }
+#endif
+inline vmask  operator <  ( vfloat a, vfloat b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_LT_OQ ); }
+inline vmask  operator <= ( vfloat a, vfloat b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_LE_OQ ); }
+inline vmask  operator >  ( vfloat a, vfloat b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_GT_OQ ); }
+inline vmask  operator >= ( vfloat a, vfloat b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_GE_OQ ); }
+inline vmask  operator == ( vfloat a, vfloat b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_EQ_OQ ); }
+inline vfloat select( vmask m, vfloat a, vfloat b ) { return _mm256_blendv_ps( b.v, a.v, m.m ); }
+inline vint   asint( vfloat a ) { return _mm256_castps_si256( a.v ); }
+inline vfloat asfloat( vint a ) { return _mm256_castsi256_ps( a.v ); }
+inline vint   roundi( vfloat a ) { return _mm256_cvtps_epi32( a.v ); }      // round to nearest even
+inline vint   trunci( vfloat a ) { return _mm256_cvttps_epi32( a.v ); }
+inline vfloat tofloat( vint a ) { return _mm256_cvtepi32_ps( a.v ); }
+
+#else
+
+//--------------------------------------------------------------------------------------
+// SSE2, the baseline for x64, and SSE4.2 which only adds blends
+//--------------------------------------------------------------------------------------
+struct vmask
+{
+    __m128 m;
+    vmask() {}
+    vmask( __m128 _m ) : m( _m ) {}
+};
+inline vmask operator & ( vmask a, vmask b ) { return _mm_and_ps( a.m, b.m ); }
+inline vmask operator | ( vmask a, vmask b ) { return _mm_or_ps( a.m, b.m ); }
+inline vmask operator ~ ( vmask a ) { return _mm_xor_ps( a.m, _mm_castsi128_ps( _mm_set1_epi32( -1 ) ) ); }
+inline vmask andnot( vmask a, vmask b ) { return _mm_andnot_ps( a.m, b.m ); }  // ~a & b
+inline int   movemask( vmask a ) { return _mm_movemask_ps( a.m ); }
+inline bool  any( vmask a ) { return movemask( a ) != 0; }
+inline bool  all( vmask a ) { return movemask( a ) == 0xf; }
+
+struct vint
+{
+    __m128i v;
+    vint() {}
+    vint( __m128i _v ) : v( _v ) {}
+    vint( int s ) : v( _mm_set1_epi32( s ) ) {}
+};
+inline vint operator + ( vint a, vint b ) { return _mm_add_epi32( a.v, b.v ); }
+inline vint operator - ( vint a, vint b ) { return _mm_sub_epi32( a.v, b.v ); }
+inline vint operator & ( vint a, vint b ) { return _mm_and_si128( a.v, b.v ); }
+inline vint operator | ( vint a, vint b ) { return _mm_or_si128( a.v, b.v ); }
+inline vint operator ^ ( vint a, vint b ) { return _mm_xor_si128( a.v, b.v ); }
+template<int N> inline vint shl( vint a ) { return _mm_slli_epi32( a.v, N ); }
+template<int N> inline vint shr( vint a ) { return _mm_srli_epi32( a.v, N ); }
+inline vmask operator == ( vint a, vint b ) { return _mm_castsi128_ps( _mm_cmpeq_epi32( a.v, b.v ) ); }
+#ifdef SIMD_SSE4
+inline vint  select( vmask m, vint a, vint b ) { return _mm_blendv_epi8( b.v, a.v, _mm_castps_si128( m.m ) ); }
+#else
+inline vint  select( vmask m, vint a, vint b )
+{
+    __m128i mi = _mm_castps_si128( m.m );
+    return _mm_or_si128( _mm_and_si128( mi, a.v ), _mm_andnot_si128( mi, b.v ) );
+}
+#endif
+
+struct vfloat
+{
+    __m128 v;
+    vfloat() {}
+    vfloat( __m128 _v ) : v( _v ) {}
+    vfloat( float s ) : v( _mm_set1_ps( s ) ) {}
+};
+inline vfloat load( const float* p ) { return _mm_loadu_ps( p ); }
+inline void   store( float* p, vfloat a ) { _mm_storeu_ps( p, a.v ); }
+inline vint   loadi( const int* p ) { return _mm_loadu_si128( ( const __m128i* )p ); }
+inline void   storei( int* p, vint a ) { _mm_storeu_si128( ( __m128i* )p, a.v ); }
+inline vfloat operator + ( vfloat a, vfloat b ) { return _mm_add_ps( a.v, b.v ); }
+inline vfloat operator - ( vfloat a, vfloat b ) { return _mm_sub_ps( a.v, b.v ); }
+inline vfloat operator * ( vfloat a, vfloat b ) { return _mm_mul_ps( a.v, b.v ); }
+inline vfloat operator / ( vfloat a, vfloat b ) { return _mm_div_ps( a.v, b.v ); }
+inline vfloat min( vfloat a, vfloat b ) { return _mm_min_ps( a.v, b.v ); }
+inline vfloat max( vfloat a, vfloat b ) { return _mm_max_ps( a.v, b.v ); }
+inline vfloat sqrt( vfloat a ) { return _mm_sqrt_ps( a.v ); }
+inline vfloat madd( vfloat a, vfloat b, vfloat c ) { return a * b + c; }   // a * b + c
+inline vmask  operator <  ( vfloat a, vfloat b ) { return _mm_cmplt_ps( a.v, b.v ); }
+inline vmask  operator <= ( vfloat a, vfloat b ) { return _mm_cmple_ps( a.v, b.v ); }
+inline vmask  operator >  ( vfloat a, vfloat b ) { return _mm_cmpgt_ps( a.v, b.v ); }
+inline vmask  operator >= ( vfloat a, vfloat b ) { return _mm_cmpge_ps( a.v, b.v ); }
+inline vmask  operator == ( vfloat a, vfloat b ) { return _mm_cmpeq_ps( a.v, b.v ); }
+#ifdef SIMD_SSE4
+inline vfloat select( vmask m, vfloat a, vfloat b ) { return _mm_blendv_ps( b.v, a.v, m.m ); }
+#else
+inline vfloat select( vmask m, vfloat a, vfloat b ) { return _mm_or_ps( _mm_and_ps( m.m, a.v ), _mm_andnot_ps( m.m, b.v ) ); }
+#endif
+inline vint   asint( vfloat a ) { return _mm_castps_si128( a.v ); }
+inline vfloat asfloat( vint a ) { return _mm_castsi128_ps( a.v ); }
+inline vint   roundi( vfloat a ) { return _mm_cvtps_epi32( a.v ); }         // round to nearest even
+inline vint   trunci( vfloat a ) { return _mm_cvttps_epi32( a.v ); }
+inline vfloat tofloat( vint a ) { return _mm_cvtepi32_ps( a.v ); }
+
+#endif
+
+//--------------------------------------------------------------------------------------
+// Width independent helpers
+//--------------------------------------------------------------------------------------
+inline vfloat operator - ( vfloat a ) { return asfloat( asint( a ) ^ vint( ( int )0x80000000 ) ); }
+inline vfloat abs( vfloat a ) { return asfloat( asint( a ) & vint( 0x7fffffff ) ); }
+inline vfloat signbit( vfloat a ) { return asfloat( asint( a ) & vint( ( int )0x80000000 ) ); }
+inline vfloat xorsign( vfloat a, vfloat s ) { return asfloat( asint( a ) ^ asint( signbit( s ) ) ); }  // a * sign(s)
+inline vfloat saturate( vfloat a ) { return min( max( a, vfloat( 0.0f ) ), vfloat( 1.0f ) ); }
+inline vfloat clamp( vfloat a, vfloat lo, vfloat hi ) { return min( max( a, lo ), hi ); }
+inline vfloat& operator += ( vfloat& a, vfloat b ) { a = a + b; return a; }
+inline vfloat& operator -= ( vfloat& a, vfloat b ) { a = a - b; return a; }
+inline vfloat& operator *= ( vfloat& a, vfloat b ) { a = a * b; return a; }
+inline vmask&  operator &= ( vmask& a, vmask b ) { a = a & b; return a; }
+inline vmask&  operator |= ( vmask& a, vmask b ) { a = a | b; return a; }
+
+inline vfloat lane_index()
+{
+    float idx[SIMD_WIDTH];
+    for( int i = 0; i < SIMD_WIDTH; ++i )
+        idx[i] = ( float )i;
+    return load( idx );
+}
+
+inline vmask lane_mask( int nActive )      // first nActive lanes set
+{
+    return lane_index() < vfloat( ( float )nActive );
+}
+
+inline int popcount( vmask a )             // number of lanes set
+{
+    int n = 0;
+    for( int m = movemask( a ); m; m &= m - 1 )
+        ++n;
+    return n;
+}
+
+// Structure of arrays 3 component vector, SIMD_WIDTH points
+struct vfloat3
+{
+    vfloat x, y, z;
+
+    vfloat3() {}
+    vfloat3( vfloat _x, vfloat _y, vfloat _z ) : x( _x ), y( _y ), z( _z ) {}
+};
+inline vfloat3 operator + ( const vfloat3& a, const vfloat3& b ) { return vfloat3( a.x + b.x, a.y + b.y, a.z + b.z ); }
+inline vfloat3 operator - ( const vfloat3& a, const vfloat3& b ) { return vfloat3( a.x - b.x, a.y - b.y, a.z - b.z ); }
+inline vfloat3 operator * ( const vfloat3& a, vfloat s ) { return vfloat3( a.x * s, a.y * s, a.z * s ); }
+inline vfloat3 operator * ( vfloat s, const vfloat3& a ) { return vfloat3( a.x * s, a.y * s, a.z * s ); }
+inline vfloat  dot( const vfloat3& a, const vfloat3& b ) { return madd( a.x, b.x, madd( a.y, b.y, a.z * b.z ) ); }
+inline vfloat  length( const vfloat3& a ) { return sqrt( dot( a, a ) ); }
+inline vfloat3 select( vmask m, const vfloat3& a, const vfloat3& b )
+{
+    return vfloat3( select( m, a.x, b.x ), select( m, a.y, b.y ), select( m, a.z, b.z ) );
+}
+
+} // namespace SIMD_ISA
+
+#endif // SIMD_H
@@ -0,0 +1,226 @@
+//--------------------------------------------------------------------------------------
+// File: tilescheduler.cpp
+//
+// Work-stealing scheduler for screen tiles on the CPU renderer.
+//
+// The pool threads are created once and sleep on a condition variable between frames.
+// Deques are guarded by one small mutex each: the owner and at most a few thieves ever
+// touch the same deque, and a tile is thousands of DE evaluations, so the lock is noise.
+//--------------------------------------------------------------------------------------
+#include "tilescheduler.h"
+#include <algorithm>
+#include <chrono>
+
+typedef std::chrono::steady_clock SchedClock;
+
+static double ElapsedMs( SchedClock::time_point t0, SchedClock::time_point t1 )
+{
+    return std::chrono::duration<double, std::milli>( t1 - t0 ).count();
+}
+
+CTileScheduler::CTileScheduler() :
+    m_nGeneration( 0 ),
+    m_nRunning( 0 ),
+    m_bQuit( false ),
+    m_pfnTile( NULL ),
+    m_nRemaining( 0 ),
+    m_fFrameMs( 0 )
+{
+    SetThreadCount( 0 );
+}
+
+CTileScheduler::~CTileScheduler()
+{
+    StopThreads();
+}
+
+void CTileScheduler::SetThreadCount( unsigned int nThreads )
+{
+    if( nThreads == 0 ) nThreads = std::thread::hardware_concurrency();
+    if( nThreads == 0 ) nThreads = 1;
+    if( nThreads == m_Workers.size() )
+        return;
+
+    StopThreads();
+    StartThreads( nThreads );
+}
+
+void CTileScheduler::StartThreads( unsigned int nThreads )
+{
+    m_bQuit = false;
+    m_Workers.clear();
+    for( unsigned int i = 0; i < nThreads; ++i )
+        m_Workers.push_back( std::unique_ptr<Worker>( new Worker ) );
+    m_Stats.assign( nThreads, TileThreadStats() );
+
+    // Worker 0 is the thread calling Run. The others start from the current generation:
+    // read here, before any Run can raise it, so a new thread neither runs a frame that
+    // already finished nor misses the next one.
+    unsigned int nGeneration;
+    {
+        std::lock_guard<std::mutex> lock( m_Mutex );
+        nGeneration = m_nGeneration;
+    }
+    for( unsigned int i = 1; i < nThreads; ++i )
+        m_Threads.push_back( std::thread( &CTileScheduler::ThreadProc, this, i, nGeneration ) );
+}
+
+void CTileScheduler::StopThreads()
+{
+    {
+        std::lock_guard<std::mutex> lock( m_Mutex );
+        m_bQuit = true;
+    }
+    m_StartCV.notify_all();
+    for( size_t i = 0; i < m_Threads.size(); ++i )
+        m_Threads[i].join();
+    m_Threads.clear();
+}
+
+void CTileScheduler::Distribute( unsigned int nTiles, const float* pCost )
+{
+    const unsigned int nThreads = GetThreadCount();
+    for( unsigned int i = 0; i < nThreads; ++i )
+        m_Workers[i]->tiles.clear();
+
+    if( !pCost )
+    {
+        // Contiguous runs keep neighbouring tiles (and their cache lines) on one core
+        // until somebody has to steal
+        for( unsigned int i = 0; i < nThreads; ++i )
+            for( unsigned int t = nTiles * i / nThreads; t < nTiles * ( i + 1 ) / nThreads; ++t )
+                m_Workers[i]->tiles.push_back( t );
+        return;
+    }
+
+    // Longest processing time first: every tile goes to the deque with the least predicted
+    // work so far. Tiles are pushed at the front, so the owner (popping from the back)
+    // starts with its most expensive tile and thieves take the cheapest ones.
+    m_Order.resize( nTiles );
+    for( unsigned int t = 0; t < nTiles; ++t )
+        m_Order[t] = t;
+    std::stable_sort( m_Order.begin(), m_Order.end(), [pCost]( unsigned int a, unsigned int b )
+    {
+        return pCost[a] > pCost[b];
+    } );
+
+    m_Load.assign( nThreads, 0.0 );
+    for( unsigned int i = 0; i < nTiles; ++i )
+    {
+        unsigned int nMin = 0;
+        for( unsigned int j = 1; j < nThreads; ++j )
+            if( m_Load[j] < m_Load[nMin] ) nMin = j;
+        m_Load[nMin] += pCost[m_Order[i]];
+        m_Workers[nMin]->tiles.push_front( m_Order[i] );
+    }
+}
+
+void CTileScheduler::Run( unsigned int nTiles, const TILEFN& fnTile, const float* pCost )
+{
+    const unsigned int nThreads = GetThreadCount();
+
+    Distribute( nTiles, pCost );
+    for( unsigned int i = 0; i < nThreads; ++i )
+        m_Stats[i] = TileThreadStats();
+
+    SchedClock::time_point t0 = SchedClock::now();
+    m_pfnTile = &fnTile;
+    m_nRemaining = nTiles;
+    {
+        std::lock_guard<std::mutex> lock( m_Mutex );
+        m_nRunning = nThreads - 1;
+        ++m_nGeneration;
+    }
+    m_StartCV.notify_all();
+
+    WorkLoop( 0 );
+
+    // fnTile must stay alive until every pool thread has left WorkLoop
+    {
+        std::unique_lock<std::mutex> lock( m_Mutex );
+        m_DoneCV.wait( lock, [this] { return m_nRunning == 0; } );
+    }
+    m_pfnTile = NULL;
+
+    m_fFrameMs = ElapsedMs( t0, SchedClock::now() );
+    for( unsigned int i = 0; i < nThreads; ++i )
+        m_Stats[i].fIdleMs = ( m_fFrameMs > m_Stats[i].fBusyMs ) ? m_fFrameMs - m_Stats[i].fBusyMs : 0;
+}
+
+void CTileScheduler::ThreadProc( unsigned int nThread, unsigned int nGeneration )
+{
+    for( ;; )
+    {
+        {
+            std::unique_lock<std::mutex> lock( m_Mutex );
+            m_StartCV.wait( lock, [&] { return m_bQuit || m_nGeneration != nGeneration; } );
+            if( m_bQuit )
+                return;
+            nGeneration = m_nGeneration;
+        }
+
+        WorkLoop( nThread );
+
+        bool bLast;
+        {
+            std::lock_guard<std::mutex> lock( m_Mutex );
+            bLast = --m_nRunning == 0;
+        }
+        if( bLast )
+            m_DoneCV.notify_one();
+    }
+}
+
+// Own deque from the back, then the front of the others starting at the next thread
+bool CTileScheduler::PopTile( unsigned int nThread, unsigned int* pTile, bool* pbStolen )
+{
+    {
+        Worker& w = *m_Workers[nThread];
+        std::lock_guard<std::mutex> lock( w.lock );
+        if( !w.tiles.empty() )
+        {
+            *pTile = w.tiles.back();
+            w.tiles.pop_back();
+            *pbStolen = false;
+            return true;
+        }
+    }
+
+    const unsigned int nThreads = GetThreadCount();
+    for( unsigned int i = 1; i < nThreads; ++i )
+    {
+        Worker& victim = *m_Workers[( nThread + i ) % nThreads];
+        std::lock_guard<std::mutex> lock( victim.lock );
+        if( !victim.tiles.empty() )
+        {
+            *pTile = victim.tiles.front();
+            victim.tiles.pop_front();
+            *pbStolen = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CTileScheduler::WorkLoop( unsigned int nThread )
+{
+    TileThreadStats& stats = m_Stats[nThread];
+    while( m_nRemaining.load() > 0 )
+    {
+        unsigned int nTile;
+        bool bStolen;
+        if( !PopTile( nThread, &nTile, &bStolen ) )
+        {
+            // Everything is taken but other threads are still on their last tile
+            std::this_thread::yield();
+            continue;
+        }
+
+        SchedClock::time_point t0 = SchedClock::now();
+        ( *m_pfnTile )( nTile, nThread );
+        stats.fBusyMs += ElapsedMs( t0, SchedClock::now() );
+        ++stats.nTiles;
+        if( bStolen ) ++stats.nStolen;
+        --m_nRemaining;
+    }
+}
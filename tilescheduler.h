@@ -0,0 +1,88 @@
+//--------------------------------------------------------------------------------------
+// File: tilescheduler.h
+//
+// Work-stealing scheduler for screen tiles on the CPU renderer.
+//
+// Every thread owns a deque of tiles. At the start of a frame the tiles are split into
+// contiguous runs, one per deque; a thread works through its own deque from the back and,
+// once it runs dry, steals from the front of the other deques. Ray marching cost varies
+// by more than 10x between tiles, so this keeps all cores busy until the frame is done.
+//
+// When the caller can predict the cost of each tile, the tiles are instead dealt out
+// most expensive first to the least loaded deque, so the long tiles start immediately
+// and only cheap ones are left to be stolen at the end of the frame.
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Per-thread statistics of the last frame
+struct TileThreadStats
+{
+    double fBusyMs;             // time spent inside tile callbacks
+    double fIdleMs;             // frame time minus busy time (stealing, waiting for the last tile)
+    unsigned int nTiles;        // tiles executed
+    unsigned int nStolen;       // of which taken from another thread's deque
+};
+
+class CTileScheduler
+{
+public:
+    typedef std::function<void ( unsigned int nTile, unsigned int nThread )> TILEFN;
+
+    CTileScheduler();
+    ~CTileScheduler();
+
+    // 0 means one thread per hardware thread; the calling thread is worker 0
+    void SetThreadCount( unsigned int nThreads );
+    unsigned int GetThreadCount() const { return ( unsigned int )m_Workers.size(); }
+
+    // Calls fnTile for tiles 0 .. nTiles-1 on all threads and returns when all are done.
+    // pCost optionally gives the predicted relative cost of every tile.
+    void Run( unsigned int nTiles, const TILEFN& fnTile, const float* pCost = NULL );
+
+    const std::vector<TileThreadStats>& GetThreadStats() const { return m_Stats; }
+    double GetFrameMs() const { return m_fFrameMs; }
+
+private:
+    struct Worker
+    {
+        std::mutex lock;
+        std::deque<unsigned int> tiles;
+    };
+
+    void Distribute( unsigned int nTiles, const float* pCost );
+    void StartThreads( unsigned int nThreads );
+    void StopThreads();
+    void ThreadProc( unsigned int nThread, unsigned int nGeneration );
+    void WorkLoop( unsigned int nThread );
+    bool PopTile( unsigned int nThread, unsigned int* pTile, bool* pbStolen );
+
+    std::vector<std::unique_ptr<Worker> > m_Workers;
+    std::vector<std::thread> m_Threads;
+    std::vector<TileThreadStats> m_Stats;
+    std::vector<unsigned int> m_Order;      // scratch for Distribute
+    std::vector<double> m_Load;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_StartCV;
+    std::condition_variable m_DoneCV;
+    unsigned int m_nGeneration;             // incremented for every frame
+    unsigned int m_nRunning;                // pool threads still inside the current frame
+    bool m_bQuit;
+
+    const TILEFN* m_pfnTile;
+    std::atomic<unsigned int> m_nRemaining; // tiles not yet finished
+    double m_fFrameMs;
+};
+
+#endif // TILESCHEDULER_H
@@ -0,0 +1,288 @@
+//--------------------------------------------------------------------------------------
+// File: vmath.h
+//
+// SIMD versions of the transcendental functions used by the distance estimators.
+//
+// Polynomial approximations after Cephes (single precision), evaluated on all lanes at
+// once. Inputs are expected in the ranges the fractal kernels produce (angles within a
+// few multiples of 2*pi, positive finite logarithm arguments).
+//
+// Every function comes in two variants. The precise ones are the Cephes polynomials and
+// stay within a few ULP of the correctly rounded result; the ...Fast ones use lower
+// degree polynomials (refitted for minimax relative error), atan2 and sin/cos also a
+// cheaper range reduction, and are good to about 1e-5. Maximum error against double precision libm, as measured
+// by frac.exe -headless -mathstats over the domains it prints:
+//
+//   function   precise   fast      domain
+//   atan2      3.1 ULP   79 ULP    |y|, |x| in [2^-20, 2^20]
+//   asin       2.3 ULP   33 ULP    |x| in [2^-20, 1]
+//   sin, cos   9.2e-8    1.4e-6    x in [-16 pi, 16 pi] (*)
+//   log        0.8 ULP   25 ULP    x in [2^-126, 2^127]
+//   exp        1.3 ULP   70 ULP    x in [-87, 88]
+//   pow        64 ULP    215 ULP   x in [1/16, 4], y in [-16, 16]
+//
+// (*) absolute error: near the zeros of sin and cos a tiny error in the reduced argument
+// is a large relative one. pow is exp(y log(x)), so its error grows with |y log(x)|.
+//--------------------------------------------------------------------------------------
+#pragma once
+#ifndef VMATH_H
+#define VMATH_H
+
+#include "simd.h"
+
+namespace SIMD_ISA
+{
+
+static const float VM_PI       = 3.14159265358979f;
+static const float VM_PI_2     = 1.57079632679490f;
+static const float VM_PI_4     = 0.78539816339745f;
+static const float VM_LOG2E    = 1.44269504088896f;
+
+// atan(x), full range
+inline vfloat vatan( vfloat x )
+{
+    vfloat a = abs( x );
+
+    // Reduce to [0, tan(pi/8)]
+    vmask big = a > vfloat( 2.414213562373095f );
+    vmask mid = andnot( big, a > vfloat( 0.4142135623730950f ) );
+    vfloat y = select( big, vfloat( VM_PI_2 ), select( mid, vfloat( VM_PI_4 ), vfloat( 0.0f ) ) );
+    vfloat t = select( big, vfloat( -1.0f ) / a, select( mid, ( a - vfloat( 1.0f ) ) / ( a + vfloat( 1.0f ) ), a ) );
+
+    vfloat z = t * t;
+    vfloat p = madd( madd( madd( vfloat( 8.05374449538e-2f ), z, vfloat( -1.38776856032e-1f ) ), z,
+                           vfloat( 1.99777106478e-1f ) ), z, vfloat( -3.33329491539e-1f ) );
+    y = y + madd( p * z, t, t );
+    return xorsign( y, x );
+}
+
+// atan2(y, x), same conventions as atan2f for finite inputs
+inline vfloat vatan2( vfloat y, vfloat x )
+{
+    vfloat r = vatan( y / x );
+
+    // Quadrant correction for x < 0, with the sign of y
+    vfloat offset = select( x < vfloat( 0.0f ), xorsign( vfloat( VM_PI ), y ), vfloat( 0.0f ) );
+    r = r + offset;
+
+    // x == 0 gives +-pi/2 (or 0 for y == 0)
+    vmask xzero = x == vfloat( 0.0f );
+    r = select( xzero, select( y == vfloat( 0.0f ), vfloat( 0.0f ), xorsign( vfloat( VM_PI_2 ), y ) ), r );
+    return r;
+}
+
+// atan2(y, x) with a single division: atan of min(|x|, |y|) / max(|x|, |y|) in [0, 1],
+// then reflected into the octant of (x, y)
+inline vfloat vatan2Fast( vfloat y, vfloat x )
+{
+    vfloat ax = abs( x ), ay = abs( y );
+    vfloat hi = max( ax, ay );
+    vfloat t = select( hi == vfloat( 0.0f ), vfloat( 0.0f ), min( ax, ay ) / hi );
+
+    vfloat z = t * t;
+    vfloat p = madd( madd( madd( madd( vfloat( -1.3955090430e-2f ), z, vfloat( 5.8770229261e-2f ) ), z,
+                                 vfloat( -1.2251499153e-1f ) ), z, vfloat( 1.9618308685e-1f ) ), z,
+                     vfloat( -3.3308899961e-1f ) );
+    vfloat r = madd( p * z, t, t );
+    r = select( ay > ax, vfloat( VM_PI_2 ) - r, r );
+    r = select( x < vfloat( 0.0f ), vfloat( VM_PI ) - r, r );
+    return xorsign( r, y );
+}
+
+// asin(x), |x| <= 1
+inline vfloat vasin( vfloat x )
+{
+    vfloat a = abs( x );
+    vmask big = a > vfloat( 0.5f );
+
+    vfloat zb = vfloat( 0.5f ) * ( vfloat( 1.0f ) - a );
+    vfloat z = select( big, zb, a * a );
+    vfloat t = select( big, sqrt( zb ), a );
+
+    vfloat p = madd( madd( madd( madd( vfloat( 4.2163199048e-2f ), z, vfloat( 2.4181311049e-2f ) ), z,
+                                 vfloat( 4.5470025998e-2f ) ), z, vfloat( 7.4953002686e-2f ) ), z,
+                     vfloat( 1.6666752422e-1f ) );
+    vfloat r = madd( p * z, t, t );
+    r = select( big, vfloat( VM_PI_2 ) - ( r + r ), r );
+    return xorsign( r, x );
+}
+
+// asin(x), |x| <= 1, with a degree 7 instead of degree 11 polynomial
+inline vfloat vasinFast( vfloat x )
+{
+    vfloat a = abs( x );
+    vmask big = a > vfloat( 0.5f );
+
+    vfloat zb = vfloat( 0.5f ) * ( vfloat( 1.0f ) - a );
+    vfloat z = select( big, zb, a * a );
+    vfloat t = select( big, sqrt( zb ), a );
+
+    vfloat p = madd( madd( vfloat( 6.4107308873e-2f ), z, vfloat( 7.1899796875e-2f ) ), z, vfloat( 1.6680125941e-1f ) );
+    vfloat r = madd( p * z, t, t );
+    r = select( big, vfloat( VM_PI_2 ) - ( r + r ), r );
+    return xorsign( r, x );
+}
+
+// sin(x) and cos(x) with a single range reduction
+inline void vsincos( vfloat x, vfloat* pSin, vfloat* pCos )
+{
+    // x = q * pi/2 + y, |y| <= pi/4 (three-part Cody-Waite reduction)
+    vint q = roundi( x * vfloat( 0.636619772367581f ) );
+    vfloat fq = tofloat( q );
+    vfloat y = madd( fq, vfloat( -1.5703125f ), x );
+    y = madd( fq, vfloat( -4.837512969970703125e-4f ), y );
+    y = madd( fq, vfloat( -7.54978995489188216e-8f ), y );
+
+    vfloat z = y * y;
+    vfloat s = madd( madd( madd( vfloat( -1.9515295891e-4f ), z, vfloat( 8.3321608736e-3f ) ), z,
+                           vfloat( -1.6666654611e-1f ) ) * z, y, y );
+    vfloat c = madd( madd( madd( vfloat( 2.443315711809948e-5f ), z, vfloat( -1.388731625493765e-3f ) ), z,
+                           vfloat( 4.166664568298827e-2f ) ) * z, z, madd( vfloat( -0.5f ), z, vfloat( 1.0f ) ) );
+
+    // Quadrant: 1 and 3 swap sin and cos, the sign of sin flips in 2 and 3, of cos in 1 and 2
+    vmask swap = ( q & vint( 1 ) ) == vint( 1 );
+    vfloat sn = select( swap, c, s );
+    vfloat cs = select( swap, s, c );
+    *pSin = asfloat( asint( sn ) ^ shl<30>( q & vint( 2 ) ) );
+    *pCos = asfloat( asint( cs ) ^ shl<30>( ( q + vint( 1 ) ) & vint( 2 ) ) );
+}
+
+// sin(x) and cos(x) with a two-part reduction and degree 5 / 6 polynomials
+inline void vsincosFast( vfloat x, vfloat* pSin, vfloat* pCos )
+{
+    vint q = roundi( x * vfloat( 0.636619772367581f ) );
+    vfloat fq = tofloat( q );
+    vfloat y = madd( fq, vfloat( -1.5703125f ), x );
+    y = madd( fq, vfloat( -4.8382679489661923e-4f ), y );
+
+    vfloat z = y * y;
+    vfloat s = madd( madd( vfloat( 8.1632818896e-3f ), z, vfloat( -1.6663390376e-1f ) ) * z, y, y );
+    vfloat c = madd( madd( vfloat( -1.3648714318e-3f ), z, vfloat( 4.1661071304e-2f ) ) * z, z,
+                     madd( vfloat( -0.5f ), z, vfloat( 1.0f ) ) );
+
+    vmask swap = ( q & vint( 1 ) ) == vint( 1 );
+    vfloat sn = select( swap, c, s );
+    vfloat cs = select( swap, s, c );
+    *pSin = asfloat( asint( sn ) ^ shl<30>( q & vint( 2 ) ) );
+    *pCos = asfloat( asint( cs ) ^ shl<30>( ( q + vint( 1 ) ) & vint( 2 ) ) );
+}
+
+// Natural logarithm, x > 0
+inline vfloat vlog( vfloat x )
+{
+    // x = m * 2^e with m in [sqrt(0.5), sqrt(2))
+    vint ix = asint( x );
+    vint e = shr<23>( ix ) - vint( 126 );
+    vfloat m = asfloat( ( ix & vint( 0x007fffff ) ) | vint( 0x3f000000 ) );        // [0.5, 1)
+    vmask small = m < vfloat( 0.707106781186547524f );
+    e = select( small, e - vint( 1 ), e );
+    m = select( small, m + m, m ) - vfloat( 1.0f );
+
+    vfloat z = m * m;
+    vfloat p = vfloat( 7.0376836292e-2f );
+    p = madd( p, m, vfloat( -1.1514610310e-1f ) );
+    p = madd( p, m, vfloat( 1.1676998740e-1f ) );
+    p = madd( p, m, vfloat( -1.2420140846e-1f ) );
+    p = madd( p, m, vfloat( 1.4249322787e-1f ) );
+    p = madd( p, m, vfloat( -1.6668057665e-1f ) );
+    p = madd( p, m, vfloat( 2.0000714765e-1f ) );
+    p = madd( p, m, vfloat( -2.4999993993e-1f ) );
+    p = madd( p, m, vfloat( 3.3333331174e-1f ) );
+
+    vfloat fe = tofloat( e );
+    vfloat y = p * m * z;
+    y = madd( fe, vfloat( -2.12194440e-4f ), y );
+    y = madd( z, vfloat( -0.5f ), y );
+    return madd( fe, vfloat( 0.693359375f ), m + y );
+}
+
+// Natural logarithm, x > 0, with 5 instead of 9 polynomial terms
+inline vfloat vlogFast( vfloat x )
+{
+    vint ix = asint( x );
+    vint e = shr<23>( ix ) - vint( 126 );
+    vfloat m = asfloat( ( ix & vint( 0x007fffff ) ) | vint( 0x3f000000 ) );
+    vmask small = m < vfloat( 0.707106781186547524f );
+    e = select( small, e - vint( 1 ), e );
+    m = select( small, m + m, m ) - vfloat( 1.0f );
+
+    vfloat z = m * m;
+    vfloat p = vfloat( 1.1781895825e-1f );
+    p = madd( p, m, vfloat( -1.8407189648e-1f ) );
+    p = madd( p, m, vfloat( 2.0442188010e-1f ) );
+    p = madd( p, m, vfloat( -2.4943832748e-1f ) );
+    p = madd( p, m, vfloat( 3.3320860875e-1f ) );
+
+    vfloat fe = tofloat( e );
+    vfloat y = p * m * z;
+    y = madd( fe, vfloat( -2.12194440e-4f ), y );
+    y = madd( z, vfloat( -0.5f ), y );
+    return madd( fe, vfloat( 0.693359375f ), m + y );
+}
+
+// 2^n for integer n in [-126, 127]
+inline vfloat vpow2i( vint n )
+{
+    return asfloat( shl<23>( n + vint( 127 ) ) );
+}
+
+// e^r * 2^n = y * 2^n for the exponentials below, which reduced x to n * ln2 + r. The
+// scaling is done in two steps so that n = 128 does not overflow; results below FLT_MIN
+// flush to 0 and above FLT_MAX become infinity.
+inline vfloat vexpScale( vfloat x, vfloat fn, vfloat y )
+{
+    vint n = roundi( fn );
+    vint n1 = shr<1>( n + vint( 0x40000000 ) ) - vint( 0x20000000 );     // floor(n / 2)
+    y = y * vpow2i( n1 ) * vpow2i( n - n1 );
+    y = select( x < vfloat( -87.33654f ), vfloat( 0.0f ), y );
+    return select( x > vfloat( 88.72284f ), asfloat( vint( 0x7f800000 ) ), y );
+}
+
+// e^x
+inline vfloat vexp( vfloat x )
+{
+    // x = n * ln2 + r, |r| <= ln2 / 2 (two-part Cody-Waite reduction)
+    vfloat xc = clamp( x, vfloat( -87.33654f ), vfloat( 88.72284f ) );
+    vfloat fn = tofloat( roundi( xc * vfloat( VM_LOG2E ) ) );
+    vfloat r = madd( fn, vfloat( -0.693359375f ), xc );
+    r = madd( fn, vfloat( 2.12194440e-4f ), r );
+
+    vfloat p = vfloat( 1.9875691500e-4f );
+    p = madd( p, r, vfloat( 1.3981999507e-3f ) );
+    p = madd( p, r, vfloat( 8.3334519073e-3f ) );
+    p = madd( p, r, vfloat( 4.1665795894e-2f ) );
+    p = madd( p, r, vfloat( 1.6666665459e-1f ) );
+    p = madd( p, r, vfloat( 5.0000001201e-1f ) );
+    vfloat y = madd( p, r * r, r + vfloat( 1.0f ) );
+
+    return vexpScale( x, fn, y );
+}
+
+// e^x with a degree 4 instead of degree 7 polynomial
+inline vfloat vexpFast( vfloat x )
+{
+    vfloat xc = clamp( x, vfloat( -87.33654f ), vfloat( 88.72284f ) );
+    vfloat fn = tofloat( roundi( xc * vfloat( VM_LOG2E ) ) );
+    vfloat r = madd( fn, vfloat( -0.693359375f ), xc );
+    r = madd( fn, vfloat( 2.12194440e-4f ), r );
+
+    vfloat p = madd( madd( vfloat( 4.1277747091e-2f ), r, vfloat( 1.6753513931e-1f ) ), r, vfloat( 5.0005116027e-1f ) );
+    vfloat y = madd( p, r * r, r + vfloat( 1.0f ) );
+
+    return vexpScale( x, fn, y );
+}
+
+// x^y for x > 0
+inline vfloat vpow( vfloat x, vfloat y )
+{
+    return vexp( y * vlog( x ) );
+}
+
+inline vfloat vpowFast( vfloat x, vfloat y )
+{
+    return vexpFast( y * vlogFast( x ) );
+}
+
+} // namespace SIMD_ISA
+
+#endif // VMATH_H